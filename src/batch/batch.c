@@ -0,0 +1,220 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "batch.h"
+#include "../devices/controller.h"
+
+/*
+instances are handed out one at a time from an atomic counter, so a
+worker that finishes early just takes the next one; no per-thread queues
+are needed since every job is one independent machine
+*/
+static void run_jobs(nes_batch* batch) {
+
+    int i;
+    while((i = atomic_fetch_add(&batch->next_job, 1)) < batch->count) {
+
+        nes_machine* nes = batch->machines[i];
+        button_set(nes, batch->actions ? batch->actions[i] : 0);
+
+        for(int f = 0; f < batch->frames; f++) {
+            Run_Frame(nes);
+        }
+    }
+}
+
+static void* batch_worker(void* arg) {
+
+    nes_batch* batch = arg;
+    int seen = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    while(true) {
+        while(batch->generation == seen && !batch->quit)
+            pthread_cond_wait(&batch->start, &batch->lock);
+        if(batch->quit)
+            break;
+        seen = batch->generation;
+        pthread_mutex_unlock(&batch->lock);
+
+        run_jobs(batch);
+
+        pthread_mutex_lock(&batch->lock);
+        if(--batch->busy == 0)
+            pthread_cond_signal(&batch->finished);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+/*
+the rom is shared (and must outlive the batch), everything else is per
+instance. one worker per online cpu, minus the caller
+*/
+nes_batch* nes_batch_create(nes_rom* rom, int count) {
+
+    if(!rom || count <= 0)
+        return NULL;
+
+    nes_batch* batch = calloc(1, sizeof(nes_batch));
+    if(!batch)
+        return NULL;
+
+    batch->rom = rom;
+    batch->count = count;
+
+    size_t frame_size = sizeof(uint32_t) * 240 * 256;
+    batch->observation_stride = (frame_size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    batch->observations = aligned_alloc(CACHE_LINE, batch->observation_stride * count);
+    batch->machines = calloc(count, sizeof(nes_machine*));
+    if(!batch->observations || !batch->machines) {
+        nes_batch_destroy(batch);
+        return NULL;
+    }
+
+    for(int i = 0; i < count; i++) {
+        batch->machines[i] = Create_Machine(rom, (uint32_t (*)[256]) nes_batch_frame(batch, i));
+        if(!batch->machines[i]) {
+            nes_batch_destroy(batch);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->start, NULL);
+    pthread_cond_init(&batch->finished, NULL);
+
+    int threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if(threads > count - 1)
+        threads = count - 1;
+    if(threads < 0)
+        threads = 0;
+
+    batch->threads = calloc(threads ? threads : 1, sizeof(pthread_t));
+    for(int i = 0; i < threads; i++) {
+        if(pthread_create(&batch->threads[i], NULL, batch_worker, batch) != 0)
+            break;
+        batch->thread_count++;
+    }
+
+    return batch;
+}
+
+/*
+apply one controller state per instance (bit n = button n, NULL = none
+pressed), then run every instance for the given number of frames.
+returns once all of them are at vblank with a finished frame
+*/
+void nes_batch_step(nes_batch* batch, const uint8_t* actions, int frames) {
+
+    batch->actions = actions;
+    batch->frames = frames;
+    atomic_store(&batch->next_job, 0);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->busy = batch->thread_count;
+    batch->generation++;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+
+    run_jobs(batch);
+
+    pthread_mutex_lock(&batch->lock);
+    while(batch->busy > 0)
+        pthread_cond_wait(&batch->finished, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void nes_batch_reset(nes_batch* batch, int index) {
+
+    Reset_Machine(batch->machines[index]);
+}
+
+void nes_batch_destroy(nes_batch* batch) {
+
+    if(!batch)
+        return;
+
+    if(batch->thread_count) {
+        pthread_mutex_lock(&batch->lock);
+        batch->quit = true;
+        pthread_cond_broadcast(&batch->start);
+        pthread_mutex_unlock(&batch->lock);
+
+        for(int i = 0; i < batch->thread_count; i++)
+            pthread_join(batch->threads[i], NULL);
+    }
+    if(batch->threads) {
+        pthread_mutex_destroy(&batch->lock);
+        pthread_cond_destroy(&batch->start);
+        pthread_cond_destroy(&batch->finished);
+    }
+
+    if(batch->machines) {
+        for(int i = 0; i < batch->count; i++)
+            Destroy_Machine(batch->machines[i]);
+    }
+
+    free(batch->threads);
+    free(batch->machines);
+    free(batch->observations);
+    free(batch);
+}
+
+uint32_t* nes_batch_frame(nes_batch* batch, int index) {
+
+    return (uint32_t*)((uint8_t*)batch->observations + (batch->observation_stride * index));
+}
+
+uint8_t* nes_batch_ram(nes_batch* batch, int index) {
+
+    return batch->machines[index]->ram;
+}
+
+/*
+--batch: headless throughput check, all instances fed the same changing
+input
+*/
+int Run_Batch_Bench(char* rom_path, int count, int frames) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_batch* batch = nes_batch_create(rom, count);
+    if(!batch) {
+        Free_Rom(rom);
+        return 1;
+    }
+
+    uint8_t* actions = calloc(count, 1);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for(int f = 0; f < frames; f++) {
+        for(int i = 0; i < count; i++)
+            actions[i] = (f / 8 + i) & 0xff;
+        nes_batch_step(batch, actions, 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    printf("%d instances x %d frames on %d threads: %.2fs, %.0f frames/s\n",
+        count, frames, batch->thread_count + 1, seconds, (double)count * frames / seconds);
+
+    free(actions);
+    nes_batch_destroy(batch);
+    Free_Rom(rom);
+
+    return 0;
+}
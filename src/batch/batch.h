@@ -0,0 +1,55 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../machine.h"
+#include "../memory/rom.h"
+
+/*
+N machines over one rom, stepped in lockstep by a worker pool. every
+machine renders straight into its slot of one contiguous observation
+tensor ([N][240][256] argb, slots observation_stride bytes apart), so
+nothing is copied between a step and the caller reading it.
+*/
+typedef struct nes_batch {
+
+    nes_rom* rom;
+    int count;
+    nes_machine** machines;
+
+    uint32_t* observations;
+    size_t observation_stride; // bytes, multiple of CACHE_LINE
+
+    // worker pool, the calling thread works too
+    int thread_count;
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    int generation;
+    int busy;
+    bool quit;
+
+    // current step
+    atomic_int next_job;
+    const uint8_t* actions;
+    int frames;
+
+} nes_batch;
+
+nes_batch* nes_batch_create(nes_rom* rom, int count);
+void nes_batch_step(nes_batch* batch, const uint8_t* actions, int frames);
+void nes_batch_reset(nes_batch* batch, int index);
+void nes_batch_destroy(nes_batch* batch);
+
+uint32_t* nes_batch_frame(nes_batch* batch, int index);
+uint8_t* nes_batch_ram(nes_batch* batch, int index);
+
+int Run_Batch_Bench(char* rom_path, int count, int frames);
+
+#endif
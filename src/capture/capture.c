@@ -0,0 +1,401 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "../processing/palette.h"
+
+#define DIRECT_ALIGN 4096
+
+static const char Y4M_HEADER[] = "YUV4MPEG2 W256 H240 F60098814:1000000 Ip A8:7 C444\n";
+
+// -- files --
+
+static bool file_open(capture_file* file, const char* path, bool direct) {
+
+    memset(file, 0, sizeof(capture_file));
+    file->fd = -1;
+    file->buffer = aligned_alloc(DIRECT_ALIGN, CAPTURE_BUFFER);
+    if(!file->buffer)
+        return false;
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    // not every filesystem takes it, those get the page cache
+    if(direct) {
+        file->fd = open(path, flags | O_DIRECT, 0644);
+        file->direct = file->fd >= 0;
+    }
+#endif
+    if(file->fd < 0)
+        file->fd = open(path, flags, 0644);
+    if(file->fd < 0) {
+        printf("Could not write %s\n", path);
+        free(file->buffer);
+        file->buffer = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void direct_off(capture_file* file) {
+
+#ifdef O_DIRECT
+    if(file->direct) {
+        fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) & ~O_DIRECT);
+        file->direct = false;
+    }
+#endif
+}
+
+/*
+everything buffered, or with O_DIRECT everything up to the last whole
+block unless this is the end of the file
+*/
+static void file_flush(capture_file* file, bool end) {
+
+    size_t length = file->fill;
+    if(file->direct && (length % DIRECT_ALIGN)) {
+        if(end)
+            direct_off(file);
+        else
+            length -= length % DIRECT_ALIGN;
+    }
+
+    // positioned writes, the emulator has a write() of its own
+    size_t done = 0;
+    while(done < length && !file->failed) {
+        ssize_t written = pwrite(file->fd, file->buffer + done, length - done, file->size + done);
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            file->failed = true;
+        else
+            done += written;
+    }
+
+    memmove(file->buffer, file->buffer + length, file->fill - length);
+    file->fill -= length;
+    file->size += length;
+}
+
+static void file_write(capture_file* file, const void* data, size_t length) {
+
+    const uint8_t* bytes = data;
+    while(length > 0) {
+        size_t room = CAPTURE_BUFFER - file->fill;
+        size_t count = length < room ? length : room;
+        memcpy(file->buffer + file->fill, bytes, count);
+        file->fill += count;
+        bytes += count;
+        length -= count;
+
+        if(file->fill == CAPTURE_BUFFER)
+            file_flush(file, false);
+    }
+}
+
+/*
+over bytes already in the file, after the last flush
+*/
+static void file_patch(capture_file* file, uint64_t offset, const void* data, size_t length) {
+
+    direct_off(file);
+    if(pwrite(file->fd, data, length, offset) != (ssize_t)length)
+        file->failed = true;
+}
+
+static bool file_close(capture_file* file) {
+
+    if(file->fd < 0)
+        return false;
+
+    file_flush(file, true);
+    if(close(file->fd) != 0)
+        file->failed = true;
+    file->fd = -1;
+    free(file->buffer);
+    file->buffer = NULL;
+    return !file->failed;
+}
+
+// -- writer --
+
+/*
+bt.601, studio range
+*/
+static void convert_y4m(uint8_t* picture, uint32_t (*frame)[256]) {
+
+    uint8_t* y = picture;
+    uint8_t* u = y + 256 * 240;
+    uint8_t* v = u + 256 * 240;
+
+    for(int i = 0; i < 256 * 240; i++) {
+        uint32_t pixel = frame[0][i];
+        int r = (pixel >> 16) & 0xff;
+        int g = (pixel >> 8) & 0xff;
+        int b = pixel & 0xff;
+        y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+static uint32_t palette_rgb(int index) {
+
+    return (palette[index].r << 16) | (palette[index].g << 8) | palette[index].b;
+}
+
+/*
+the ppu only ever writes palette colours. runs of one colour are the
+common case, so the last match is tried before searching
+*/
+static void convert_indexed(uint8_t* picture, uint32_t (*frame)[256]) {
+
+    uint32_t last_rgb = palette_rgb(0);
+    uint8_t last_index = 0;
+
+    for(int i = 0; i < 256 * 240; i++) {
+        uint32_t rgb = frame[0][i] & 0xffffff;
+        if(rgb != last_rgb) {
+            last_rgb = rgb;
+            last_index = 0x0f;
+            for(int p = 0; p < 64; p++) {
+                if(palette_rgb(p) == rgb) {
+                    last_index = p;
+                    break;
+                }
+            }
+        }
+        picture[i] = last_index;
+    }
+}
+
+static void write_picture(capture* capture) {
+
+    if(capture->format == CAPTURE_Y4M)
+        file_write(&capture->video, "FRAME\n", 6);
+    file_write(&capture->video, capture->picture, capture->picture_size);
+}
+
+static void write_slot(capture* capture, capture_slot* slot) {
+
+    for(int i = 0; i < slot->dropped_frames; i++)
+        write_picture(capture);
+
+    static const int16_t silence[512];
+    for(int left = slot->dropped_samples; left > 0; left -= 512)
+        file_write(&capture->audio, silence, sizeof(int16_t) * (left < 512 ? left : 512));
+
+    if(capture->format == CAPTURE_Y4M)
+        convert_y4m(capture->picture, slot->frame);
+    else
+        convert_indexed(capture->picture, slot->frame);
+    write_picture(capture);
+
+    file_write(&capture->audio, slot->samples, sizeof(int16_t) * slot->sample_count);
+    capture->samples_written += slot->dropped_samples + slot->sample_count;
+}
+
+static void* capture_writer(void* arg) {
+
+    capture* capture = arg;
+
+    while(true) {
+        sem_wait(&capture->ready);
+
+        size_t tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&capture->head, memory_order_acquire);
+        if(tail == head) {
+            // stopping is posted after the last slot, everything is written
+            if(atomic_load(&capture->stopping))
+                break;
+            continue;
+        }
+
+        write_slot(capture, &capture->slots[tail % CAPTURE_SLOTS]);
+
+        // the slot is free for the emulation thread again
+        atomic_store_explicit(&capture->tail, tail + 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+// -- capture --
+
+static void write_headers(capture* capture) {
+
+    if(capture->format == CAPTURE_Y4M) {
+        file_write(&capture->video, Y4M_HEADER, sizeof(Y4M_HEADER) - 1);
+    }
+    else {
+        uint8_t header[20] = "NESIDX1\n";
+        uint16_t size[2] = {256, 240};
+        uint32_t rate[2] = {CAPTURE_FPS_NUM, CAPTURE_FPS_DEN};
+        memcpy(header + 8, size, sizeof(size));
+        memcpy(header + 12, rate, sizeof(rate));
+        file_write(&capture->video, header, sizeof(header));
+
+        uint8_t colors[64][3];
+        for(int i = 0; i < 64; i++) {
+            colors[i][0] = palette[i].r;
+            colors[i][1] = palette[i].g;
+            colors[i][2] = palette[i].b;
+        }
+        file_write(&capture->video, colors, sizeof(colors));
+    }
+
+    // the sizes are filled in when the capture stops
+    uint32_t wav[11];
+    make_wav_header(wav, 0, capture->rate);
+    file_write(&capture->audio, wav, WAV_HEADER_SIZE);
+}
+
+static void free_capture(capture* capture) {
+
+    if(capture->own_audio) {
+        if(capture->nes->audio == capture->own_audio)
+            capture->nes->audio = NULL;
+        Destroy_Apu_Output(capture->own_audio);
+    }
+    free(capture->video.buffer);
+    free(capture->audio.buffer);
+    free(capture->picture);
+    free(capture->slots);
+    free(capture);
+}
+
+/*
+presented frames to video_path and the machine's audio to audio_path
+(wav) until Stop_Capture(). a machine without audio attached gets an
+output of its own for the time
+*/
+capture* Start_Capture(nes_machine* nes, const char* video_path, const char* audio_path, capture_format format, bool direct) {
+
+    // head and tail each get a cache line of their own
+    capture* capture = aligned_alloc(64, sizeof(struct capture));
+    if(!capture)
+        return NULL;
+    memset(capture, 0, sizeof(struct capture));
+    capture->nes = nes;
+    capture->format = format;
+    capture->video.fd = capture->audio.fd = -1;
+    atomic_init(&capture->head, 0);
+    atomic_init(&capture->tail, 0);
+    atomic_init(&capture->stopping, false);
+
+    // touched now so the first frames do not fault their pages in
+    capture->slots = aligned_alloc(64, sizeof(capture_slot) * CAPTURE_SLOTS);
+    capture->picture_size = format == CAPTURE_Y4M ? 3 * 256 * 240 : 256 * 240;
+    capture->picture = calloc(1, capture->picture_size);
+    if(!capture->slots || !capture->picture) {
+        free_capture(capture);
+        return NULL;
+    }
+    memset(capture->slots, 0, sizeof(capture_slot) * CAPTURE_SLOTS);
+
+    if(!nes->audio) {
+        capture->own_audio = Create_Apu_Output(APU_SAMPLE_RATE);
+        if(!capture->own_audio) {
+            free_capture(capture);
+            return NULL;
+        }
+        nes->audio = capture->own_audio;
+    }
+    capture->rate = nes->audio->rate;
+
+    if(!file_open(&capture->video, video_path, direct) || !file_open(&capture->audio, audio_path, direct)) {
+        if(capture->video.fd >= 0)
+            close(capture->video.fd);
+        free_capture(capture);
+        return NULL;
+    }
+    write_headers(capture);
+
+    sem_init(&capture->ready, 0, 0);
+    if(pthread_create(&capture->writer, NULL, capture_writer, capture) != 0) {
+        sem_destroy(&capture->ready);
+        close(capture->video.fd);
+        close(capture->audio.fd);
+        free_capture(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+/*
+waits for the writer to catch up, so everything queued is on disk.
+false if anything could not be written
+*/
+bool Stop_Capture(capture* capture) {
+
+    if(!capture)
+        return true;
+
+    atomic_store(&capture->stopping, true);
+    sem_post(&capture->ready);
+    pthread_join(capture->writer, NULL);
+    sem_destroy(&capture->ready);
+
+    file_flush(&capture->audio, true);
+    uint32_t wav[11];
+    make_wav_header(wav, capture->samples_written, capture->rate);
+    file_patch(&capture->audio, 0, wav, WAV_HEADER_SIZE);
+
+    bool ok = file_close(&capture->video);
+    ok = file_close(&capture->audio) && ok;
+
+    printf("Capture stopped: %ld frames, %ld dropped\n", capture->frames + capture->dropped, capture->dropped);
+
+    free_capture(capture);
+    return ok;
+}
+
+/*
+called once per Update() with the frame presented, if any, and the
+samples read from the machine since the last call. never waits: when
+the writer is behind the frame is dropped and only counted
+*/
+void Capture_Frame(capture* capture, uint32_t (*frame)[256], const int16_t* samples, int count) {
+
+    int room = CAPTURE_SAMPLES - capture->staged_count;
+    int taken = count < room ? count : room;
+    memcpy(capture->staged + capture->staged_count, samples, sizeof(int16_t) * taken);
+    capture->staged_count += taken;
+    capture->pending_samples += count - taken;
+
+    if(!frame)
+        return;
+
+    size_t head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&capture->tail, memory_order_acquire);
+    if(head - tail == CAPTURE_SLOTS) {
+        capture->pending_frames++;
+        capture->pending_samples += capture->staged_count;
+        capture->staged_count = 0;
+        capture->dropped++;
+        return;
+    }
+
+    capture_slot* slot = &capture->slots[head % CAPTURE_SLOTS];
+    memcpy(slot->frame, frame, sizeof(slot->frame));
+    memcpy(slot->samples, capture->staged, sizeof(int16_t) * capture->staged_count);
+    slot->sample_count = capture->staged_count;
+    slot->dropped_frames = capture->pending_frames;
+    slot->dropped_samples = capture->pending_samples;
+
+    capture->staged_count = 0;
+    capture->pending_frames = 0;
+    capture->pending_samples = 0;
+    capture->frames++;
+
+    // the slot is filled before the writer can see the new head
+    atomic_store_explicit(&capture->head, head + 1, memory_order_release);
+    sem_post(&capture->ready);
+}
@@ -0,0 +1,109 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "../machine.h"
+#include "../processing/apu.h"
+
+#define CAPTURE_SLOTS 16 // frames queued for the writer, about a quarter second
+#define CAPTURE_SAMPLES 4096 // audio carried by one frame at most
+#define CAPTURE_BUFFER (1 << 20) // bytes gathered before a write, a multiple of 4096
+#define CAPTURE_FPS_NUM 60098814 // ntsc frame rate
+#define CAPTURE_FPS_DEN 1000000
+
+/*
+video the writer turns the frames into.
+
+y4m: YUV4MPEG2, 4:4:4 bt.601, 8:7 pixels. plays and converts anywhere.
+
+indexed, lossless and a third of rgb:
+    char magic[8] "NESIDX1\n"
+    uint16_t width, height
+    uint32_t fps_num, fps_den
+    uint8_t palette[64][3]
+    frames of width * height palette indices
+*/
+typedef enum capture_format {
+    CAPTURE_Y4M,
+    CAPTURE_INDEXED
+} capture_format;
+
+/*
+one presented frame and the audio made since the last one. what the
+emulation thread could not queue is counted into the next slot, the
+writer repeats the last frame and writes silence for it so the streams
+stay in sync
+*/
+typedef struct capture_slot {
+
+    uint32_t frame[240][256];
+    int16_t samples[CAPTURE_SAMPLES];
+    int sample_count;
+    int dropped_frames; // before this one
+    int dropped_samples;
+
+} capture_slot;
+
+/*
+an output file written in CAPTURE_BUFFER sized pieces. with O_DIRECT the
+buffer and every write but the last are aligned, the tail is written
+with it turned off
+*/
+typedef struct capture_file {
+
+    int fd;
+    bool direct;
+    uint8_t* buffer;
+    size_t fill;
+    uint64_t size; // bytes handed to the file so far
+    bool failed;
+
+} capture_file;
+
+/*
+the emulation thread only fills slots and moves head, the writer thread
+only empties them and moves tail. a full queue drops the frame instead
+of waiting, a semaphore wakes the writer
+*/
+typedef struct capture {
+
+    nes_machine* nes;
+    apu_output* own_audio; // made when the machine had no audio attached
+    capture_format format;
+    int rate;
+
+    capture_slot* slots; // CAPTURE_SLOTS, preallocated
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    sem_t ready;
+    atomic_bool stopping;
+    pthread_t writer;
+
+    // emulation thread
+    int16_t staged[CAPTURE_SAMPLES];
+    int staged_count;
+    int pending_frames;
+    int pending_samples;
+    long frames;
+    long dropped;
+
+    // writer thread
+    capture_file video;
+    capture_file audio;
+    uint8_t* picture; // the last frame as written, repeated for drops
+    size_t picture_size;
+    long samples_written;
+
+} capture;
+
+capture* Start_Capture(nes_machine* nes, const char* video_path, const char* audio_path, capture_format format, bool direct);
+bool Stop_Capture(capture* capture);
+
+void Capture_Frame(capture* capture, uint32_t (*frame)[256], const int16_t* samples, int count);
+
+#endif
@@ -12,6 +12,7 @@
 #include "../memory/mem.h"
 #include "../processing/cpu.h"
 #include "../processing/ppu.h"
+#include "../nes.h"
 
 
 /*
@@ -119,15 +120,15 @@ void Update_Rendered_Content(Panel* panel) {
         char* str = malloc(sizeof(char) * 9);
         strcpy(str, "nv--dizc");
 
-        sprintf(panel->debug_memory_render[0]->display_string, "PC|%02x%02x", (uint8_t)(pc >> 8), (uint8_t)pc);
-        sprintf(panel->debug_memory_render[1]->display_string, "ST|%s", status_2_text(str, status));
-        sprintf(panel->debug_memory_render[2]->display_string, "A |%02x", accumulator);
-        sprintf(panel->debug_memory_render[3]->display_string, "X |%02x", index_x);
-        sprintf(panel->debug_memory_render[4]->display_string, "Y |%02x", index_y);
-        sprintf(panel->debug_memory_render[5]->display_string, "SP|%02x", sp);
-        sprintf(panel->debug_memory_render[6]->display_string, "Line:%d", scanline);
-        sprintf(panel->debug_memory_render[7]->display_string, "Dot:%d", dot);
-        sprintf(panel->debug_memory_render[8]->display_string, "v:%04x", ppu_address);
+        sprintf(panel->debug_memory_render[0]->display_string, "PC|%02x%02x", (uint8_t)(machine->cpu.pc >> 8), (uint8_t)machine->cpu.pc);
+        sprintf(panel->debug_memory_render[1]->display_string, "ST|%s", status_2_text(str, machine->cpu.status));
+        sprintf(panel->debug_memory_render[2]->display_string, "A |%02x", machine->cpu.accumulator);
+        sprintf(panel->debug_memory_render[3]->display_string, "X |%02x", machine->cpu.index_x);
+        sprintf(panel->debug_memory_render[4]->display_string, "Y |%02x", machine->cpu.index_y);
+        sprintf(panel->debug_memory_render[5]->display_string, "SP|%02x", machine->cpu.sp);
+        sprintf(panel->debug_memory_render[6]->display_string, "Line:%d", machine->ppu.scanline);
+        sprintf(panel->debug_memory_render[7]->display_string, "Dot:%d", machine->ppu.dot);
+        sprintf(panel->debug_memory_render[8]->display_string, "v:%04x", machine->ppu.ppu_address);
         free(str);
     }
 
@@ -137,11 +138,11 @@ void Update_Rendered_Content(Panel* panel) {
         
         //sprintf(panel->debug_memory_render[i]->label, "0x%04x", (i+start_val) % panel->ADDR_RANGE);
         if(!strcmp(panel->name, "RAM")) {
-            panel->debug_memory_render[i]->data = peek_ram((i + start_val) % (panel->ADDR_RANGE+1));
+            panel->debug_memory_render[i]->data = peek_ram(machine, (i + start_val) % (panel->ADDR_RANGE+1));
             sprintf(panel->debug_memory_render[i]->display_string, "0x%04x|%02x", (i+start_val) % (panel->ADDR_RANGE+1), panel->debug_memory_render[i]->data);
         }
         else if(!strcmp(panel->name, "VRAM")) {
-            panel->debug_memory_render[i]->data = peek_vram((i + start_val) % (panel->ADDR_RANGE+1));
+            panel->debug_memory_render[i]->data = peek_vram(machine, (i + start_val) % (panel->ADDR_RANGE+1));
             sprintf(panel->debug_memory_render[i]->display_string, "0x%04x|%02x", (i+start_val) % (0x4000), panel->debug_memory_render[i]->data);
         }
     }
@@ -5,6 +5,7 @@
 
 #include "name_table.h"
 #include "../memory/mem.h"
+#include "../nes.h"
 #include "../processing/palette.h"
 
 uint32_t n_table_0[256*256];
@@ -78,12 +79,12 @@ void fetch_name_table(int table_id) {
     k = bit of byte, the column of the pixel
     */
     for(int i = 0; i < 32*30; i++) {
-        int sprite_addr = 0x1000 + (peek_vram(table_addr + i)*0x10);
+        int sprite_addr = 0x1000 + (peek_vram(machine, table_addr + i)*0x10);
 
         for(int j = 0; j < 8; j++) {
 
-            uint8_t pattern_byte = peek_vram(sprite_addr + j);
-            uint8_t pattern_byte_2 = peek_vram(sprite_addr + 8 + j);
+            uint8_t pattern_byte = peek_vram(machine, sprite_addr + j);
+            uint8_t pattern_byte_2 = peek_vram(machine, sprite_addr + 8 + j);
 
             for(int k = 0; k < 8; k++) {
 
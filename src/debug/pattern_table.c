@@ -5,6 +5,7 @@
 
 #include "pattern_table.h"
 #include "../memory/mem.h"
+#include "../nes.h"
 #include "../processing/palette.h"
 
 uint32_t p_table_0[128*128];
@@ -52,8 +53,8 @@ void fetch_pattern_table(int table) {
 
         for(int j = 0; j < 8; j++) {
 
-            uint8_t pattern_byte = peek_vram(sprite_addr + j);
-            uint8_t pattern_byte_2 = peek_vram(sprite_addr + 8 + j);
+            uint8_t pattern_byte = peek_vram(machine, sprite_addr + j);
+            uint8_t pattern_byte_2 = peek_vram(machine, sprite_addr + 8 + j);
 
             for(int k = 0; k < 8; k++) {
 
@@ -119,7 +120,7 @@ void render_palettes(SDL_Renderer* renderer) {
 
     for(int i = 0; i < 16; i++) {
         
-        int color_id = read_vram(0x3f00 + i);
+        int color_id = read_vram(machine, 0x3f00 + i);
         color = palette[color_id];
         //if(i % 4 == 0)
         //    color = palette[read_vram(0x3f00)];
@@ -136,7 +137,7 @@ void render_palettes(SDL_Renderer* renderer) {
     color_rect.y = table_1_rect.y - 32;
     for(int i = 16; i < 32; i++) {
         
-        int color_id = read_vram(0x3f00 + i);
+        int color_id = read_vram(machine, 0x3f00 + i);
         color = palette[color_id];
         //if(i % 4 == 0)
         //    color = palette[read_vram(0x3f00)];
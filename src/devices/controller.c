@@ -3,65 +3,57 @@
 #include <stdio.h>
 #include <stdint.h>
 
-uint8_t controller_reg_1 = 0;
-uint8_t controller_reg_2 = 0;
-
-uint8_t strobe = false;
-
-// A -> B -> SELECT -> START -> UP -> DOWN -> LEFT -> RIGHT
-int counter = 0;
-uint8_t buttons[8] = {0,0,0,0,0,0,0,0};
-
-uint8_t controller_read(uint16_t addr) {
-
-    if(addr == 0x4016 || 1) {
-
-        if(strobe)
-            return buttons[0];
+/*
+$4016 shifts out pad 1, $4017 pad 2. while the strobe is high the shift
+register keeps reloading, so only A comes out. a standard pad shifts 1s
+in behind the 8 buttons
+*/
+uint8_t controller_read(nes_machine* nes, uint16_t addr) {
+
+    controller_state* pad = &nes->controller;
+    int port = addr & 1;
+
+    if(pad->strobe)
+        return pad->pads[port] & 1;
+
+    uint8_t bit = pad->shift[port] & 1;
+    pad->shift[port] = (pad->shift[port] >> 1) | 0x80;
+    return bit;
+}
 
-        else {
-            if(counter > 7) {
+/*
+both ports share the strobe. the pads are latched on every write, the
+one that drops the strobe is the copy that gets shifted out
+*/
+void controller_write(nes_machine* nes, uint8_t data) { 
+    
+    controller_state* pad = &nes->controller;
 
-                return 1;
-            }
-            counter++;
-            printf("button[%d] : %d\n", counter-1, buttons[counter-1]);
-            return buttons[counter-1];
-        }
-    }
-    else {
-        //printf("button: %d = %d\n", counter-1, buttons[counter-1]);
-        return controller_reg_2;
-    }
+    pad->strobe = data & 1;
+    pad->shift[0] = pad->pads[0];
+    pad->shift[1] = pad->pads[1];
 }
 
-void controller_write(uint8_t data) { 
-    
-    data &= 1;
+/*
+the snapshot for the frame, all eight buttons at once. bit n = button n:
+A B SELECT START UP DOWN LEFT RIGHT. takes effect at the next strobe
+*/
+void button_set(nes_machine* nes, uint8_t state) {
 
-    if(data == 0) {
-        strobe = false;
-        counter = 0;
-    }
-    else
-        strobe = true;
+    nes->controller.pads[0] = state;
 }
 
-void button_down(int b) {
+uint8_t button_get(nes_machine* nes) {
 
-    buttons[b] = 1;
-    controller_reg_1 |= (1 << b);
+    return nes->controller.pads[0];
 }
 
-void button_up(int b) {
+void button_set_2(nes_machine* nes, uint8_t state) {
 
-    buttons[b] = 0;
-    controller_reg_1 &= ~(1 << b);
+    nes->controller.pads[1] = state;
 }
 
-void button_reset() {
+uint8_t button_get_2(nes_machine* nes) {
 
-    for(int i = 0; i < 8; i++) {
-        buttons[i] = 0;
-    }
-}
\ No newline at end of file
+    return nes->controller.pads[1];
+}
@@ -1,11 +1,11 @@
 #include <stdint.h>
 
-extern uint8_t controller_reg_1;
-extern uint8_t controller_reg_2;
+#include "../machine.h"
 
-uint8_t controller_read(uint16_t addr);
-void controller_write(uint8_t data);
+uint8_t controller_read(nes_machine* nes, uint16_t addr);
+void controller_write(nes_machine* nes, uint8_t data);
 
-void button_down(int b);
-void button_up(int b);
-void button_reset();
\ No newline at end of file
+void button_set(nes_machine* nes, uint8_t state);
+uint8_t button_get(nes_machine* nes);
+void button_set_2(nes_machine* nes, uint8_t state);
+uint8_t button_get_2(nes_machine* nes);
@@ -0,0 +1,169 @@
+#include "sound.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -- ring --
+
+static size_t ring_fill(sound_ring* ring) {
+
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/*
+copies in as much as fits, returns how much that was
+*/
+static int ring_write(sound_ring* ring, const int16_t* samples, int count) {
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t room = SOUND_RING_SIZE - (head - tail);
+    if((size_t)count > room)
+        count = room;
+
+    size_t start = head & (SOUND_RING_SIZE - 1);
+    size_t first = SOUND_RING_SIZE - start < (size_t)count ? SOUND_RING_SIZE - start : (size_t)count;
+    memcpy(ring->samples + start, samples, sizeof(int16_t) * first);
+    memcpy(ring->samples, samples + first, sizeof(int16_t) * (count - first));
+
+    // the samples are in before the callback can see the new head
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+static int ring_read(sound_ring* ring, int16_t* samples, int count) {
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if((size_t)count > head - tail)
+        count = head - tail;
+
+    size_t start = tail & (SOUND_RING_SIZE - 1);
+    size_t first = SOUND_RING_SIZE - start < (size_t)count ? SOUND_RING_SIZE - start : (size_t)count;
+    memcpy(samples, ring->samples + start, sizeof(int16_t) * first);
+    memcpy(samples + first, ring->samples, sizeof(int16_t) * (count - first));
+
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+// -- device --
+
+/*
+runs on SDL's audio thread. whatever the ring is short is played as
+silence, the output is centred on zero so that does not click much
+*/
+static void audio_callback(void* userdata, Uint8* stream, int length) {
+
+    sound_device* sound = userdata;
+    int16_t* samples = (int16_t*)stream;
+    int count = length / sizeof(int16_t);
+
+    int got = ring_read(&sound->ring, samples, count);
+    if(got < count) {
+        memset(samples + got, 0, sizeof(int16_t) * (count - got));
+        atomic_fetch_add_explicit(&sound->underruns, count - got, memory_order_relaxed);
+    }
+}
+
+sound_device* Create_Sound(nes_machine* nes, int rate) {
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        fprintf(stderr, "Failed to init SDL audio: %s\n", SDL_GetError());
+        return NULL;
+    }
+
+    // the head and tail each get a cache line of their own
+    sound_device* sound = aligned_alloc(64, sizeof(sound_device));
+    if(!sound)
+        return NULL;
+    memset(sound, 0, sizeof(sound_device));
+    atomic_init(&sound->ring.head, 0);
+    atomic_init(&sound->ring.tail, 0);
+    atomic_init(&sound->underruns, 0);
+
+    SDL_AudioSpec wanted = {0};
+    wanted.freq = rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = SOUND_DEVICE_SAMPLES;
+    wanted.callback = audio_callback;
+    wanted.userdata = sound;
+
+    SDL_AudioSpec obtained;
+    sound->device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if(sound->device == 0) {
+        fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
+        free(sound);
+        return NULL;
+    }
+
+    if(obtained.freq > SOUND_MAX_RATE) {
+        fprintf(stderr, "Audio device rate %d Hz is too high\n", obtained.freq);
+        SDL_CloseAudioDevice(sound->device);
+        free(sound);
+        return NULL;
+    }
+
+    sound->nes = nes;
+    sound->rate = obtained.freq;
+    sound->stretch = 1;
+    sound->out = Create_Apu_Output(APU_SAMPLE_RATE);
+    if(!sound->out || !Init_Resampler(&sound->resampler, APU_SAMPLE_RATE, sound->rate)) {
+        SDL_CloseAudioDevice(sound->device);
+        Destroy_Apu_Output(sound->out);
+        free(sound);
+        return NULL;
+    }
+    nes->audio = sound->out;
+
+    SDL_PauseAudioDevice(sound->device, 0);
+    return sound;
+}
+
+void Destroy_Sound(sound_device* sound) {
+
+    if(!sound)
+        return;
+
+    // closing waits for a callback in progress, nothing reads the ring after
+    SDL_CloseAudioDevice(sound->device);
+    if(sound->nes->audio == sound->out)
+        sound->nes->audio = NULL;
+    Destroy_Apu_Output(sound->out);
+    Shut_Down_Resampler(&sound->resampler);
+    free(sound);
+}
+
+/*
+after Run_Frame(): hand the frame's samples, as read from sound->out, to
+the callback. a full ring means the card is slower than us, make fewer
+samples; a ring running low means make more
+*/
+void Sound_Frame(sound_device* sound, const int16_t* samples, int count) {
+
+    // what the card still has queued, before this frame's samples go in
+    double error = ((double)SOUND_TARGET_FILL - (double)ring_fill(&sound->ring)) / SOUND_TARGET_FILL;
+    if(error > 1)
+        error = 1;
+    if(error < -1)
+        error = -1;
+
+    sound->stretch = 1 + SOUND_MAX_STRETCH * error;
+    Resampler_Set_Rates(&sound->resampler, APU_SAMPLE_RATE, sound->rate * sound->stretch);
+
+    int16_t resampled[512 * SOUND_MAX_RATE / APU_SAMPLE_RATE * 2];
+    for(int i = 0; i < count; i += 512) {
+        int made = Resample(&sound->resampler, samples + i, count - i < 512 ? count - i : 512, resampled);
+        sound->overruns += made - ring_write(&sound->ring, resampled, made);
+    }
+}
+
+/*
+with audio as the master clock a frame runs whenever the card has used
+up enough that the ring is below its target
+*/
+bool Sound_Wants_Frame(sound_device* sound) {
+
+    return ring_fill(&sound->ring) < SOUND_TARGET_FILL;
+}
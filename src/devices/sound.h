@@ -0,0 +1,59 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <SDL2/SDL.h>
+
+#include "../machine.h"
+#include "../processing/apu.h"
+#include "../processing/resample.h"
+
+#define SOUND_RING_SIZE 8192 // samples, a power of two
+#define SOUND_DEVICE_SAMPLES 512 // per callback
+#define SOUND_TARGET_FILL 2048 // samples queued that rate control aims for
+#define SOUND_MAX_STRETCH 0.005 // of the output rate, either way
+#define SOUND_MAX_RATE 192000 // of the card
+
+/*
+single producer, single consumer. the emulation loop only moves head and
+the audio callback only moves tail, so neither ever waits on the other
+*/
+typedef struct sound_ring {
+
+    _Alignas(64) atomic_size_t head; // samples ever written
+    _Alignas(64) atomic_size_t tail; // samples ever read
+    int16_t samples[SOUND_RING_SIZE];
+
+} sound_ring;
+
+/*
+the machine's audio on the sound card. the apu always makes
+APU_SAMPLE_RATE, every frame that is resampled to the card's rate
+stretched a little by how full the ring is, so a card whose clock runs a
+bit apart from the emulation neither runs dry nor piles up latency
+*/
+typedef struct sound_device {
+
+    nes_machine* nes;
+    apu_output* out;
+    SDL_AudioDeviceID device;
+    int rate; // of the card
+    double stretch; // output rate over card rate, last set
+    resampler resampler;
+
+    sound_ring ring;
+    atomic_long underruns; // samples the callback had to make up
+    long overruns; // samples the ring had no room for
+
+} sound_device;
+
+sound_device* Create_Sound(nes_machine* nes, int rate);
+void Destroy_Sound(sound_device* sound);
+
+void Sound_Frame(sound_device* sound, const int16_t* samples, int count);
+bool Sound_Wants_Frame(sound_device* sound);
+
+#endif
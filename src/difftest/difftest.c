@@ -0,0 +1,398 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "difftest.h"
+#include "../state.h"
+#include "../processing/cpu.h"
+#include "../devices/controller.h"
+
+static void no_render(nes_machine* nes) {
+
+    nes->skip_render = true;
+}
+
+/*
+the reference is the plain interpreter. new engines go in this table and
+are then covered by --difftest and --fuzz
+*/
+static const diff_engine engines[] = {
+    {"reference", NULL, Step_Machine},
+    {"norender", no_render, Step_Machine}, // run-ahead, rollback and search frames
+};
+
+const diff_engine* Find_Diff_Engine(const char* name) {
+
+    for(size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if(strcmp(engines[i].name, name) == 0)
+            return &engines[i];
+    }
+
+    printf("Unknown engine %s, one of:", name);
+    for(size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        printf(" %s", engines[i].name);
+    }
+    printf("\n");
+    return NULL;
+}
+
+static uint64_t next_random(uint64_t* state) {
+
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int operand_size(enum ADDRESS_MODE mode) {
+
+    switch(mode) {
+        case IMPLIED:
+        case ACCUMULATOR:
+            return 0;
+        case ABSOLUTE:
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+        case INDIRECT:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+/*
+absolute operands mostly land somewhere that does something: RAM, the ppu
+and apu/controller registers, prg ram and rom
+*/
+static uint16_t fuzz_address(uint64_t* random) {
+
+    uint64_t r = next_random(random);
+    switch(r % 10) {
+        case 0: case 1: case 2: case 3: case 4:
+            return (r >> 8) & 0x7ff;
+        case 5: case 6:
+            return 0x2000 + ((r >> 8) & 7);
+        case 7:
+            return 0x4000 + ((r >> 8) % 0x18);
+        case 8:
+            return 0x6000 + ((r >> 8) & 0x1fff);
+        default:
+            return 0x8000 + ((r >> 8) & 0x7fef);
+    }
+}
+
+/*
+a 32k/8k mapper 0 cart full of random instructions. chr is random too, so
+sprites and sprite 0 hits happen once the program turns rendering on
+*/
+nes_rom* Create_Fuzz_Rom(uint64_t seed) {
+
+    long prg_size = 0x8000;
+    long chr_size = 0x2000;
+    long size = HEADER_SIZE + prg_size + chr_size;
+
+    // anonymous mapping, so Free_Rom() works on it like on a rom file
+    uint8_t* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    nes_rom* rom = calloc(1, sizeof(nes_rom));
+    if(data == MAP_FAILED || !rom) {
+        if(data != MAP_FAILED)
+            munmap(data, size);
+        free(rom);
+        return NULL;
+    }
+
+    // straight from opcode_table, the cpu's decode table may not be built yet
+    const opcode* opcodes[256];
+    int opcode_count = 0;
+    bool found[256] = {false};
+    for(int i = 0; i < 256; i++) {
+        uint8_t op = opcode_table[i].OPCODE;
+        if(!found[op]) {
+            found[op] = true;
+            opcodes[opcode_count++] = &opcode_table[i];
+        }
+    }
+
+    uint64_t random = seed * 0x9e3779b97f4a7c15ULL + 1;
+    uint8_t* prg = data + HEADER_SIZE;
+    int pc = 0;
+    while(pc < prg_size - 8) {
+        opcode op = *opcodes[next_random(&random) % opcode_count];
+        prg[pc++] = op.OPCODE;
+
+        int operands = operand_size(op.MODE);
+        if(operands == 2) {
+            uint16_t addr = fuzz_address(&random);
+            prg[pc++] = addr & 0xff;
+            prg[pc++] = addr >> 8;
+        }
+        else if(operands == 1) {
+            prg[pc++] = next_random(&random) & 0xff;
+        }
+    }
+
+    uint8_t* chr = prg + prg_size;
+    for(long i = 0; i < chr_size; i++) {
+        chr[i] = next_random(&random) & 0xff;
+    }
+
+    // nmi and irq somewhere random, reset at the start
+    uint16_t vectors[3] = {fuzz_address(&random) | 0x8000, 0x8000, fuzz_address(&random) | 0x8000};
+    for(int i = 0; i < 3; i++) {
+        prg[prg_size - 6 + (i * 2)] = vectors[i] & 0xff;
+        prg[prg_size - 5 + (i * 2)] = vectors[i] >> 8;
+    }
+
+    memcpy(data, "NES\x1a", 4);
+    data[4] = prg_size / PRG_ROM_BLOCK_SIZE;
+    data[5] = chr_size / CHR_ROM_BLOCK_SIZE;
+    data[6] = 1; // vertical mirroring
+
+    rom->data = data;
+    rom->size = size;
+    rom->prg_offset = HEADER_SIZE;
+    Parse_Header(data, size, &rom->header);
+    rom->prg_length = prg_size / PRG_ROM_BLOCK_SIZE;
+    rom->chr_length = chr_size / CHR_ROM_BLOCK_SIZE;
+    rom->identity.crc32 = crc32_update(0, prg, prg_size + chr_size);
+    snprintf(rom->path, sizeof(rom->path), "fuzz-%llu.nes", (unsigned long long)seed);
+
+    return rom;
+}
+
+bool Init_Difftest(difftest* test, nes_rom* rom, const diff_engine* candidate) {
+
+    memset(test, 0, sizeof(difftest));
+    test->reference = &engines[0];
+    test->candidate = candidate;
+    test->expected = Create_Machine(rom, NULL);
+    test->actual = Create_Machine(rom, NULL);
+    if(!test->expected || !test->actual) {
+        Shut_Down_Difftest(test);
+        return false;
+    }
+
+    if(test->reference->prepare)
+        test->reference->prepare(test->expected);
+    if(test->candidate->prepare)
+        test->candidate->prepare(test->actual);
+    test->expected->ppu.frame_complete = test->actual->ppu.frame_complete = false;
+
+    return true;
+}
+
+void Shut_Down_Difftest(difftest* test) {
+
+    Destroy_Machine(test->expected);
+    Destroy_Machine(test->actual);
+    test->expected = test->actual = NULL;
+}
+
+static void print_record(const char* name, const diff_record* record) {
+
+    const cpu_state* cpu = &record->cpu;
+    printf("  %-10s pc=%04x a=%02x x=%02x y=%02x sp=%02x p=%02x %d cycles:",
+        name, cpu->pc, cpu->accumulator, cpu->index_x, cpu->index_y, cpu->sp, cpu->status, record->cycles);
+
+    int count = record->bus.count < BUS_TRACE_MAX ? record->bus.count : BUS_TRACE_MAX;
+    for(int i = 0; i < count; i++) {
+        const bus_access* access = &record->bus.accesses[i];
+        printf(" %c%04x=%02x", access->write ? 'w' : 'r', access->addr, access->value);
+    }
+    if(record->bus.count > count)
+        printf(" +%d", record->bus.count - count);
+    printf("\n");
+}
+
+/*
+the last few instructions of both sides, oldest first, then the registers
+each side ended up with
+*/
+static void print_window(difftest* test, const char* problem) {
+
+    printf("mismatch after %ld instructions, frame %d: %s\n", test->instructions, test->frames, problem);
+
+    long shown = test->instructions < DIFF_WINDOW ? test->instructions : DIFF_WINDOW;
+    for(long i = test->instructions - shown; i < test->instructions; i++) {
+        int slot = i % DIFF_WINDOW;
+        print_record(test->reference->name, &test->history[0][slot]);
+        print_record(test->candidate->name, &test->history[1][slot]);
+    }
+
+    diff_record now[2] = {{.cpu = test->expected->cpu}, {.cpu = test->actual->cpu}};
+    printf("now:\n");
+    print_record(test->reference->name, &now[0]);
+    print_record(test->candidate->name, &now[1]);
+}
+
+static bool same_cpu(const cpu_state* a, const cpu_state* b) {
+
+    return a->pc == b->pc && a->sp == b->sp && a->status == b->status && a->accumulator == b->accumulator
+        && a->index_x == b->index_x && a->index_y == b->index_y && a->irq == b->irq && a->nmi == b->nmi;
+}
+
+static bool same_bus(const bus_trace* a, const bus_trace* b) {
+
+    if(a->count != b->count)
+        return false;
+
+    int count = a->count < BUS_TRACE_MAX ? a->count : BUS_TRACE_MAX;
+    for(int i = 0; i < count; i++) {
+        const bus_access* x = &a->accesses[i];
+        const bus_access* y = &b->accesses[i];
+        if(x->addr != y->addr || x->value != y->value || x->write != y->write)
+            return false;
+    }
+    return true;
+}
+
+/*
+one instruction on both sides. registers and bus traffic are compared
+every instruction, the whole machine at every frame boundary. false on the
+first difference, after printing it
+*/
+bool Difftest_Step(difftest* test) {
+
+    nes_machine* machines[2] = {test->expected, test->actual};
+    const diff_engine* engines[2] = {test->reference, test->candidate};
+    int slot = test->instructions % DIFF_WINDOW;
+
+    for(int k = 0; k < 2; k++) {
+        diff_record* record = &test->history[k][slot];
+        record->cpu = machines[k]->cpu;
+        record->bus.count = 0;
+
+        machines[k]->trace = &record->bus;
+        record->cycles = engines[k]->step(machines[k]);
+        machines[k]->trace = NULL;
+    }
+    test->instructions++;
+
+    const char* problem = NULL;
+    if(test->history[0][slot].cycles != test->history[1][slot].cycles)
+        problem = "cycle count";
+    else if(!same_bus(&test->history[0][slot].bus, &test->history[1][slot].bus))
+        problem = "bus traffic";
+    else if(!same_cpu(&test->expected->cpu, &test->actual->cpu))
+        problem = "registers";
+
+    char section[64];
+    // vblank, where Run_Frame() would return
+    if(!problem && test->expected->ppu.frame_complete) {
+        test->frames++;
+
+        state_hash expected, actual;
+        Hash_Machine(test->expected, &expected);
+        Hash_Machine(test->actual, &actual);
+        test->expected->ppu.frame_complete = test->actual->ppu.frame_complete = false;
+        int diff = State_Hash_Diff(&expected, &actual);
+        if(diff >= 0) {
+            snprintf(section, sizeof(section), "machine state, %.4s section",
+                diff < expected.count ? (const char*)&expected.ids[diff] : "?");
+            problem = section;
+        }
+    }
+
+    if(problem) {
+        print_window(test, problem);
+        return false;
+    }
+    return true;
+}
+
+static double seconds_since(struct timespec* begin) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--difftest: a rom in lockstep on the reference and another engine, with
+the same scripted input as --hash
+*/
+int Run_Difftest(char* rom_path, const char* engine, int frames) {
+
+    const diff_engine* candidate = Find_Diff_Engine(engine);
+    nes_rom* rom = candidate ? Parse_Rom(rom_path) : NULL;
+    if(!rom)
+        return 1;
+
+    difftest test;
+    if(!Init_Difftest(&test, rom, candidate)) {
+        Free_Rom(rom);
+        return 1;
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    bool ok = true;
+    while(ok && test.frames < frames) {
+        int frame = test.frames;
+        ok = Difftest_Step(&test);
+        if(test.frames != frame) {
+            button_set(test.expected, (test.frames / 8) & 0xff);
+            button_set(test.actual, (test.frames / 8) & 0xff);
+        }
+    }
+
+    if(ok)
+        printf("%s matches %s: %d frames, %ld instructions in %.2fs\n",
+            candidate->name, test.reference->name, test.frames, test.instructions, seconds_since(&begin));
+
+    Shut_Down_Difftest(&test);
+    Free_Rom(rom);
+
+    return ok ? 0 : 1;
+}
+
+/*
+--fuzz: random programs on synthetic carts, each run for a fixed number
+of instructions. a failing seed can be run again on its own
+*/
+int Run_Fuzz(int programs, const char* engine, uint64_t seed) {
+
+    const diff_engine* candidate = Find_Diff_Engine(engine);
+    if(!candidate)
+        return 1;
+
+    const long instructions = 200000;
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    long total = 0;
+    int frames = 0;
+    bool ok = true;
+    for(int p = 0; p < programs && ok; p++) {
+        nes_rom* rom = Create_Fuzz_Rom(seed + p);
+        difftest test;
+        if(!rom || !Init_Difftest(&test, rom, candidate)) {
+            Free_Rom(rom);
+            return 1;
+        }
+
+        while(ok && test.instructions < instructions) {
+            ok = Difftest_Step(&test);
+        }
+        if(!ok)
+            printf("failing program: seed %llu\n", (unsigned long long)(seed + p));
+
+        total += test.instructions;
+        frames += test.frames;
+        Shut_Down_Difftest(&test);
+        Free_Rom(rom);
+    }
+
+    if(ok)
+        printf("%s matches %s: %d programs, %ld instructions, %d frames in %.2fs\n",
+            candidate->name, engines[0].name, programs, total, frames, seconds_since(&begin));
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+#ifndef DIFFTEST_H
+#define DIFFTEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../machine.h"
+#include "../memory/rom.h"
+
+#define DIFF_WINDOW 16 // instructions shown before a mismatch
+
+/*
+a way of running the machine. every engine has to end up exactly where
+the reference one does, instruction by instruction: same registers, same
+bus accesses in the same order, same state at every frame
+*/
+typedef struct diff_engine {
+
+    const char* name;
+    void (*prepare)(nes_machine* nes); // once, after power on. may be NULL
+    int (*step)(nes_machine* nes); // one instruction and its ppu dots, returns cpu cycles
+
+} diff_engine;
+
+/*
+what one instruction did, kept in a ring for the trace window
+*/
+typedef struct diff_record {
+
+    cpu_state cpu; // before the instruction
+    int cycles;
+    bus_trace bus;
+
+} diff_record;
+
+typedef struct difftest {
+
+    const diff_engine* reference;
+    const diff_engine* candidate;
+    nes_machine* expected; // runs reference
+    nes_machine* actual; // runs candidate
+
+    long instructions;
+    int frames;
+    diff_record history[2][DIFF_WINDOW];
+
+} difftest;
+
+const diff_engine* Find_Diff_Engine(const char* name);
+
+nes_rom* Create_Fuzz_Rom(uint64_t seed);
+
+bool Init_Difftest(difftest* test, nes_rom* rom, const diff_engine* candidate);
+void Shut_Down_Difftest(difftest* test);
+bool Difftest_Step(difftest* test);
+
+int Run_Difftest(char* rom_path, const char* engine, int frames);
+int Run_Fuzz(int programs, const char* engine, uint64_t seed);
+
+#endif
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "input.h"
+#include "../devices/controller.h"
+
+/*
+poll the source and hand its pads to the machine for the next frame
+*/
+bool Input_Frame(nes_machine* nes, input_source* source) {
+
+    uint8_t pads[CONTROLLER_PORTS] = {button_get(nes), button_get_2(nes)};
+    if(!source->poll(source->context, nes, pads))
+        return false;
+
+    button_set(nes, pads[0]);
+    button_set_2(nes, pads[1]);
+    return true;
+}
+
+// -- keyboard --
+
+/*
+pad 1 on the letters, pad 2 on the keypad
+*/
+void Init_Keyboard_Input(input_keyboard* keyboard) {
+
+    static const SDL_Scancode bindings[CONTROLLER_PORTS][8] = {
+        {SDL_SCANCODE_K, SDL_SCANCODE_L, SDL_SCANCODE_M, SDL_SCANCODE_N,
+            SDL_SCANCODE_W, SDL_SCANCODE_S, SDL_SCANCODE_A, SDL_SCANCODE_D},
+        {SDL_SCANCODE_KP_1, SDL_SCANCODE_KP_2, SDL_SCANCODE_KP_MINUS, SDL_SCANCODE_KP_ENTER,
+            SDL_SCANCODE_KP_8, SDL_SCANCODE_KP_5, SDL_SCANCODE_KP_4, SDL_SCANCODE_KP_6}
+    };
+
+    memset(keyboard, 0, sizeof(input_keyboard));
+    memcpy(keyboard->bindings, bindings, sizeof(bindings));
+}
+
+/*
+true when the key is bound to a button. repeats are ignored
+*/
+bool Keyboard_Input_Event(input_keyboard* keyboard, const SDL_Event* event) {
+
+    if(event->type != SDL_KEYDOWN && event->type != SDL_KEYUP)
+        return false;
+
+    for(int port = 0; port < CONTROLLER_PORTS; port++) {
+        for(int b = 0; b < 8; b++) {
+            if(keyboard->bindings[port][b] != event->key.keysym.scancode)
+                continue;
+
+            if(event->type == SDL_KEYUP)
+                keyboard->held[port] &= ~(1 << b);
+            else if(!event->key.repeat) {
+                keyboard->held[port] |= 1 << b;
+                keyboard->pressed[port] |= 1 << b;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool keyboard_poll(void* context, nes_machine* nes, uint8_t pads[CONTROLLER_PORTS]) {
+
+    input_keyboard* keyboard = context;
+    (void)nes;
+
+    for(int port = 0; port < CONTROLLER_PORTS; port++) {
+        pads[port] = keyboard->held[port] | keyboard->pressed[port];
+        keyboard->pressed[port] = 0;
+    }
+    return true;
+}
+
+input_source Keyboard_Input(input_keyboard* keyboard) {
+
+    return (input_source) {"keyboard", keyboard_poll, keyboard};
+}
+
+// -- movie --
+
+/*
+Movie_Frame() records or applies pad 1 on the machine and hashes it, the
+pads are read back from there
+*/
+static bool movie_poll(void* context, nes_machine* nes, uint8_t pads[CONTROLLER_PORTS]) {
+
+    input_movie* feed = context;
+
+    if(feed->film->mode == MOVIE_RECORDING) {
+        if(!feed->live.poll(feed->live.context, nes, pads))
+            return false;
+        button_set(nes, pads[0]);
+        button_set_2(nes, 0);
+    }
+
+    if(!Movie_Frame(feed->film))
+        return false;
+
+    pads[0] = button_get(nes);
+    pads[1] = button_get_2(nes);
+    return true;
+}
+
+input_source Movie_Input(input_movie* feed) {
+
+    return (input_source) {"movie", movie_poll, feed};
+}
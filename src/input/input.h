@@ -0,0 +1,59 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#include "../machine.h"
+#include "../movie.h"
+
+/*
+where a frame's pads come from: the keyboard, a movie, the network or a
+script. poll is called once before a frame and fills one byte per port,
+bit n = button n (see button_set()), which the machine takes whole. a
+source that has run out returns false.
+
+drivers that run frames themselves (netplay, the batch api, the
+benchmarks) put their snapshot in with button_set() the same way
+*/
+typedef struct input_source {
+
+    const char* name;
+    bool (*poll)(void* context, nes_machine* nes, uint8_t pads[CONTROLLER_PORTS]);
+    void* context;
+
+} input_source;
+
+/*
+sdl key events are folded into the next snapshot. a button pressed and
+let go between two polls still counts as pressed for that frame
+*/
+typedef struct input_keyboard {
+
+    SDL_Scancode bindings[CONTROLLER_PORTS][8];
+    uint8_t held[CONTROLLER_PORTS];
+    uint8_t pressed[CONTROLLER_PORTS]; // went down since the last poll
+
+} input_keyboard;
+
+/*
+a movie plays its pads back, or records what live gives it. movies carry
+pad 1 only, pad 2 stays empty while recording so a replay matches
+*/
+typedef struct input_movie {
+
+    movie* film;
+    input_source live;
+
+} input_movie;
+
+bool Input_Frame(nes_machine* nes, input_source* source);
+
+void Init_Keyboard_Input(input_keyboard* keyboard);
+bool Keyboard_Input_Event(input_keyboard* keyboard, const SDL_Event* event);
+input_source Keyboard_Input(input_keyboard* keyboard);
+
+input_source Movie_Input(input_movie* feed);
+
+#endif
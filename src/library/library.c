@@ -0,0 +1,440 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "library.h"
+#include "../memory/rom.h"
+#include "../memory/rom_db.h"
+
+const char* CATALOG_PATH = "../../ROMS/catalog.bin";
+
+/*
+catalog file: header, count entries, then a string table of
+nul-terminated paths
+*/
+static const char CATALOG_MAGIC[8] = {'N','E','S','C','A','T','L','G'};
+static const uint32_t CATALOG_VERSION = 2;
+
+typedef struct catalog_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t strings_size;
+} catalog_header;
+
+typedef struct scan_job {
+    char* path;
+    catalog_entry entry;
+    bool reused;
+} scan_job;
+
+typedef struct scan_state {
+    scan_job* jobs;
+    int count;
+    int capacity;
+
+    atomic_int next_job;
+    atomic_int hashed;
+
+    // previous catalog, for skipping unchanged files
+    rom_catalog previous;
+    int* previous_index; // open addressed, -1 = empty
+    int previous_capacity;
+
+    // directories walked so far, symlinks can lead back into one
+    dev_t* walked_dev;
+    ino_t* walked_ino;
+    int walked_count;
+    int walked_capacity;
+} scan_state;
+
+static uint64_t hash_string(const char* str) {
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for(; *str; str++) {
+        hash ^= (uint8_t)*str;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+const char* catalog_path(const rom_catalog* catalog, const catalog_entry* entry) {
+
+    return catalog->strings + entry->path_offset;
+}
+
+// catalog loading
+
+bool Load_Catalog(const char* catalog_file, rom_catalog* catalog) {
+
+    memset(catalog, 0, sizeof(rom_catalog));
+
+    int fd = open(catalog_file, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat catalog_stat;
+    if(fstat(fd, &catalog_stat) != 0 || catalog_stat.st_size < (off_t)sizeof(catalog_header)) {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(NULL, catalog_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    const catalog_header* header = mapping;
+    size_t entries_size = (size_t)header->count * sizeof(catalog_entry);
+    size_t available = catalog_stat.st_size - sizeof(catalog_header);
+    if(memcmp(header->magic, CATALOG_MAGIC, 8) != 0 || header->version != CATALOG_VERSION
+        || entries_size > available || header->strings_size > available - entries_size) {
+        munmap(mapping, catalog_stat.st_size);
+        return false;
+    }
+
+    // every path has to start and end inside the string table
+    const catalog_entry* entries = (const catalog_entry*)((const uint8_t*)mapping + sizeof(catalog_header));
+    const char* strings = (const char*)entries + entries_size;
+    for(uint32_t i = 0; i < header->count; i++) {
+        uint32_t offset = entries[i].path_offset;
+        if(offset >= header->strings_size || !memchr(strings + offset, '\0', header->strings_size - offset)) {
+            munmap(mapping, catalog_stat.st_size);
+            return false;
+        }
+    }
+
+    catalog->mapping = mapping;
+    catalog->mapping_size = catalog_stat.st_size;
+    catalog->count = header->count;
+    catalog->entries = entries;
+    catalog->strings = strings;
+
+    return true;
+}
+
+void Close_Catalog(rom_catalog* catalog) {
+
+    if(catalog->mapping)
+        munmap(catalog->mapping, catalog->mapping_size);
+    memset(catalog, 0, sizeof(rom_catalog));
+}
+
+void Print_Catalog(const rom_catalog* catalog, bool runnable_only) {
+
+    for(int i = 0; i < catalog->count; i++) {
+        const catalog_entry* entry = &catalog->entries[i];
+        if(runnable_only && !(entry->flags & CATALOG_SUPPORTED))
+            continue;
+
+        printf("%08x  mapper %3d.%-2d  %s%s  %s\n", entry->crc32, entry->mapper, entry->submapper,
+            (entry->flags & CATALOG_SUPPORTED) ? "ok " : ((entry->flags & CATALOG_INVALID) ? "bad" : "---"),
+            (entry->flags & CATALOG_KNOWN) ? "*" : " ", catalog_path(catalog, entry));
+    }
+}
+
+// scanning
+
+static const catalog_entry* previous_entry(scan_state* state, const char* path) {
+
+    if(!state->previous_capacity)
+        return NULL;
+
+    int mask = state->previous_capacity - 1;
+    for(int i = hash_string(path) & mask; state->previous_index[i] >= 0; i = (i + 1) & mask) {
+        const catalog_entry* entry = &state->previous.entries[state->previous_index[i]];
+        if(strcmp(catalog_path(&state->previous, entry), path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void index_previous(scan_state* state) {
+
+    int capacity = 16;
+    while(capacity < state->previous.count * 2)
+        capacity *= 2;
+
+    state->previous_capacity = capacity;
+    state->previous_index = malloc(capacity * sizeof(int));
+    memset(state->previous_index, -1, capacity * sizeof(int));
+
+    for(int n = 0; n < state->previous.count; n++) {
+        const char* path = catalog_path(&state->previous, &state->previous.entries[n]);
+        int i = hash_string(path) & (capacity - 1);
+        while(state->previous_index[i] >= 0)
+            i = (i + 1) & (capacity - 1);
+        state->previous_index[i] = n;
+    }
+}
+
+static bool is_rom(const char* name) {
+
+    size_t length = strlen(name);
+    return length > 4 && strcasecmp(name + length - 4, ".nes") == 0;
+}
+
+/*
+directory walk only reads metadata, so it stays on one thread and the
+pool does the expensive part (header parse + hashing)
+*/
+static bool walked_before(scan_state* state, const char* dir_path) {
+
+    struct stat dir_stat;
+    if(stat(dir_path, &dir_stat) != 0)
+        return true;
+
+    for(int i = 0; i < state->walked_count; i++) {
+        if(state->walked_dev[i] == dir_stat.st_dev && state->walked_ino[i] == dir_stat.st_ino)
+            return true;
+    }
+
+    if(state->walked_count == state->walked_capacity) {
+        state->walked_capacity = state->walked_capacity ? state->walked_capacity * 2 : 64;
+        state->walked_dev = realloc(state->walked_dev, state->walked_capacity * sizeof(dev_t));
+        state->walked_ino = realloc(state->walked_ino, state->walked_capacity * sizeof(ino_t));
+    }
+    state->walked_dev[state->walked_count] = dir_stat.st_dev;
+    state->walked_ino[state->walked_count] = dir_stat.st_ino;
+    state->walked_count++;
+    return false;
+}
+
+static void walk(scan_state* state, const char* dir_path) {
+
+    if(walked_before(state, dir_path))
+        return;
+
+    DIR* dir = opendir(dir_path);
+    if(!dir)
+        return;
+
+    struct dirent* item;
+    while((item = readdir(dir))) {
+        if(item->d_name[0] == '.')
+            continue;
+
+        size_t length = strlen(dir_path) + strlen(item->d_name) + 2;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir_path, item->d_name);
+
+        bool is_dir = item->d_type == DT_DIR;
+        if(item->d_type == DT_UNKNOWN || item->d_type == DT_LNK) {
+            struct stat item_stat;
+            is_dir = stat(path, &item_stat) == 0 && S_ISDIR(item_stat.st_mode);
+        }
+
+        if(is_dir) {
+            walk(state, path);
+            free(path);
+        }
+        else if(is_rom(item->d_name)) {
+            if(state->count == state->capacity) {
+                state->capacity = state->capacity ? state->capacity * 2 : 256;
+                state->jobs = realloc(state->jobs, state->capacity * sizeof(scan_job));
+            }
+            scan_job* job = &state->jobs[state->count++];
+            memset(job, 0, sizeof(scan_job));
+            job->path = path;
+        }
+        else {
+            free(path);
+        }
+    }
+    closedir(dir);
+}
+
+static void scan_file(scan_state* state, scan_job* job) {
+
+    catalog_entry* entry = &job->entry;
+
+    struct stat file_stat;
+    if(stat(job->path, &file_stat) != 0) {
+        entry->flags = CATALOG_INVALID;
+        return;
+    }
+    entry->mtime_ns = (int64_t)file_stat.st_mtim.tv_sec * 1000000000 + file_stat.st_mtim.tv_nsec;
+    entry->size = file_stat.st_size;
+
+    const catalog_entry* previous = previous_entry(state, job->path);
+    if(previous && previous->mtime_ns == entry->mtime_ns && previous->size == entry->size) {
+        *entry = *previous;
+        job->reused = true;
+        return;
+    }
+
+    int fd = open(job->path, O_RDONLY);
+    if(fd < 0 || file_stat.st_size < HEADER_SIZE) {
+        if(fd >= 0)
+            close(fd);
+        entry->flags = CATALOG_INVALID;
+        return;
+    }
+    uint8_t* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        entry->flags = CATALOG_INVALID;
+        return;
+    }
+
+    // same checks and database fixes as Parse_Rom()
+    rom_header header;
+    long prg_offset = 0;
+    bool valid = Parse_Header(data, file_stat.st_size, &header);
+    if(valid) {
+        prg_offset = HEADER_SIZE + (header.trainer ? TRAINER_BLOCK_SIZE : 0);
+        valid = prg_offset + header.prg_size + header.chr_size <= file_stat.st_size;
+    }
+
+    if(valid) {
+        rom_id id;
+        const rom_db_entry* known = NULL;
+        if(rom_db_identify(job->path, &file_stat, data + prg_offset, header.prg_size + header.chr_size, &id)) {
+            entry->crc32 = id.crc32;
+            known = id.entry;
+            if(known)
+                entry->flags |= CATALOG_KNOWN;
+        }
+        atomic_fetch_add(&state->hashed, 1);
+        valid = rom_fix_header(&header, known, prg_offset, file_stat.st_size);
+    }
+
+    if(valid) {
+        entry->prg_size = header.prg_size;
+        entry->chr_size = header.chr_size;
+        entry->mapper = header.mapper;
+        entry->submapper = header.submapper;
+        entry->mirroring = header.mirroring;
+        if(mapper_supported(header.mapper))
+            entry->flags |= CATALOG_SUPPORTED;
+        if(header.battery)
+            entry->flags |= CATALOG_BATTERY;
+        if(header.nes2)
+            entry->flags |= CATALOG_NES2;
+        if(header.pal)
+            entry->flags |= CATALOG_PAL;
+    }
+    else {
+        entry->flags |= CATALOG_INVALID;
+    }
+
+    munmap(data, file_stat.st_size);
+}
+
+static void* scan_worker(void* arg) {
+
+    scan_state* state = arg;
+
+    int job;
+    while((job = atomic_fetch_add(&state->next_job, 1)) < state->count) {
+        scan_file(state, &state->jobs[job]);
+    }
+    return NULL;
+}
+
+static bool write_catalog(const char* catalog_file, scan_state* state) {
+
+    char temp_file[1024];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", catalog_file);
+
+    FILE* file = fopen(temp_file, "wb");
+    if(!file)
+        return false;
+
+    catalog_header header = {0};
+    memcpy(header.magic, CATALOG_MAGIC, 8);
+    header.version = CATALOG_VERSION;
+    header.count = state->count;
+
+    uint64_t offset = 0;
+    for(int i = 0; i < state->count; i++) {
+        state->jobs[i].entry.path_offset = offset;
+        offset += strlen(state->jobs[i].path) + 1;
+    }
+    header.strings_size = offset;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int i = 0; ok && i < state->count; i++)
+        ok = fwrite(&state->jobs[i].entry, sizeof(catalog_entry), 1, file) == 1;
+    for(int i = 0; ok && i < state->count; i++)
+        ok = fwrite(state->jobs[i].path, strlen(state->jobs[i].path) + 1, 1, file) == 1;
+
+    ok = (fclose(file) == 0) && ok;
+    if(ok)
+        ok = rename(temp_file, catalog_file) == 0;
+    else
+        remove(temp_file);
+    return ok;
+}
+
+static int compare_jobs(const void* a, const void* b) {
+
+    return strcmp(((const scan_job*)a)->path, ((const scan_job*)b)->path);
+}
+
+/*
+walk root for .nes files, parse and hash them on a pool of threads and
+write the catalog. files whose mtime and size match the existing catalog
+are carried over without being opened.
+*/
+int Scan_Library(const char* root, const char* catalog_file, int threads) {
+
+    scan_state state;
+    memset(&state, 0, sizeof(scan_state));
+
+    if(Load_Catalog(catalog_file, &state.previous))
+        index_previous(&state);
+
+    walk(&state, root);
+    qsort(state.jobs, state.count, sizeof(scan_job), compare_jobs);
+
+    if(threads < 1)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads < 1)
+        threads = 1;
+    if(threads > state.count)
+        threads = state.count ? state.count : 1;
+
+    atomic_init(&state.next_job, 0);
+    atomic_init(&state.hashed, 0);
+
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+    for(int i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, scan_worker, &state);
+    for(int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    int reused = 0, supported = 0, invalid = 0;
+    for(int i = 0; i < state.count; i++) {
+        reused += state.jobs[i].reused;
+        supported += (state.jobs[i].entry.flags & CATALOG_SUPPORTED) != 0;
+        invalid += (state.jobs[i].entry.flags & CATALOG_INVALID) != 0;
+    }
+
+    bool written = write_catalog(catalog_file, &state);
+    printf("Scanned %d roms in %s (%d unchanged, %d hashed): %d supported, %d unsupported, %d invalid\n",
+        state.count, root, reused, atomic_load(&state.hashed), supported, state.count - supported - invalid, invalid);
+    if(!written)
+        printf("Could not write catalog: %s\n", catalog_file);
+
+    for(int i = 0; i < state.count; i++)
+        free(state.jobs[i].path);
+    free(state.jobs);
+    free(state.previous_index);
+    free(state.walked_dev);
+    free(state.walked_ino);
+    Close_Catalog(&state.previous);
+
+    return written ? state.count : -1;
+}
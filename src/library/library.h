@@ -0,0 +1,59 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+one rom found by the scanner. fixed size so the catalog can be used
+straight from an mmap; paths live in a string table after the entries.
+*/
+typedef struct catalog_entry {
+
+    uint32_t path_offset;
+    uint32_t crc32;
+    int64_t mtime_ns;
+    int64_t size;
+    uint32_t prg_size;
+    uint32_t chr_size;
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t mirroring;
+    uint8_t flags;
+    uint8_t reserved[7];
+
+} catalog_entry;
+
+enum CATALOG_FLAG
+{
+    CATALOG_SUPPORTED = 1 << 0, // mapper implemented, safe to schedule
+    CATALOG_INVALID = 1 << 1, // bad header or truncated
+    CATALOG_KNOWN = 1 << 2, // matched in the rom database
+    CATALOG_BATTERY = 1 << 3,
+    CATALOG_NES2 = 1 << 4,
+    CATALOG_PAL = 1 << 5,
+};
+
+typedef struct rom_catalog {
+
+    const catalog_entry* entries;
+    const char* strings;
+    int count;
+
+    void* mapping;
+    size_t mapping_size;
+
+} rom_catalog;
+
+extern const char* CATALOG_PATH;
+
+int Scan_Library(const char* root, const char* catalog_file, int threads);
+
+bool Load_Catalog(const char* catalog_file, rom_catalog* catalog);
+void Close_Catalog(rom_catalog* catalog);
+void Print_Catalog(const rom_catalog* catalog, bool runnable_only);
+
+const char* catalog_path(const rom_catalog* catalog, const catalog_entry* entry);
+
+#endif
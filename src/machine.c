@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "machine.h"
+#include "processing/cpu.h"
+#include "processing/ppu.h"
+#include "processing/apu.h"
+#include "memory/rom.h"
+
+/*
+the rom must outlive the machine, see Free_Rom(). frame_buffer may point
+into a larger caller owned buffer (240x256 pixels), NULL allocates one
+*/
+nes_machine* Create_Machine(nes_rom* rom, uint32_t (*frame_buffer)[256]) {
+
+    nes_machine* nes = aligned_alloc(CACHE_LINE, sizeof(nes_machine));
+    if(!nes)
+        return NULL;
+
+    memset(nes, 0, sizeof(nes_machine));
+    nes->rom = rom;
+
+    if(frame_buffer) {
+        nes->frame_buffer = frame_buffer;
+    }
+    else {
+        nes->frame_buffer = aligned_alloc(CACHE_LINE, sizeof(uint32_t) * 240 * 256);
+        if(!nes->frame_buffer) {
+            free(nes);
+            return NULL;
+        }
+        nes->frame_buffer_owned = true;
+    }
+
+    Reset_Machine(nes);
+
+    return nes;
+}
+
+/*
+power cycle. a mapped .sav survives, like the battery it stands in for
+*/
+void Reset_Machine(nes_machine* nes) {
+
+    nes_rom* rom = nes->rom;
+    uint32_t (*frame_buffer)[256] = nes->frame_buffer;
+    bool frame_buffer_owned = nes->frame_buffer_owned;
+    bool skip_render = nes->skip_render;
+    bus_trace* trace = nes->trace;
+    apu_output* audio = nes->audio;
+    uint8_t* save_ram = nes->mapper.prg_ram_battery ? nes->mapper.prg_ram : NULL;
+
+    memset(nes, 0, sizeof(nes_machine));
+    nes->rom = rom;
+    nes->frame_buffer = frame_buffer;
+    nes->frame_buffer_owned = frame_buffer_owned;
+    nes->skip_render = skip_render;
+    nes->trace = trace;
+    nes->audio = audio;
+    memset(frame_buffer, 0, sizeof(uint32_t) * 240 * 256);
+
+    nes->cpu.sp = 0xfd;
+    nes->cpu.status = 0b100;
+    nes->ppu.scanline = -1;
+    nes->ppu.a12_rise_dot = -1;
+    nes->sprites.dirty = true;
+
+    Init_Mapper(nes, rom);
+    if(save_ram) {
+        nes->mapper.prg_ram = save_ram;
+        nes->mapper.prg_ram_battery = true;
+    }
+
+    Init_CPU(nes);
+    Init_APU(nes);
+}
+
+void Destroy_Machine(nes_machine* nes) {
+
+    if(!nes)
+        return;
+
+    Shut_Down_ROM(nes);
+    if(nes->frame_buffer_owned)
+        free(nes->frame_buffer);
+    free(nes);
+}
+
+/*
+one instruction plus the three ppu dots per cpu cycle it took
+*/
+int Step_Machine(nes_machine* nes) {
+
+    int cpu_cycles = Update_CPU(nes);
+    nes->cpu.cycles += cpu_cycles;
+
+    for(int i = 0; i < cpu_cycles*3; i++) {
+        Update_PPU(nes);
+    }
+    return cpu_cycles;
+}
+
+/*
+run until the ppu enters vblank, frame_buffer then holds the finished
+frame and the audio output the frame's samples. stops early on a
+breakpoint. returns cpu cycles run
+*/
+int Run_Frame(nes_machine* nes) {
+
+    int cycles = 0;
+
+    nes->ppu.frame_complete = false;
+    nes->cpu.breakpoint = false;
+
+    while(!nes->ppu.frame_complete && !nes->cpu.breakpoint) {
+        cycles += Step_Machine(nes);
+    }
+
+    Apu_End_Frame(nes);
+    return cycles;
+}
@@ -0,0 +1,261 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "memory/mapper.h"
+
+#define CACHE_LINE 64
+
+#define BUS_TRACE_MAX 16 // accesses kept per instruction, an interrupt plus RMW fits
+#define CONTROLLER_PORTS 2 // $4016 and $4017
+
+typedef struct nes_rom nes_rom;
+
+/*
+cpu bus accesses of one instruction, recorded while a tester has a trace
+hooked into the machine
+*/
+typedef struct bus_access {
+
+    uint16_t addr;
+    uint8_t value;
+    bool write;
+
+} bus_access;
+
+typedef struct bus_trace {
+
+    bus_access accesses[BUS_TRACE_MAX];
+    int count; // may pass BUS_TRACE_MAX, only the first ones are kept
+
+} bus_trace;
+
+/*
+cpu registers and interrupt lines, touched by every instruction
+*/
+typedef struct cpu_state {
+
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t status;
+    uint8_t accumulator;
+    uint8_t index_x;
+    uint8_t index_y;
+    uint8_t irq; // one bit per IRQ_SOURCE
+    int nmi;
+    bool breakpoint; // pc entered $fff0-$ffff, the frontend pauses on it
+    uint64_t cycles; // since power on, at the start of the current instruction
+    int stall; // cycles dma halts the cpu for before its next instruction
+    bool stall_align; // oam dma, one more to start on an even cycle
+
+} cpu_state;
+
+/*
+ppu timing, loopy registers and OAM, touched every dot
+*/
+typedef struct ppu_state {
+
+    int scanline;
+    int dot;
+    int frame;
+    bool frame_complete; // set when vblank starts
+
+    uint16_t ppu_address;  // 'v' register
+    uint16_t ppu_address_temp;  // 't' register
+    uint8_t fine_x;   // 'x' register
+    int latch;  // 'w register'
+    uint8_t data_buffer;
+
+    int rendering_enabled;
+    int render_s0;
+
+    // dot of the A12 rise each rendered line (-1 when bg/sprites share a table)
+    int a12_rise_dot;
+    uint8_t a12;
+
+    uint8_t ppu_reg[8];
+    uint8_t OAM_memory[0x100];
+    uint8_t OAM_memory_secondary[0x40];
+
+} ppu_state;
+
+/*
+apu channels. timers count cpu cycles down to the channel's next step,
+periods are in cpu cycles too, so a channel can be moved over any span at
+once
+*/
+typedef struct apu_envelope {
+
+    bool start;
+    bool loop; // also halts the length counter
+    bool constant;
+    uint8_t volume; // constant volume or divider period
+    uint8_t divider;
+    uint8_t decay;
+
+} apu_envelope;
+
+typedef struct apu_pulse {
+
+    uint32_t timer;
+    uint32_t period; // 2 * (timer_reload + 1)
+    uint16_t timer_reload; // 11 bit register value
+    uint8_t duty;
+    uint8_t step; // 0-7 in the duty cycle
+    uint8_t length;
+    apu_envelope envelope;
+
+    bool sweep_enabled;
+    bool sweep_negate;
+    bool sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+
+    uint8_t output; // 0-15
+
+} apu_pulse;
+
+typedef struct apu_triangle {
+
+    uint32_t timer;
+    uint16_t timer_reload; // period is timer_reload + 1
+    uint8_t step; // 0-31
+    uint8_t length;
+    bool control; // halts the length counter, holds the linear counter reload
+    bool linear_reload_flag;
+    uint8_t linear_reload;
+    uint8_t linear;
+
+    uint8_t output; // 0-15
+
+} apu_triangle;
+
+typedef struct apu_noise {
+
+    uint32_t timer;
+    uint32_t period;
+    uint16_t shift; // 15 bit lfsr
+    bool mode; // short, 93 step sequence
+    uint8_t length;
+    apu_envelope envelope;
+
+    uint8_t output; // 0-15
+
+} apu_noise;
+
+typedef struct apu_dmc {
+
+    uint32_t timer;
+    uint32_t period;
+    bool irq_enabled;
+    bool loop;
+    bool irq;
+
+    uint16_t sample_address;
+    uint16_t sample_length;
+    uint16_t address; // next byte to fetch
+    uint16_t bytes_remaining;
+    uint8_t buffer;
+    bool buffer_full;
+
+    uint8_t shift;
+    uint8_t bits; // left in shift
+    bool silence;
+
+    uint8_t output; // 0-127
+
+} apu_dmc;
+
+typedef struct apu_state {
+
+    uint64_t cycle; // channels are caught up to this cpu cycle
+    uint64_t frame_start; // cpu cycle the frame sequencer last started over
+    uint64_t frame_next; // cpu cycle of its next step
+    uint8_t frame_step;
+    bool frame_five_step;
+    bool frame_irq_inhibit;
+    bool frame_irq;
+    uint8_t enabled; // $4015 channel bits
+
+    uint64_t event_next; // cpu cycle of the next frame irq or dmc fetch, see Apu_Event()
+
+    apu_pulse pulse[2];
+    apu_triangle triangle;
+    apu_noise noise;
+    apu_dmc dmc;
+
+} apu_state;
+
+typedef struct apu_output apu_output;
+
+/*
+which sprites fall on each line, worked out from OAM in one pass when it
+changed (a dma, $2004, the sprite size) instead of searching all 64 on
+every line. derived, so not part of a save state
+*/
+typedef struct sprite_lines {
+
+    bool dirty;
+    uint8_t count[240]; // 9 = more than 8, the rest overflow
+    uint8_t index[240][8]; // in OAM order
+
+} sprite_lines;
+
+/*
+$4016/$4017 as the cpu sees them. pads is the snapshot an input source set
+for the frame, the strobe copies it into the shift registers and reads
+take bit 0 from there, so a frame's reads all agree whatever the host did
+meanwhile
+*/
+typedef struct controller_state {
+
+    uint8_t strobe;
+    uint8_t pads[CONTROLLER_PORTS]; // bit n = button n: A B SELECT START UP DOWN LEFT RIGHT
+    uint8_t shift[CONTROLLER_PORTS]; // latched pads, 1s come in from the top
+
+} controller_state;
+
+/*
+one console. everything the core touches lives here, so any number can
+run side by side (one per thread) over the same read-only nes_rom.
+ordered hot-first: registers and ram share the first few cache lines,
+bulk arrays go last and the frame buffer is outside the struct.
+*/
+typedef struct nes_machine {
+
+    _Alignas(CACHE_LINE) cpu_state cpu;
+    _Alignas(CACHE_LINE) ppu_state ppu;
+    _Alignas(CACHE_LINE) uint8_t ram[0x800];
+
+    uint8_t apu_reg[0x18];
+    apu_state apu;
+    controller_state controller;
+    uint8_t open_bus; // unmapped reads/writes land here
+    nes_rom* rom;
+
+    // 240 rows of 256 argb pixels, owned or a slot in a caller's buffer
+    uint32_t (*frame_buffer)[256];
+    bool frame_buffer_owned;
+    bool skip_render; // ppu keeps timing and sprite 0 hits but writes no pixels (run-ahead)
+    bus_trace* trace; // NULL unless cpu bus traffic is being recorded
+    apu_output* audio; // NULL runs the apu without making samples
+
+    _Alignas(CACHE_LINE) memory_mapper mapper;
+    _Alignas(CACHE_LINE) uint8_t vram[0x4000];
+
+    _Alignas(CACHE_LINE) uint8_t sprite_priority[240][256];
+    sprite_lines sprites;
+
+} nes_machine;
+
+nes_machine* Create_Machine(nes_rom* rom, uint32_t (*frame_buffer)[256]);
+void Reset_Machine(nes_machine* nes);
+void Destroy_Machine(nes_machine* nes);
+
+int Step_Machine(nes_machine* nes);
+int Run_Frame(nes_machine* nes);
+
+#endif
@@ -2,28 +2,45 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "mapper.h"
-#include "mem.h"
 
-memory_mapper* create_mapper(uint8_t* rom_data, int mapper_type, int prg_length, int chr_length, int prg_ram_length, uint8_t mirroring) {
-    
-    memory_mapper* mapper = (memory_mapper*) malloc(sizeof(memory_mapper));
+/*
+mapper state lives inside the machine, so this fills one in place
+*/
+void init_mapper(memory_mapper* mapper, int mapper_type, int prg_length, int chr_length, int prg_ram_length, uint8_t mirroring) {
 
-    mapper->rom_data = rom_data;
+    memset(mapper, 0, sizeof(memory_mapper));
 
     mapper->type = mapper_type;
     mapper->prg_length = prg_length;
     mapper->chr_length = chr_length;
     mapper->prg_ram_length = prg_ram_length;
 
+    mapper->prg_ram = mapper->work_ram;
     mapper->prg_ram_bank = 0;
     mapper->prg_bank_0 = 0;
     mapper->prg_bank_1 = 1; 
 
     mapper->mirroring = mirroring;
+}
+
+/*
+point the 4kb prg and 1kb chr windows at the current 16kb/4kb banks
+(mappers 0 and 1). bank numbers wrap to the size of the rom.
+*/
+void mapper_update_banks(memory_mapper* mapper) {
+
+    int prg_banks = mapper->prg_length > 0 ? mapper->prg_length : 1;
+    int chr_banks = mapper->chr_length > 0 ? mapper->chr_length * 2 : 2;
 
-    return mapper;
+    for(int i = 0; i < 4; i++) {
+        mapper->prg_pages[i] = mapper->prg_rom + ((mapper->prg_bank_0 % prg_banks) * 0x4000) + (i * 0x1000);
+        mapper->prg_pages[i+4] = mapper->prg_rom + ((mapper->prg_bank_1 % prg_banks) * 0x4000) + (i * 0x1000);
+        mapper->chr_pages[i] = mapper->chr_rom + ((mapper->chr_bank_0 % chr_banks) * 0x1000) + (i * 0x400);
+        mapper->chr_pages[i+4] = mapper->chr_rom + ((mapper->chr_bank_1 % chr_banks) * 0x1000) + (i * 0x400);
+    }
 }
 
 uint8_t read_rom() {
@@ -41,6 +58,8 @@ void mapper_0(memory_mapper* mapper, unsigned char* rom_buffer) {
 
     if(mapper->prg_length > 1)
         mapper->prg_bank_1 = 1; 
+
+    mapper_update_banks(mapper);
 }
 
 void mapper_1(memory_mapper* mapper, uint8_t* rom_buffer) {
@@ -54,6 +73,8 @@ void mapper_1(memory_mapper* mapper, uint8_t* rom_buffer) {
 
     mapper->registers[0] = 0b10000;
     mapper->registers[1] = 0b01100;
+
+    mapper_update_banks(mapper);
 }
 
 void mapper_write_1(uint16_t addr, uint8_t data, memory_mapper* mapper) {
@@ -80,6 +101,14 @@ void mapper_write_1(uint16_t addr, uint8_t data, memory_mapper* mapper) {
             }
             else if(addr <= 0xbfff) {
                 mapper->registers[CHR_0] = mapper->registers[SHIFT];
+                if((mapper->registers[CTRL] >> 4) & 1) {
+                    mapper->chr_bank_0 = mapper->registers[CHR_0] & 0b11111;
+                }
+                else {
+                    // 8kb mode, low bit ignored
+                    mapper->chr_bank_0 = mapper->registers[CHR_0] & 0b11110;
+                    mapper->chr_bank_1 = mapper->chr_bank_0 + 1;
+                }
             }
             else if(addr <= 0xdfff) {
                 if((mapper->registers[CTRL] >> 4) & 1) {
@@ -107,7 +136,163 @@ void mapper_write_1(uint16_t addr, uint8_t data, memory_mapper* mapper) {
 
             mapper->registers[SHIFT] = 0b10000;
             mapper->registers[COUNTER] = 0;
+
+            mapper_update_banks(mapper);
         }
     }
 }
 
+/*
+MMC3: 8kb prg banks and 1kb/2kb chr banks selected through R0-R7, plus a
+scanline counter clocked by rising edges of ppu address line A12.
+*/
+void mapper_4_update_banks(memory_mapper* mapper) {
+
+    int prg_banks = mapper->prg_length * 2; // 8kb
+    int chr_banks = mapper->chr_length > 0 ? mapper->chr_length * 8 : 8; // 1kb
+
+    uint8_t* R = mapper->registers;
+    int prg[4];
+    if(mapper->bank_select & 0b01000000) {
+        prg[0] = prg_banks - 2;
+        prg[2] = R[6];
+    }
+    else {
+        prg[0] = R[6];
+        prg[2] = prg_banks - 2;
+    }
+    prg[1] = R[7];
+    prg[3] = prg_banks - 1;
+
+    for(int i = 0; i < 4; i++) {
+        uint8_t* bank = mapper->prg_rom + ((prg[i] % prg_banks) * 0x2000);
+        mapper->prg_pages[(i*2)] = bank;
+        mapper->prg_pages[(i*2) + 1] = bank + 0x1000;
+    }
+
+    // R0/R1 are 2kb banks, R2-R5 are 1kb. A12 inversion swaps the two halves
+    int chr[8] = {
+        R[0] & 0xfe, R[0] | 1, R[1] & 0xfe, R[1] | 1,
+        R[2], R[3], R[4], R[5]
+    };
+    int invert = (mapper->bank_select & 0b10000000) ? 4 : 0;
+
+    for(int i = 0; i < 8; i++) {
+        mapper->chr_pages[i ^ invert] = mapper->chr_rom + ((chr[i] % chr_banks) * 0x400);
+    }
+}
+
+void mapper_4(memory_mapper* mapper, uint8_t* rom_buffer) {
+
+    mapper->registers[6] = 0;
+    mapper->registers[7] = 1;
+    mapper->bank_select = 0;
+
+    mapper->irq_latch = 0;
+    mapper->irq_counter = 0;
+    mapper->irq_reload = false;
+    mapper->irq_enabled = false;
+
+    mapper_4_update_banks(mapper);
+}
+
+void mapper_write_4(uint16_t addr, uint8_t data, memory_mapper* mapper) {
+
+    bool even = (addr & 1) == 0;
+
+    if(addr <= 0x9fff) {
+        if(even)
+            mapper->bank_select = data;
+        else
+            mapper->registers[mapper->bank_select & 0b111] = data;
+
+        mapper_4_update_banks(mapper);
+    }
+    else if(addr <= 0xbfff) {
+        // 0 = vertical / 1 = horizontal (four screen carts ignore this)
+        if(even && mapper->mirroring != 4)
+            mapper->mirroring = (data & 1) ? 3 : 2;
+    }
+    else if(addr <= 0xdfff) {
+        if(even)
+            mapper->irq_latch = data;
+        else {
+            mapper->irq_counter = 0;
+            mapper->irq_reload = true;
+        }
+    }
+    else {
+        if(even) {
+            mapper->irq_enabled = false;
+            mapper->irq_asserted = false;
+        }
+        else
+            mapper->irq_enabled = true;
+    }
+}
+
+/*
+called once per A12 rise (once per scanline while rendering)
+*/
+void mapper_irq_clock_4(memory_mapper* mapper) {
+
+    if(mapper->irq_counter == 0 || mapper->irq_reload) {
+        mapper->irq_counter = mapper->irq_latch;
+        mapper->irq_reload = false;
+    }
+    else {
+        mapper->irq_counter--;
+    }
+
+    if(mapper->irq_counter == 0 && mapper->irq_enabled) {
+        mapper->irq_asserted = true;
+    }
+}
+
+
+/*
+recompute the bank windows from the register state alone, e.g. after a
+save state was copied into the scalar part of the mapper
+*/
+void mapper_rebuild_pages(memory_mapper* mapper) {
+
+    switch(mapper->type) {
+        case 4:
+            mapper_4_update_banks(mapper);
+            break;
+        case MAPPER_NSF:
+            mapper_nsf_update_banks(mapper);
+            break;
+        default:
+            mapper_update_banks(mapper);
+            break;
+    }
+}
+
+/*
+nsf images are 4kb pages, prg_length counts those and not 16kb blocks.
+$5ff8-$5fff pick the page of each window, they start out as the bytes
+8-15 of the image's header
+*/
+void mapper_nsf(memory_mapper* mapper, uint8_t* rom_buffer) {
+
+    memcpy(mapper->registers, rom_buffer + 8, 8);
+    mapper_nsf_update_banks(mapper);
+}
+
+void mapper_nsf_update_banks(memory_mapper* mapper) {
+
+    int pages = mapper->prg_length > 0 ? mapper->prg_length : 1;
+    for(int i = 0; i < 8; i++) {
+        mapper->prg_pages[i] = mapper->prg_rom + ((mapper->registers[i] % pages) * 0x1000);
+        mapper->chr_pages[i] = mapper->chr_rom + (i * 0x400);
+    }
+}
+
+void mapper_write_nsf(uint16_t addr, uint8_t data, memory_mapper* mapper) {
+
+    if(addr >= 0x5ff8 && addr <= 0x5fff) {
+        mapper->registers[addr - 0x5ff8] = data;
+        mapper_nsf_update_banks(mapper);
+    }
+}
@@ -1,10 +1,22 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
 #include <stdint.h>
+#include <stdbool.h>
+
+#define MAPPER_NSF 0x1000 // past any ines number, the image Load_NSF() makes
 
 typedef struct memory_mapper {
 
-    uint8_t* rom_data;
-    uint8_t prg_ram[0x2000];
-    uint8_t chr_ram[0x2000];
+    // bank windows, rebuilt on bank switch so reads are a single lookup
+    uint8_t* prg_pages[8]; // 4kb windows $8000-$ffff
+    uint8_t* chr_pages[8]; // 1kb windows $0000-$1fff (ppu)
+
+    uint8_t* prg_rom; // inside the shared rom mapping
+    uint8_t* chr_rom; // or chr_ram below
+    uint8_t* prg_ram; // work_ram, or the .sav mapping for battery carts
+    bool prg_ram_battery;
+    bool prg_ram_dirty;
 
     int type;
 
@@ -22,11 +34,34 @@ typedef struct memory_mapper {
 
     uint8_t mirroring;
 
+    // MMC3
+    uint8_t bank_select;
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+    bool irq_asserted; // mirrored onto the cpu IRQ line by mapper_write()/mapper_a12_rise()
+
+    uint8_t work_ram[0x2000];
+    uint8_t chr_ram[0x2000];
+
 } memory_mapper;
 
-memory_mapper* create_mapper(uint8_t* rom_data, int mapper_type, int prg_length, int chr_length, int prg_ram_length, uint8_t mirroring);
+void init_mapper(memory_mapper* mapper, int mapper_type, int prg_length, int chr_length, int prg_ram_length, uint8_t mirroring);
+
+void mapper_update_banks(memory_mapper* mapper);
+void mapper_rebuild_pages(memory_mapper* mapper);
 
 void mapper_write_1(uint16_t addr, uint8_t, memory_mapper* mapper);
+void mapper_write_4(uint16_t addr, uint8_t data, memory_mapper* mapper);
+void mapper_irq_clock_4(memory_mapper* mapper);
 
 void mapper_0(memory_mapper* mapper, uint8_t* rom_buffer);
-void mapper_1(memory_mapper* mapper, uint8_t* rom_buffer);
\ No newline at end of file
+void mapper_1(memory_mapper* mapper, uint8_t* rom_buffer);
+void mapper_4(memory_mapper* mapper, uint8_t* rom_buffer);
+
+void mapper_nsf(memory_mapper* mapper, uint8_t* rom_buffer);
+void mapper_nsf_update_banks(memory_mapper* mapper);
+void mapper_write_nsf(uint16_t addr, uint8_t data, memory_mapper* mapper);
+
+#endif
@@ -8,195 +8,193 @@
 #include "../processing/ppu.h"
 #include "../devices/controller.h"
 
+static void trace_access(nes_machine* nes, uint16_t addr, uint8_t value, bool write) {
+
+    bus_trace* trace = nes->trace;
+    if(trace->count < BUS_TRACE_MAX)
+        trace->accesses[trace->count] = (bus_access) {addr, value, write};
+    trace->count++;
+}
+
 const int ADDR_RANGE = 0xffff;
 
-unsigned char read(uint16_t addr) {
+unsigned char read(nes_machine* nes, uint16_t addr) {
     
     unsigned char val;
+    uint16_t bus_addr = addr;
 
     if(addr >= 0x2000 && addr < 0x4000) {
         addr = (addr-0x2000) % 8;
-        val = read_ppu(addr);
+        val = read_ppu(nes, addr);
     }
     else if(addr == 0x4016 || addr == 0x4017) {
-        val = controller_read(addr);
+        val = controller_read(nes, addr);
     }
-    else if(addr >= 0x4000 && addr <= 0x4018) {
-        val = apu_read(addr);
+    else if(addr >= 0x4000 && addr < 0x4018) {
+        val = apu_read(nes, addr);
     }
     else {
-        val = *memory_map(addr);
+        val = *memory_map(nes, addr);
     }
+
+    if(nes->trace)
+        trace_access(nes, bus_addr, val, false);
     return val;
 }
 
-void write(uint16_t addr, uint8_t data) {
+void write(nes_machine* nes, uint16_t addr, uint8_t data) {
+
+    if(nes->trace)
+        trace_access(nes, addr, data, true);
 
-    
     if(addr >= 0x2000 && addr < 0x4000) {
         addr = (addr-0x2000) % 8;
-        write_ppu(addr, data);
+        write_ppu(nes, addr, data);
     }
     else if(addr == 0x4014) {
-        OAM_DMA(data);
+        OAM_DMA(nes, data);
     }
     else if(addr == 0x4016) {
-        controller_write(data);
+        controller_write(nes, data);
     }
-    else if(addr >= 0x4000 && addr <= 0x4018) {
-        apu_write(addr, data);
+    else if(addr >= 0x4000 && addr < 0x4018) {
+        apu_write(nes, addr, data);
     }
     else if(addr >= 0x8000) {
-        mapper_write(addr, data);
+        mapper_write(nes, addr, data);
+    }
+    else if(addr >= 0x5ff8 && addr < 0x6000 && nes->mapper.type == MAPPER_NSF) {
+        mapper_write(nes, addr, data);
     }
     else {
-        unsigned char * ptr = memory_map(addr);
+        unsigned char * ptr = memory_map(nes, addr);
         *ptr = data;
-    }
-}
 
-void Load_Rom(char *file_path) { 
-    Parse_Rom(file_path);
+        if(addr >= 0x6000)
+            nes->mapper.prg_ram_dirty = true;
+    }
 }
 
-unsigned char * memory_map(uint16_t addr) {
+unsigned char * memory_map(nes_machine* nes, uint16_t addr) {
 
     addr %= 0x10000;
 
     if(addr < 0x2000) {
-        return &ram[addr % 0x800];
+        return &nes->ram[addr % 0x800];
     }
     else if(addr < 0x4000) {
-        return &ppu_reg[(addr-0x2000) % 8];
+        return &nes->ppu.ppu_reg[(addr-0x2000) % 8];
     }
     else if(addr == 0x4016) {
-        return &controller_reg_1;
+        return &nes->controller.shift[0]; // peeks see pad 1 as latched, reads go through controller_read()
     }
     else if(addr < 0x4018) {
-        return &apu_reg[(addr-0x4000)];
+        return &nes->apu_reg[(addr-0x4000)];
     }
     else if (addr >= 0x6000 && addr < 0x8000) {
-        return &mapper->prg_ram[addr-0x6000];
+        return &nes->mapper.prg_ram[addr-0x6000];
     }
-    else if (addr >= 0x8000 && addr <= 0xbfff) {
-        return &mapper->rom_data[HEADER_SIZE + (mapper->prg_bank_0 * 0x4000) + (addr - 0x8000)];
+    else if (addr >= 0x8000) {
+        return &nes->mapper.prg_pages[(addr >> 12) & 7][addr & 0xfff];
     }
-    else if (addr >= 0xc000 && addr <= 0xffff) {
-        return &mapper->rom_data[HEADER_SIZE + (mapper->prg_bank_1 * 0x4000) + (addr - 0xc000)];
-    }
-    return &prg_ram[0x1fff];
+    return &nes->open_bus;
 }
 
-unsigned char read_vram(uint16_t addr) {
+unsigned char read_vram(nes_machine* nes, uint16_t addr) {
 
     addr %= 0x4000;
 
-    if(addr < 0x2000 && mapper->chr_length == 0) {
-        return mapper->chr_ram[addr];
-    }
-    
-    if(addr < 0x1000) {
-        return mapper->rom_data[HEADER_SIZE + ((mapper->prg_ram_length) * 0x4000) + (mapper->chr_bank_0 * 0x1000) + (addr)];
-    }
-    else if(addr < 0x2000) {
-        return mapper->rom_data[HEADER_SIZE + ((mapper->prg_ram_length) * 0x4000) + (mapper->chr_bank_1 * 0x1000) + (addr - 0x1000)];
+    if(addr < 0x2000) {
+        return nes->mapper.chr_pages[addr >> 10][addr & 0x3ff];
     }
     else if(addr < 0x3f00) {
 
-        if(mapper->mirroring == 3)  // horizontal
+        if(nes->mapper.mirroring == 3)  // horizontal
         {
             if(addr >= 0x2400 && addr < 0x2c00)
                 addr -= 0x400;
             else if(addr >= 0x2c00 && addr < 0x2fff)
                 addr -= 0x800;
         }
-        else if(mapper->mirroring == 2)  // vertical
+        else if(nes->mapper.mirroring == 2)  // vertical
         {
             if(addr >= 0x2800 && addr < 0x3000)
                 addr -= 0x800;
         }
 
-        return vram[addr];
+        return nes->vram[addr];
     }
     else if(addr < 0x4000) {
         addr = addr % 0x20;
-        return vram[addr + 0x3f00];
+        return nes->vram[addr + 0x3f00];
     }
-    return vram[addr];
+    return nes->vram[addr];
 }
 
-void write_vram(uint16_t addr, uint8_t data) {
+void write_vram(nes_machine* nes, uint16_t addr, uint8_t data) {
 
     addr %= 0x4000;
 
-    if(addr < 0x2000 && mapper->chr_length == 0) {
-        mapper->chr_ram[addr] = data;
+    if(addr < 0x2000 && nes->mapper.chr_length == 0) {
+        nes->mapper.chr_pages[addr >> 10][addr & 0x3ff] = data;
     }
     else if(addr < 0x3f00) {
 
-        if(mapper->mirroring == 3)  // horizontal
+        if(nes->mapper.mirroring == 3)  // horizontal
         {
             if(addr >= 0x2400 && addr < 0x2c00)
                 addr -= 0x400;
             else if(addr >= 0x2c00 && addr < 0x2fff)
                 addr -= 0x800;
         }
-        else if(mapper->mirroring == 2)  // vertical
+        else if(nes->mapper.mirroring == 2)  // vertical
         {
             if(addr >= 0x2800 && addr < 0x3000)
                 addr -= 0x800;
         }
         
-        vram[addr] = data;
+        nes->vram[addr] = data;
     }
     else if(addr < 0x4000) {
         addr = addr % 0x20;
-        vram[addr + 0x3f00] = data;
+        nes->vram[addr + 0x3f00] = data;
     }
 }
 
-unsigned char peek_ram(uint16_t addr) {
-    unsigned char val = *memory_map(addr);
+unsigned char peek_ram(nes_machine* nes, uint16_t addr) {
+    unsigned char val = *memory_map(nes, addr);
     return val;
 }
 
-unsigned char peek_vram(uint16_t addr) {
+unsigned char peek_vram(nes_machine* nes, uint16_t addr) {
 
     addr %= 0x4000;
 
-    if(addr < 0x2000 && mapper->chr_length == 0)  // chr ram
-    {
-        return mapper->chr_ram[addr];
-    }
-    if(addr < 0x1000)  // chr rom 0
-    {
-        return mapper->rom_data[HEADER_SIZE + ((mapper->prg_length) * 0x4000) + (mapper->chr_bank_0 * 0x1000) + (addr)];
-    }
-    else if(addr < 0x2000)  // chr rom 1
+    if(addr < 0x2000)  // chr rom/ram through the 1kb bank windows
     {
-        return mapper->rom_data[HEADER_SIZE + ((mapper->prg_length) * 0x4000) + (mapper->chr_bank_1 * 0x1000) + (addr - 0x1000)];
+        return nes->mapper.chr_pages[addr >> 10][addr & 0x3ff];
     }
     else if(addr < 0x3f00)  // name tables w/ mirroring
     {
-        if(mapper->mirroring == 3)  // horizontal
+        if(nes->mapper.mirroring == 3)  // horizontal
         {
             if(addr >= 0x2400 && addr < 0x2c00)
                 addr -= 0x400;
             else if(addr >= 0x2c00 && addr < 0x2fff)
                 addr -= 0x800;
         }
-        else if(mapper->mirroring == 2)  // vertical
+        else if(nes->mapper.mirroring == 2)  // vertical
         {
             if(addr >= 0x2800 && addr < 0x3000)
                 addr -= 0x800;
         }
 
-        return vram[addr];
+        return nes->vram[addr];
     }
     else if(addr < 0x4000)  // color palettes
     {
         addr = addr % 0x20;
-        return vram[addr + 0x3f00];
+        return nes->vram[addr + 0x3f00];
     }
-    return vram[addr];
+    return nes->vram[addr];
 }
\ No newline at end of file
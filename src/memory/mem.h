@@ -1,15 +1,16 @@
 #include <stdint.h>
+#include <stdbool.h>
 
-extern const int ADDR_RANGE;
+#include "../machine.h"
 
-unsigned char read(uint16_t addr);
-void write(uint16_t addr, uint8_t val);
-unsigned char * memory_map(uint16_t addr);
+extern const int ADDR_RANGE;
 
-unsigned char read_vram(uint16_t addr);
-void write_vram(uint16_t addr, uint8_t data);
+unsigned char read(nes_machine* nes, uint16_t addr);
+void write(nes_machine* nes, uint16_t addr, uint8_t val);
+unsigned char * memory_map(nes_machine* nes, uint16_t addr);
 
-unsigned char peek_ram(uint16_t addr);
-unsigned char peek_vram(uint16_t addr);
+unsigned char read_vram(nes_machine* nes, uint16_t addr);
+void write_vram(nes_machine* nes, uint16_t addr, uint8_t data);
 
-void Load_Rom(char *file_path);
\ No newline at end of file
+unsigned char peek_ram(nes_machine* nes, uint16_t addr);
+unsigned char peek_vram(nes_machine* nes, uint16_t addr);
\ No newline at end of file
@@ -1,5 +1,3 @@
 const int ZERO_PAGE = 0x0000;
 const int STACK = 0x0100;
-const int RAM = 0x0200;
-
-unsigned char ram[0x800];
\ No newline at end of file
+const int RAM = 0x0200;
\ No newline at end of file
@@ -1,2 +1,2 @@
-extern unsigned char ram[0x800];
+
 
@@ -2,139 +2,430 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "rom.h"
-#include "vram.h"
-
-// starting point in RAM for ROM data
-int prg_rom_cpu_addr;
-int prg_rom_cpu_length;
-int prg_rom_mirror_offset = 0x8000;
-
-int prg_ram_cpu_addr;
-int prg_ram_cpu_length;
-int chr_rom_ppu_addr;
-int chr_rom_ppu_addr;
+#include "../processing/cpu.h"
 
 const int HEADER_SIZE = 0x10;
 const int TRAINER_BLOCK_SIZE = 0x200;
 const int PRG_ROM_BLOCK_SIZE = 0x4000;
 const int CHR_ROM_BLOCK_SIZE = 0x2000;
 
-memory_mapper* mapper;
+const int FLAGS6 = 6;  // mirroring, battery, trainer, four screen, mapper lower nibble
+const int FLAGS7 = 7;  // vs, playchoice, nes 2.0 id, mapper upper nibble
+const int FLAGS8 = 8;  // ines: prg ram size / nes 2.0: mapper msb + submapper
+const int FLAGS9 = 9;  // ines: tv system / nes 2.0: prg/chr size msb
+const int FLAGS10 = 10;  // nes 2.0: prg ram/nvram shift counts
+const int FLAGS12 = 12;  // nes 2.0: timing
+
+/*
+NES 2.0 rom size: 12 bit block count, or exponent-multiplier form when
+the msb nibble is $f
+*/
+long rom_size_nes2(uint8_t lsb, uint8_t msb, long block_size) {
+
+    if(msb == 0xf) {
+        int exponent = lsb >> 2;
+        if(exponent > 30)
+            return -1;
+        return (1L << exponent) * (((lsb & 3) * 2) + 1);
+    }
+    return ((msb << 8) | lsb) * block_size;
+}
 
-int file_size;
+/*
+decode an iNES 1.0 / NES 2.0 header. iNES 1.0 only defines bytes 4-9, so
+bytes 10-15 are ignored there (and the upper mapper nibble too when old
+rippers left junk in 12-15)
+*/
+bool Parse_Header(const uint8_t* data, long size, rom_header* header) {
 
-const int FLAGS6 = 6;
-unsigned char mapper_lower; // 
-bool trainer; // 512 byte (0x200) trainer at $7000-$71ff
-bool battery; // battery powered prg ram $6000-$7fff (used for save memory)
-bool ignore_mirror; // ignore mirror bit and use 4 screen vram
-bool mirror; // 0: horizontal, 1: vertical
+    memset(header, 0, sizeof(rom_header));
 
-const int FLAGS7 = 7;
-bool vs;
-bool playchoice;
-bool nes2;
-unsigned char mapper_upper;
+    if(size < HEADER_SIZE || memcmp(data, "NES\x1a", 4) != 0)
+        return false;
 
-const int FLAGS8 = 8;
-unsigned char submapper;
+    header->nes2 = ((data[FLAGS7] >> 2) & 3) == 2;
 
-const int FLAGS10 = 10;
-bool tv_system; // 0: NTSC 1: PAL
-bool prg_ram_exists;
-bool bus_conflicts;
+    header->trainer = data[FLAGS6] & (1<<2);
+    header->battery = data[FLAGS6] & (1<<1);
+    header->vs = data[FLAGS7] & (1<<0);
+    header->playchoice = data[FLAGS7] & (1<<1);
 
-unsigned char prg_ram[0x2000];
+    // 2 = vertical / 3 = horizontal / 4 = four screen (see mapper_write_1)
+    if(data[FLAGS6] & (1<<3))
+        header->mirroring = 4;
+    else
+        header->mirroring = (data[FLAGS6] & (1<<0)) ? 2 : 3;
 
-void Parse_Rom(char *file_path) { 
+    header->mapper = (data[FLAGS6] >> 4) | (data[FLAGS7] & 0xf0);
 
-    remove("log.txt");
-    FILE* file_ptr = fopen("log.txt", "w");
-    fclose(file_ptr);
+    if(header->nes2) {
+        header->mapper |= (data[FLAGS8] & 0x0f) << 8;
+        header->submapper = data[FLAGS8] >> 4;
+        header->prg_size = rom_size_nes2(data[4], data[FLAGS9] & 0x0f, PRG_ROM_BLOCK_SIZE);
+        header->chr_size = rom_size_nes2(data[5], data[FLAGS9] >> 4, CHR_ROM_BLOCK_SIZE);
 
-    unsigned char* rom_data;
+        int prg_ram_shift = data[FLAGS10] & 0x0f;
+        int prg_nvram_shift = data[FLAGS10] >> 4;
+        header->prg_ram_size = (prg_ram_shift ? 64 << prg_ram_shift : 0) + (prg_nvram_shift ? 64 << prg_nvram_shift : 0);
+        header->pal = (data[FLAGS12] & 3) == 1;
+    }
+    else {
+        bool dirty_tail = data[12] || data[13] || data[14] || data[15];
+        if(dirty_tail)
+            header->mapper &= 0x0f;
+
+        header->prg_size = data[4] * PRG_ROM_BLOCK_SIZE;
+        header->chr_size = data[5] * CHR_ROM_BLOCK_SIZE;
+        header->prg_ram_size = (data[FLAGS8] ? data[FLAGS8] : 1) * 0x2000;
+        header->pal = !dirty_tail && (data[FLAGS9] & 1);
+    }
+
+    return header->prg_size > 0 && header->chr_size >= 0;
+}
 
-    FILE *rom_file = fopen(file_path, "r"); 
-    if(rom_file) {
-        file_size = fsize(rom_file);
-        rom_data = (unsigned char*)malloc(sizeof(char)*file_size);
-        size_t s = fread(rom_data, sizeof(char), file_size, rom_file);
-    } else {
-        printf("\nROM file not loaded\n");
+/*
+a known dump's database entry over its header (sizes only when the file
+holds that much), shared by Parse_Rom() and the library scanner so both
+agree on what a file is. false when the sizes are not whole 16kb/8kb
+blocks, which nes 2.0 exponents allow but the bank windows can't cover
+*/
+bool rom_fix_header(rom_header* header, const rom_db_entry* entry, long prg_offset, long file_size) {
+
+    if(entry) {
+        if(prg_offset + entry->prg_size + entry->chr_size <= (unsigned long)file_size) {
+            header->prg_size = entry->prg_size;
+            header->chr_size = entry->chr_size;
+        }
+        header->mapper = entry->mapper;
+        header->submapper = entry->submapper;
+        header->mirroring = entry->mirroring;
+        header->prg_ram_size = entry->prg_ram_size;
+        header->battery = entry->flags & ROM_DB_BATTERY;
+        header->pal = entry->flags & ROM_DB_PAL;
     }
-    fclose(rom_file); 
 
-    int prg_length = rom_data[4];
-    int chr_length = rom_data[5];
+    return header->prg_size % PRG_ROM_BLOCK_SIZE == 0 && header->chr_size % CHR_ROM_BLOCK_SIZE == 0;
+}
 
-    uint8_t mirror = rom_data[FLAGS6] & (1<<0) ? true : false;
-    battery = rom_data[FLAGS6] & (1<<1) ? true : false;
-    trainer = rom_data[FLAGS6] & (1<<2) ? true : false;
-    ignore_mirror = rom_data[FLAGS6] & (1<<3) ? true : false;
-    mapper_lower = rom_data[FLAGS6] >> 4;
+/*
+the rom is mapped read-only rather than copied, so bank windows point
+straight into the page cache and every machine running the same game
+shares one physical copy of PRG/CHR
+*/
+nes_rom* Parse_Rom(char *file_path) { 
+
+    int fd = open(file_path, O_RDONLY);
+    if(fd < 0) {
+        printf("\nROM file not loaded: %s\n", file_path);
+        return NULL;
+    }
+
+    struct stat rom_stat;
+    if(fstat(fd, &rom_stat) != 0 || rom_stat.st_size < HEADER_SIZE) {
+        printf("\nROM file too small: %s\n", file_path);
+        close(fd);
+        return NULL;
+    }
+    long file_size = rom_stat.st_size;
 
-    vs = rom_data[FLAGS7] & (1<<0) ? true : false;
-    playchoice = rom_data[FLAGS7] & (1<<0) ? true : false;
-    nes2 = ((rom_data[FLAGS7] >> 2) & 3) == 2 ? true : false;
-    mapper_upper = rom_data[FLAGS7] >> 4;
+    unsigned char* rom_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(rom_data == MAP_FAILED) {
+        printf("\nROM file could not be mapped: %s\n", file_path);
+        return NULL;
+    }
 
-    submapper = rom_data[FLAGS8] >> 0;
-    printf("submapper: %d\n", submapper);
-    printf("NES2: %d\n", nes2);
+    rom_header header;
+    if(!Parse_Header(rom_data, file_size, &header)) {
+        printf("\nNot a valid iNES file: %s\n", file_path);
+        munmap(rom_data, file_size);
+        return NULL;
+    }
 
-    tv_system = (rom_data[FLAGS10] & 3) == 2 ? true : false;
-    prg_ram_exists = (rom_data[FLAGS10] >> 4 ) & 1 ? false : true;
+    long prg_rom_offset = HEADER_SIZE + (header.trainer ? TRAINER_BLOCK_SIZE : 0);
+    long chr_rom_offset = prg_rom_offset + header.prg_size;
+    long rom_size = chr_rom_offset + header.chr_size;
+    if(file_size < rom_size) {
+        printf("\nROM file truncated (%ld of %ld bytes): %s\n", file_size, rom_size, file_path);
+        munmap(rom_data, file_size);
+        return NULL;
+    }
 
-    mapper = create_mapper(rom_data, mapper_lower + (mapper_upper << 8), prg_length, chr_length, 1, mirror);
+    nes_rom* rom = (nes_rom*) calloc(1, sizeof(nes_rom));
+    rom->data = rom_data;
+    rom->size = file_size;
+    rom->prg_offset = prg_rom_offset;
+    snprintf(rom->path, sizeof(rom->path), "%s", file_path);
+
+    // a known dump overrides whatever the header claims
+    const rom_db_entry* entry = NULL;
+    if(rom_db_identify(file_path, &rom_stat, rom_data + prg_rom_offset, header.prg_size + header.chr_size, &rom->identity))
+        entry = rom->identity.entry;
+
+    if(!rom_fix_header(&header, entry, prg_rom_offset, file_size)) {
+        printf("\nROM size is not whole PRG/CHR banks (%ld/%ld bytes): %s\n", header.prg_size, header.chr_size, file_path);
+        munmap(rom_data, file_size);
+        free(rom);
+        return NULL;
+    }
+    rom->header = header;
 
-    int prg_rom_offset = HEADER_SIZE + (trainer ? TRAINER_BLOCK_SIZE : 0);
-    int chr_rom_offset = prg_rom_offset + (PRG_ROM_BLOCK_SIZE * prg_length);
+    rom->prg_length = header.prg_size / PRG_ROM_BLOCK_SIZE;
+    rom->chr_length = header.chr_size / CHR_ROM_BLOCK_SIZE;
+
+    if(!mapper_supported(header.mapper)) {
+        printf("-------------------- MAPPER NOT IMPLEMENTED ------------------------\n");
+    }
+
+    return rom;
+}
+
+/*
+only once every machine using it has been destroyed
+*/
+void Free_Rom(nes_rom* rom) {
+
+    if(!rom)
+        return;
+
+    munmap(rom->data, rom->size);
+    free(rom);
+}
+
+/*
+--make-romdb: an index of known-good dumps, one entry per file taken from
+its own header. only meant for verified sets, whatever the headers say
+is what Parse_Rom() will later force on matching files
+*/
+int Make_ROM_DB(const char* index_path, char** paths, int count) {
+
+    rom_db_entry* entries = calloc(count > 0 ? count : 1, sizeof(rom_db_entry));
+    if(!entries)
+        return 1;
+
+    int written = 0;
+    for(int i = 0; i < count; i++) {
+
+        int fd = open(paths[i], O_RDONLY);
+        struct stat rom_stat;
+        if(fd < 0 || fstat(fd, &rom_stat) != 0 || rom_stat.st_size < HEADER_SIZE) {
+            printf("Skipped, not readable: %s\n", paths[i]);
+            if(fd >= 0)
+                close(fd);
+            continue;
+        }
+        uint8_t* data = mmap(NULL, rom_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED) {
+            printf("Skipped, not readable: %s\n", paths[i]);
+            continue;
+        }
+
+        rom_header header;
+        long offset = HEADER_SIZE;
+        bool ok = Parse_Header(data, rom_stat.st_size, &header);
+        if(ok) {
+            offset += header.trainer ? TRAINER_BLOCK_SIZE : 0;
+            ok = offset + header.prg_size + header.chr_size <= rom_stat.st_size
+                && rom_fix_header(&header, NULL, offset, rom_stat.st_size);
+        }
+
+        if(ok) {
+            size_t length = header.prg_size + header.chr_size;
+            rom_db_entry* entry = &entries[written++];
+            uint8_t sha1[20];
+            sha1_digest(data + offset, length, sha1);
+
+            entry->crc32 = crc32_update(0, data + offset, length);
+            entry->prg_size = header.prg_size;
+            entry->chr_size = header.chr_size;
+            entry->prg_ram_size = header.prg_ram_size;
+            entry->mapper = header.mapper;
+            entry->submapper = header.submapper;
+            entry->mirroring = header.mirroring;
+            entry->flags = (header.battery ? ROM_DB_BATTERY : 0) | (header.pal ? ROM_DB_PAL : 0);
+            memcpy(entry->sha1_prefix, sha1, 8);
+        }
+        else {
+            printf("Skipped, not a usable iNES file: %s\n", paths[i]);
+        }
+        munmap(data, rom_stat.st_size);
+    }
+
+    bool ok = rom_db_write_index(index_path, entries, written);
+    printf(ok ? "%d of %d dumps written to %s\n" : "%d of %d dumps, could not write %s\n", written, count, index_path);
+    free(entries);
+    return ok ? 0 : 1;
+}
+
+/*
+set up a machine's mapper over the shared rom mapping. prg/chr windows
+point into the rom, everything writable is per machine
+*/
+void Init_Mapper(nes_machine* nes, nes_rom* rom) {
+
+    memory_mapper* mapper = &nes->mapper;
+
+    init_mapper(mapper, rom->header.mapper, rom->prg_length, rom->chr_length, 1, rom->header.mirroring);
+
+    mapper->prg_rom = rom->data + rom->prg_offset;
+    mapper->chr_rom = rom->chr_length > 0 ? rom->data + rom->prg_offset + rom->header.prg_size : mapper->chr_ram;
 
     switch(mapper->type) {
         case 0:
-            mapper_0(mapper, rom_data);
+            mapper_0(mapper, rom->data);
             break;
         case 1:
-            mapper_1(mapper, rom_data);
+            mapper_1(mapper, rom->data);
+            break;
+        case 4:
+            mapper_4(mapper, rom->data);
+            break;
+        case MAPPER_NSF:
+            mapper_nsf(mapper, rom->data);
             break;
         default:
-            printf("-------------------- MAPPER NOT IMPLEMENTED ------------------------");
+            // not implemented, fixed nrom windows so the cart still loads
+            mapper_0(mapper, rom->data);
+            break;
+    }
+}
+
+/*
+battery backed prg ram is a shared mapping of <rom>.sav, so $6000-$7fff
+writes go straight to the page cache and survive a crash without any
+save/load step. the kernel writes the pages back; Flush_Save_RAM() only
+nudges it once per frame when something changed. only the frontend
+machine does this, other instances keep prg ram in work_ram.
+*/
+bool Map_Save_RAM(nes_machine* nes) {
+
+    char save_path[512];
+    if(!rom_sibling_path(nes->rom->path, ".sav", save_path, sizeof(save_path)))
+        return false;
+
+    int fd = open(save_path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        printf("Could not open save file: %s\n", save_path);
+        return false;
+    }
+
+    struct stat save_stat;
+    if(fstat(fd, &save_stat) != 0 || (save_stat.st_size < 0x2000 && ftruncate(fd, 0x2000) != 0)) {
+        close(fd);
+        return false;
+    }
+
+    uint8_t* save_ram = mmap(NULL, 0x2000, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(save_ram == MAP_FAILED) {
+        printf("Could not map save file: %s\n", save_path);
+        return false;
     }
 
-    ROM_Description(file_path);
+    nes->mapper.prg_ram = save_ram;
+    nes->mapper.prg_ram_battery = true;
+    nes->mapper.prg_ram_dirty = false;
+
+    return true;
+}
+
+/*
+<rom path minus .nes><extension>, for files that belong to a game
+*/
+bool rom_sibling_path(const char* rom_path, const char* extension, char* out, size_t size) {
+
+    size_t length = strlen(rom_path);
+    if(length > 4 && strcmp(rom_path + length - 4, ".nes") == 0)
+        length -= 4;
+    if(length + strlen(extension) + 1 > size)
+        return false;
+
+    memcpy(out, rom_path, length);
+    strcpy(out + length, extension);
+    return true;
 }
 
-// helper
+void Flush_Save_RAM(nes_machine* nes) {
+
+    memory_mapper* mapper = &nes->mapper;
 
-int fsize(FILE *fp) {
-    int prev=ftell(fp);
-    fseek(fp, 0L, SEEK_END);
-    int sz=ftell(fp);
-    fseek(fp,prev,SEEK_SET); //go back to where we were
-    return sz;
+    if(mapper->prg_ram_battery && mapper->prg_ram_dirty) {
+        msync(mapper->prg_ram, 0x2000, MS_ASYNC);
+        mapper->prg_ram_dirty = false;
+    }
 }
 
 // ShutDown
 
-void Shut_Down_ROM() {
-    free(mapper->rom_data);
-    free(mapper);
+void Shut_Down_ROM(nes_machine* nes) {
+
+    memory_mapper* mapper = &nes->mapper;
+
+    if(mapper->prg_ram_battery) {
+        msync(mapper->prg_ram, 0x2000, MS_SYNC);
+        munmap(mapper->prg_ram, 0x2000);
+        mapper->prg_ram = mapper->work_ram;
+        mapper->prg_ram_battery = false;
+    }
+}
+
+void ROM_Description(nes_rom* rom) {
+    printf("ROM: %s\nPRG LENGTH: %d\nCHR LENGTH: %d\nMAPPER: %d.%d\nmirroring: %d, trainer: %d, battery: %d, NES2: %d, PRG_RAM: %d\nCRC32: %08x%s\n\n"
+        , rom->path, rom->prg_length, rom->chr_length, rom->header.mapper, rom->header.submapper, rom->header.mirroring, rom->header.trainer
+        , rom->header.battery, rom->header.nes2, rom->header.prg_ram_size, rom->identity.crc32, rom->identity.entry ? " (known dump)" : "");
 }
 
-void ROM_Description(char* filepath) {
-    printf("ROM: %s\nPRG LENGTH: %d\nCHR LENGTH: %d\nMAPPER: %d\nmirror: %d, trainer: %d, battery: %d, ignore_mirror: %d, PRG_RAM: %d\n\n"
-        , filepath, mapper->prg_length, mapper->chr_length, mapper_lower, mirror, trainer, battery, ignore_mirror, prg_ram_exists);
+/*
+the mapper only raises/acknowledges its own irq output, this carries it
+onto the machine's cpu IRQ line
+*/
+static void mapper_irq_line(nes_machine* nes) {
+
+    if(nes->mapper.irq_asserted)
+        nes->cpu.irq |= IRQ_MAPPER;
+    else
+        nes->cpu.irq &= ~IRQ_MAPPER;
 }
 
-void mapper_write(uint16_t addr, uint8_t data) {
+void mapper_write(nes_machine* nes, uint16_t addr, uint8_t data) {
 
-    switch (mapper->type) {
+    switch (nes->mapper.type) {
         
         case 1:
-            mapper_write_1(addr, data, mapper);
+            mapper_write_1(addr, data, &nes->mapper);
+            break;
+
+        case 4:
+            mapper_write_4(addr, data, &nes->mapper);
+            mapper_irq_line(nes);
+            break;
+
+        case MAPPER_NSF:
+            mapper_write_nsf(addr, data, &nes->mapper);
             break;
+    }
+}
+
+bool mapper_supported(int type) {
 
+    return type == 0 || type == 1 || type == 4;
+}
+
+/*
+rising edge on ppu address line A12, used by MMC3 to count scanlines
+*/
+void mapper_a12_rise(nes_machine* nes) {
+
+    if(nes->mapper.type == 4) {
+        mapper_irq_clock_4(&nes->mapper);
+        mapper_irq_line(nes);
     }
-}
\ No newline at end of file
+}
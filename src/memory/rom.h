@@ -1,31 +1,73 @@
+#ifndef ROM_H
+#define ROM_H
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "rom_db.h"
+#include "../machine.h"
+
+/*
+decoded iNES 1.0 / NES 2.0 header
+*/
+typedef struct rom_header {
+
+    long prg_size; // bytes
+    long chr_size;
+    int prg_ram_size;
+    int mapper;
+    int submapper;
+    uint8_t mirroring; // 2 = vertical / 3 = horizontal / 4 = four screen
+    bool trainer;
+    bool battery;
+    bool vs;
+    bool playchoice;
+    bool nes2;
+    bool pal;
+
+} rom_header;
 
-#include "mapper.h"
+/*
+a parsed rom file. the file is mapped read-only and never written, so one
+of these can back any number of machines running the same game
+*/
+typedef struct nes_rom {
+
+    uint8_t* data; // read-only file mapping
+    long size;
+    long prg_offset; // past header and trainer
+    int prg_length; // 16kb blocks
+    int chr_length; // 8kb blocks, 0 = chr ram
+    rom_header header;
+    rom_id identity;
+    char path[512];
+
+} nes_rom;
 
 extern const int HEADER_SIZE;
 extern const int TRAINER_BLOCK_SIZE;
 extern const int PRG_ROM_BLOCK_SIZE;
 extern const int CHR_ROM_BLOCK_SIZE;
 
-extern unsigned char* prg_rom;
-extern unsigned char* chr_rom;
-extern unsigned char prg_ram[0x2000];
-
-extern int prg_rom_cpu_addr;
-extern int prg_rom_cpu_length;
-extern int prg_rom_mirror_offset;
-
-extern int prg_ram_cpu_addr;
-extern int prg_ram_cpu_length;
+nes_rom* Parse_Rom(char *file_path);
+bool Parse_Header(const uint8_t* data, long size, rom_header* header);
+bool rom_fix_header(rom_header* header, const rom_db_entry* entry, long prg_offset, long file_size);
+long rom_size_nes2(uint8_t lsb, uint8_t msb, long block_size);
+void Free_Rom(nes_rom* rom);
+int Make_ROM_DB(const char* index_path, char** paths, int count);
 
-extern memory_mapper* mapper;
+void ROM_Description(nes_rom* rom);
 
-void Parse_Rom(char *file_path);
+void Init_Mapper(nes_machine* nes, nes_rom* rom);
+void mapper_write(nes_machine* nes, uint16_t addr, uint8_t data);
+void mapper_a12_rise(nes_machine* nes);
+bool mapper_supported(int type);
 
-void ROM_Description(char* filepath);
-int fsize(FILE *fp);
+bool Map_Save_RAM(nes_machine* nes);
+bool rom_sibling_path(const char* rom_path, const char* extension, char* out, size_t size);
+void Flush_Save_RAM(nes_machine* nes);
 
-void mapper_write(uint16_t addr, uint8_t data);
+void Shut_Down_ROM(nes_machine* nes);
 
-void Shut_Down_ROM();
\ No newline at end of file
+#endif
@@ -0,0 +1,458 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rom_db.h"
+
+const char* ROM_DB_PATH = "../../ROMS/romdb.bin";
+const char* ROM_DB_CACHE_PATH = "../../ROMS/romdb_cache.bin";
+
+/*
+index file: 16 byte header followed by rom_db_entry records sorted by crc32
+*/
+static const char INDEX_MAGIC[8] = {'N','E','S','R','O','M','D','B'};
+static const uint32_t INDEX_VERSION = 1;
+
+typedef struct rom_db_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+} rom_db_index_header;
+
+static const rom_db_entry* index_entries = NULL;
+static int index_count = 0;
+static void* index_mapping = NULL;
+static size_t index_mapping_size = 0;
+
+static bool sha1_enabled = false;
+
+/*
+per-file cache keyed by path, mtime and size so unchanged files are never
+hashed twice. open addressing, persisted to the cache file on shutdown.
+paths are not stored, a second independent hash of the path has to match
+too so a colliding path is never handed another file's result.
+*/
+typedef struct rom_db_cache_entry {
+    uint64_t path_hash; // 0 = empty slot
+    uint64_t path_check;
+    int64_t mtime_ns;
+    int64_t size;
+    uint32_t crc32;
+    uint8_t has_sha1;
+    uint8_t sha1[20];
+} rom_db_cache_entry;
+
+static const char CACHE_MAGIC[8] = {'N','E','S','R','O','M','C','2'};
+
+static rom_db_cache_entry* cache = NULL;
+static int cache_capacity = 0;
+static int cache_count = 0;
+static bool cache_dirty = false;
+static char* cache_file = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// crc32 (reflected 0xedb88320), slice-by-8
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table(void) {
+
+    for(int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for(int j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+        crc_table[0][i] = crc;
+    }
+    for(int i = 0; i < 256; i++) {
+        for(int t = 1; t < 8; t++)
+            crc_table[t][i] = (crc_table[t-1][i] >> 8) ^ crc_table[0][crc_table[t-1][i] & 0xff];
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length) {
+
+    pthread_once(&crc_table_once, build_crc_table);
+
+    crc = ~crc;
+    while(length >= 8) {
+        uint32_t one = (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24)) ^ crc;
+        uint32_t two = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+        crc = crc_table[7][one & 0xff] ^ crc_table[6][(one >> 8) & 0xff]
+            ^ crc_table[5][(one >> 16) & 0xff] ^ crc_table[4][one >> 24]
+            ^ crc_table[3][two & 0xff] ^ crc_table[2][(two >> 8) & 0xff]
+            ^ crc_table[1][(two >> 16) & 0xff] ^ crc_table[0][two >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while(length--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xff];
+    }
+    return ~crc;
+}
+
+// sha-1
+
+static uint32_t rol32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t* block) {
+
+    uint32_t w[80];
+    for(int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i*4] << 24) | (block[i*4+1] << 16) | (block[i*4+2] << 8) | block[i*4+3];
+    }
+    for(int i = 16; i < 80; i++) {
+        w[i] = rol32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for(int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if(i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if(i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if(i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t temp = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(b, 30);
+        b = a;
+        a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1_digest(const uint8_t* data, size_t length, uint8_t digest[20]) {
+
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+    size_t remaining = length;
+    while(remaining >= 64) {
+        sha1_block(state, data);
+        data += 64;
+        remaining -= 64;
+    }
+
+    // padding: 0x80, zeros, 64-bit big endian bit length
+    uint8_t tail[128] = {0};
+    memcpy(tail, data, remaining);
+    tail[remaining] = 0x80;
+    int tail_length = remaining < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)length * 8;
+    for(int i = 0; i < 8; i++) {
+        tail[tail_length - 1 - i] = bits >> (i * 8);
+    }
+    sha1_block(state, tail);
+    if(tail_length == 128)
+        sha1_block(state, tail + 64);
+
+    for(int i = 0; i < 5; i++) {
+        digest[i*4] = state[i] >> 24;
+        digest[i*4+1] = state[i] >> 16;
+        digest[i*4+2] = state[i] >> 8;
+        digest[i*4+3] = state[i];
+    }
+}
+
+// index
+
+static bool map_index(const char* path) {
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat index_stat;
+    if(fstat(fd, &index_stat) != 0 || index_stat.st_size < (off_t)sizeof(rom_db_index_header)) {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(NULL, index_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    const rom_db_index_header* header = mapping;
+    size_t expected = sizeof(rom_db_index_header) + ((size_t)header->count * sizeof(rom_db_entry));
+    if(memcmp(header->magic, INDEX_MAGIC, 8) != 0 || header->version != INDEX_VERSION || expected > (size_t)index_stat.st_size) {
+        printf("ROM database %s is invalid, ignoring\n", path);
+        munmap(mapping, index_stat.st_size);
+        return false;
+    }
+
+    index_mapping = mapping;
+    index_mapping_size = index_stat.st_size;
+    index_entries = (const rom_db_entry*)((const uint8_t*)mapping + sizeof(rom_db_index_header));
+    index_count = header->count;
+    return true;
+}
+
+const rom_db_entry* rom_db_lookup(uint32_t crc32, const uint8_t* sha1) {
+
+    int low = 0;
+    int high = index_count;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        if(index_entries[mid].crc32 < crc32)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // several dumps can share a crc, the sha1 prefix breaks the tie when known
+    const rom_db_entry* match = NULL;
+    static const uint8_t no_sha1[8] = {0};
+    for(int i = low; i < index_count && index_entries[i].crc32 == crc32; i++) {
+        const rom_db_entry* entry = &index_entries[i];
+        if(!sha1 || memcmp(entry->sha1_prefix, no_sha1, 8) == 0) {
+            if(!match)
+                match = entry;
+        }
+        else if(memcmp(entry->sha1_prefix, sha1, 8) == 0) {
+            return entry;
+        }
+    }
+    return match;
+}
+
+static int compare_entries(const void* a, const void* b) {
+
+    uint32_t crc_a = ((const rom_db_entry*)a)->crc32;
+    uint32_t crc_b = ((const rom_db_entry*)b)->crc32;
+    return (crc_a > crc_b) - (crc_a < crc_b);
+}
+
+bool rom_db_write_index(const char* path, rom_db_entry* entries, int count) {
+
+    qsort(entries, count, sizeof(rom_db_entry), compare_entries);
+
+    FILE* file = fopen(path, "wb");
+    if(!file)
+        return false;
+
+    rom_db_index_header header;
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.version = INDEX_VERSION;
+    header.count = count;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(rom_db_entry), count, file) == (size_t)count;
+    return (fclose(file) == 0) && ok;
+}
+
+// cache
+
+static uint64_t hash_path(const char* path) {
+
+    // fnv-1a, never 0 so 0 can mark empty slots
+    uint64_t hash = 0xcbf29ce484222325;
+    for(; *path; path++) {
+        hash ^= (uint8_t)*path;
+        hash *= 0x100000001b3;
+    }
+    return hash ? hash : 1;
+}
+
+static uint64_t check_path(const char* path) {
+
+    // murmur3 style mixing, nothing in common with fnv-1a above
+    uint64_t hash = 0x9e3779b97f4a7c15;
+    for(; *path; path++) {
+        hash = (hash ^ (uint8_t)*path) * 0xff51afd7ed558ccd;
+        hash ^= hash >> 33;
+    }
+    return hash;
+}
+
+static rom_db_cache_entry* cache_slot(uint64_t path_hash) {
+
+    int mask = cache_capacity - 1;
+    for(int i = path_hash & mask; ; i = (i + 1) & mask) {
+        if(cache[i].path_hash == path_hash || cache[i].path_hash == 0)
+            return &cache[i];
+    }
+}
+
+static void cache_insert(const rom_db_cache_entry* entry) {
+
+    if((cache_count + 1) * 4 > cache_capacity * 3) {
+        rom_db_cache_entry* old = cache;
+        int old_capacity = cache_capacity;
+
+        cache_capacity = cache_capacity ? cache_capacity * 2 : 256;
+        cache = calloc(cache_capacity, sizeof(rom_db_cache_entry));
+        cache_count = 0;
+        for(int i = 0; i < old_capacity; i++) {
+            if(old[i].path_hash) {
+                *cache_slot(old[i].path_hash) = old[i];
+                cache_count++;
+            }
+        }
+        free(old);
+    }
+
+    rom_db_cache_entry* slot = cache_slot(entry->path_hash);
+    if(slot->path_hash == 0)
+        cache_count++;
+    *slot = *entry;
+    cache_dirty = true;
+}
+
+static void load_cache(const char* path) {
+
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return;
+
+    char magic[8];
+    uint32_t count = 0;
+    if(fread(magic, 8, 1, file) == 1 && memcmp(magic, CACHE_MAGIC, 8) == 0 && fread(&count, 4, 1, file) == 1) {
+        rom_db_cache_entry entry;
+        for(uint32_t i = 0; i < count && fread(&entry, sizeof(entry), 1, file) == 1; i++) {
+            if(entry.path_hash)
+                cache_insert(&entry);
+        }
+    }
+    fclose(file);
+    cache_dirty = false;
+}
+
+bool rom_db_save_cache(const char* path) {
+
+    pthread_mutex_lock(&cache_lock);
+
+    bool ok = true;
+    if(cache_dirty) {
+        FILE* file = fopen(path, "wb");
+        ok = file != NULL;
+        if(ok) {
+            uint32_t count = cache_count;
+            ok = fwrite(CACHE_MAGIC, 8, 1, file) == 1 && fwrite(&count, 4, 1, file) == 1;
+            for(int i = 0; ok && i < cache_capacity; i++) {
+                if(cache[i].path_hash)
+                    ok = fwrite(&cache[i], sizeof(rom_db_cache_entry), 1, file) == 1;
+            }
+            ok = (fclose(file) == 0) && ok;
+        }
+        cache_dirty = !ok;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+    return ok;
+}
+
+/*
+hash PRG+CHR (cached by path/mtime/size) and find the file in the index.
+thread safe, the scanner calls this from every worker.
+*/
+bool rom_db_identify(const char* path, const struct stat* file_stat, const uint8_t* data, size_t length, rom_id* id) {
+
+    memset(id, 0, sizeof(rom_id));
+
+    rom_db_cache_entry key = {0};
+    key.path_hash = hash_path(path);
+    key.path_check = check_path(path);
+    if(file_stat) {
+        key.mtime_ns = (int64_t)file_stat->st_mtim.tv_sec * 1000000000 + file_stat->st_mtim.tv_nsec;
+        key.size = file_stat->st_size;
+    }
+
+    bool cached = false;
+    if(file_stat && cache_file) {
+        pthread_mutex_lock(&cache_lock);
+        if(cache_capacity) {
+            rom_db_cache_entry* slot = cache_slot(key.path_hash);
+            if(slot->path_hash && slot->path_check == key.path_check && slot->mtime_ns == key.mtime_ns && slot->size == key.size
+                && (slot->has_sha1 || !sha1_enabled)) {
+                key = *slot;
+                cached = true;
+            }
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+
+    if(!cached) {
+        if(!data)
+            return false;
+
+        key.crc32 = crc32_update(0, data, length);
+        if(sha1_enabled) {
+            sha1_digest(data, length, key.sha1);
+            key.has_sha1 = 1;
+        }
+
+        if(file_stat && cache_file) {
+            pthread_mutex_lock(&cache_lock);
+            cache_insert(&key);
+            pthread_mutex_unlock(&cache_lock);
+        }
+    }
+
+    id->crc32 = key.crc32;
+    id->has_sha1 = key.has_sha1;
+    memcpy(id->sha1, key.sha1, 20);
+    id->entry = rom_db_lookup(id->crc32, id->has_sha1 ? id->sha1 : NULL);
+
+    return true;
+}
+
+// init / shutdown
+
+bool Init_ROM_DB(const char* index_path, const char* cache_path, bool use_sha1) {
+
+    sha1_enabled = use_sha1;
+
+    bool found = index_path && map_index(index_path);
+    if(found) {
+        printf("ROM database: %d entries\n", index_count);
+    }
+
+    if(cache_path) {
+        cache_file = strdup(cache_path);
+        load_cache(cache_path);
+    }
+
+    return found;
+}
+
+void Shut_Down_ROM_DB() {
+
+    if(cache_file) {
+        rom_db_save_cache(cache_file);
+        free(cache_file);
+        cache_file = NULL;
+    }
+    free(cache);
+    cache = NULL;
+    cache_capacity = 0;
+    cache_count = 0;
+
+    if(index_mapping) {
+        munmap(index_mapping, index_mapping_size);
+        index_mapping = NULL;
+        index_entries = NULL;
+        index_count = 0;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef ROM_DB_H
+#define ROM_DB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+known-good dump in the index file. entries are sorted by the crc32 of
+PRG+CHR (no header/trainer) so lookups are a binary search over the
+mapped file.
+*/
+typedef struct rom_db_entry {
+
+    uint32_t crc32;
+    uint32_t prg_size; // bytes
+    uint32_t chr_size;
+    uint32_t prg_ram_size;
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t mirroring; // 2 = vertical / 3 = horizontal / 4 = four screen
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint8_t sha1_prefix[8]; // all zero when unknown
+
+} rom_db_entry;
+
+enum ROM_DB_FLAG
+{
+    ROM_DB_BATTERY = 1 << 0,
+    ROM_DB_PAL = 1 << 1,
+};
+
+/*
+result of identifying one file
+*/
+typedef struct rom_id {
+
+    uint32_t crc32;
+    uint8_t sha1[20];
+    bool has_sha1;
+    const rom_db_entry* entry; // NULL when not in the index
+
+} rom_id;
+
+extern const char* ROM_DB_PATH;
+extern const char* ROM_DB_CACHE_PATH;
+
+bool Init_ROM_DB(const char* index_path, const char* cache_path, bool use_sha1);
+void Shut_Down_ROM_DB();
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length);
+void sha1_digest(const uint8_t* data, size_t length, uint8_t digest[20]);
+
+bool rom_db_identify(const char* path, const struct stat* file_stat, const uint8_t* data, size_t length, rom_id* id);
+const rom_db_entry* rom_db_lookup(uint32_t crc32, const uint8_t* sha1);
+bool rom_db_write_index(const char* path, rom_db_entry* entries, int count);
+bool rom_db_save_cache(const char* path);
+
+#endif
@@ -13,5 +13,3 @@ const int SPRITE_PALETTE = 0x3F10;
 //remainder mirros 3F00-3F1F
 
 //0x4000-0x10000 MIRROS  0x0000-0x3FFF
-
-unsigned char vram[0x3fff];
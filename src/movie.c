@@ -0,0 +1,396 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "movie.h"
+#include "state.h"
+#include "memory/rom.h"
+#include "devices/controller.h"
+
+static int expected_keyframes(movie* film) {
+
+    return film->frame_count ? (film->frame_count - 1) / film->keyframe_interval + 1 : 1;
+}
+
+static bool index_path(movie* film, char* out, size_t size) {
+
+    return snprintf(out, size, "%s.idx", film->path) < (int)size;
+}
+
+static bool add_keyframe(movie* film) {
+
+    if(film->keyframe_count == film->keyframe_capacity) {
+        int capacity = film->keyframe_capacity ? film->keyframe_capacity * 2 : 16;
+        uint8_t* keyframes = realloc(film->keyframes, film->state_size * capacity);
+        if(!keyframes)
+            return false;
+        film->keyframes = keyframes;
+        film->keyframe_capacity = capacity;
+    }
+
+    Save_State(film->nes, film->keyframes + (film->state_size * film->keyframe_count), film->state_size);
+    film->keyframe_count++;
+    return true;
+}
+
+static movie* create_movie(nes_machine* nes, const char* path, movie_mode mode) {
+
+    movie* film = calloc(1, sizeof(movie));
+    if(!film)
+        return NULL;
+
+    film->nes = nes;
+    film->mode = mode;
+    film->keyframe_interval = MOVIE_KEYFRAME_INTERVAL;
+    film->state_size = State_Size(nes);
+    film->desync_frame = -1;
+    snprintf(film->path, sizeof(film->path), "%s", path);
+
+    film->power_on = malloc(film->state_size);
+    if(!film->power_on) {
+        free(film);
+        return NULL;
+    }
+    return film;
+}
+
+static void free_movie(movie* film) {
+
+    free(film->input);
+    free(film->hashes);
+    free(film->power_on);
+    free(film->keyframes);
+    free(film);
+}
+
+static bool write_movie(movie* film) {
+
+    movie_header header = {0};
+    memcpy(header.magic, "NESMOVIE", 8);
+    header.version = MOVIE_VERSION;
+    header.crc32 = film->nes->rom->identity.crc32;
+    header.frame_count = film->frame_count;
+    header.ports = 1;
+    header.state_size = film->state_size;
+
+    FILE* file = fopen(film->path, "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(film->power_on, 1, film->state_size, file) == film->state_size;
+    ok = ok && fwrite(film->input, 1, film->frame_count, file) == (size_t)film->frame_count;
+    ok = ok && fwrite(film->hashes, sizeof(uint64_t), film->frame_count, file) == (size_t)film->frame_count;
+    return (fclose(file) == 0) && ok;
+}
+
+static bool write_index(movie* film) {
+
+    movie_index_header header = {0};
+    memcpy(header.magic, "NESMVIDX", 8);
+    header.version = MOVIE_VERSION;
+    header.crc32 = film->nes->rom->identity.crc32;
+    header.frame_count = film->frame_count;
+    header.keyframe_interval = film->keyframe_interval;
+    header.keyframe_count = film->keyframe_count;
+    header.state_size = film->state_size;
+
+    char path[528];
+    if(!index_path(film, path, sizeof(path)))
+        return false;
+
+    FILE* file = fopen(path, "wb");
+    if(!file)
+        return false;
+
+    size_t size = film->state_size * film->keyframe_count;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(film->keyframes, 1, size, file) == size;
+    return (fclose(file) == 0) && ok;
+}
+
+/*
+a stale or foreign index is ignored, Movie_Seek() rebuilds it
+*/
+static bool read_index(movie* film) {
+
+    char path[528];
+    if(!index_path(film, path, sizeof(path)))
+        return false;
+
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    movie_index_header header;
+    int count = expected_keyframes(film);
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, "NESMVIDX", 8) == 0
+        && header.version == MOVIE_VERSION
+        && header.crc32 == film->nes->rom->identity.crc32
+        && header.frame_count == (uint32_t)film->frame_count
+        && header.keyframe_interval == (uint32_t)film->keyframe_interval
+        && header.keyframe_count == (uint32_t)count
+        && header.state_size == film->state_size;
+
+    if(ok) {
+        film->keyframes = malloc(film->state_size * count);
+        ok = film->keyframes && fread(film->keyframes, film->state_size, count, file) == (size_t)count;
+        if(ok) {
+            film->keyframe_count = film->keyframe_capacity = count;
+        }
+        else {
+            free(film->keyframes);
+            film->keyframes = NULL;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/*
+one pass over the whole movie without rendering, leaves the machine at
+the end of it
+*/
+static bool build_index(movie* film) {
+
+    nes_machine* nes = film->nes;
+    film->keyframe_count = 0;
+    if(!Load_State(nes, film->power_on, film->state_size))
+        return false;
+
+    nes->skip_render = true;
+    for(int f = 0; f < film->frame_count; f++) {
+        if(f % film->keyframe_interval == 0 && !add_keyframe(film))
+            break;
+        button_set(nes, film->input[f]);
+        Run_Frame(nes);
+    }
+    nes->skip_render = false;
+
+    if(film->keyframe_count == 0 && !add_keyframe(film))
+        return false;
+    if(film->keyframe_count != expected_keyframes(film))
+        return false;
+
+    write_index(film);
+    return true;
+}
+
+/*
+power cycles the machine and records from there. the power-on state goes
+in the movie, so battery RAM and anything else the cart starts with is
+replayed as it was
+*/
+movie* Movie_Record(nes_machine* nes, const char* path) {
+
+    movie* film = create_movie(nes, path, MOVIE_RECORDING);
+    if(!film)
+        return NULL;
+
+    Reset_Machine(nes);
+    Save_State(nes, film->power_on, film->state_size);
+    if(!add_keyframe(film)) {
+        free_movie(film);
+        return NULL;
+    }
+
+    return film;
+}
+
+/*
+puts the machine in the movie's power-on state, NULL if the movie is for
+another rom or unreadable
+*/
+movie* Movie_Play(nes_machine* nes, const char* path) {
+
+    movie* film = create_movie(nes, path, MOVIE_PLAYING);
+    if(!film)
+        return NULL;
+
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        free_movie(film);
+        return NULL;
+    }
+
+    movie_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, "NESMOVIE", 8) == 0
+        && header.version == MOVIE_VERSION
+        && header.crc32 == nes->rom->identity.crc32
+        && header.ports == 1
+        && header.state_size == film->state_size;
+
+    if(ok) {
+        film->frame_count = film->input_capacity = header.frame_count;
+        film->input = malloc(film->frame_count ? film->frame_count : 1);
+        film->hashes = malloc(sizeof(uint64_t) * (film->frame_count ? film->frame_count : 1));
+        ok = film->input && film->hashes
+            && fread(film->power_on, 1, film->state_size, file) == film->state_size
+            && fread(film->input, 1, film->frame_count, file) == (size_t)film->frame_count
+            && fread(film->hashes, sizeof(uint64_t), film->frame_count, file) == (size_t)film->frame_count;
+    }
+    fclose(file);
+
+    if(!ok || !Load_State(nes, film->power_on, film->state_size)) {
+        free_movie(film);
+        return NULL;
+    }
+
+    read_index(film);
+    return film;
+}
+
+/*
+writes a recording (and its index) out, then frees the movie either way
+*/
+bool Close_Movie(movie* film) {
+
+    if(!film)
+        return false;
+
+    bool ok = true;
+    if(film->mode == MOVIE_RECORDING) {
+        ok = write_movie(film);
+        ok = ok && write_index(film);
+    }
+
+    free_movie(film);
+    return ok;
+}
+
+/*
+call before every Run_Frame(). records the pad, or applies the recorded
+one; false once playback has run out. the machine is hashed either way,
+with this frame's pad in place, and on playback a hash that differs from
+the recording sets desync_frame
+*/
+bool Movie_Frame(movie* film) {
+
+    nes_machine* nes = film->nes;
+    state_hash hash;
+
+    if(film->mode == MOVIE_PLAYING) {
+        if(film->frame >= film->frame_count)
+            return false;
+        button_set(nes, film->input[film->frame]);
+        Hash_Machine(nes, &hash);
+        if(hash.total != film->hashes[film->frame] && film->desync_frame < 0)
+            film->desync_frame = film->frame;
+        film->frame++;
+        return true;
+    }
+
+    if(film->frame > 0 && film->frame % film->keyframe_interval == 0 && !add_keyframe(film))
+        return false;
+
+    if(film->frame == film->input_capacity) {
+        int capacity = film->input_capacity ? film->input_capacity * 2 : 3600;
+        uint8_t* input = realloc(film->input, capacity);
+        if(input)
+            film->input = input;
+        uint64_t* hashes = realloc(film->hashes, sizeof(uint64_t) * capacity);
+        if(hashes)
+            film->hashes = hashes;
+        if(!input || !hashes)
+            return false;
+        film->input_capacity = capacity;
+    }
+
+    Hash_Machine(nes, &hash);
+    film->hashes[film->frame] = hash.total;
+    film->input[film->frame++] = button_get(nes);
+    film->frame_count = film->frame;
+    return true;
+}
+
+/*
+puts the machine at the start of the given frame of a movie being played:
+the nearest keyframe before it, then at most keyframe_interval frames
+*/
+bool Movie_Seek(movie* film, int frame) {
+
+    nes_machine* nes = film->nes;
+    if(film->mode != MOVIE_PLAYING || frame < 0 || frame > film->frame_count)
+        return false;
+
+    if(film->keyframe_count != expected_keyframes(film) && !build_index(film))
+        return false;
+
+    int keyframe = frame / film->keyframe_interval;
+    if(keyframe >= film->keyframe_count)
+        keyframe = film->keyframe_count - 1;
+    if(!Load_State(nes, film->keyframes + (film->state_size * keyframe), film->state_size))
+        return false;
+
+    for(int f = keyframe * film->keyframe_interval; f < frame; f++) {
+        nes->skip_render = f < frame - 1;
+        button_set(nes, film->input[f]);
+        Run_Frame(nes);
+    }
+    nes->skip_render = false;
+
+    film->frame = frame;
+    return true;
+}
+
+static double seconds_since(struct timespec* begin) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--movie: replay a movie headless as a fixed workload, optionally timing a
+seek to seek_frame (the first seek builds the index if it has to)
+*/
+int Run_Movie_Bench(char* rom_path, char* movie_path, int seek_frame) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    movie* film = nes ? Movie_Play(nes, movie_path) : NULL;
+    if(!film) {
+        printf("Movie %s does not play on this rom\n", movie_path);
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while(Movie_Frame(film)) {
+        Run_Frame(nes);
+    }
+    double elapsed = seconds_since(&begin);
+    printf("%d frames in %.2fs, %.0f frames/s, pc=%04x\n",
+        film->frame_count, elapsed, film->frame_count / elapsed, nes->cpu.pc);
+    if(film->desync_frame >= 0)
+        printf("out of sync from frame %d\n", film->desync_frame);
+    else
+        printf("in sync, every frame hash matches\n");
+
+    bool ok = film->desync_frame < 0;
+    if(seek_frame >= 0) {
+        for(int pass = 0; pass < 2 && ok; pass++) {
+            clock_gettime(CLOCK_MONOTONIC, &begin);
+            ok = Movie_Seek(film, seek_frame);
+            printf("seek to %d: %.2f ms%s\n", seek_frame, seconds_since(&begin) * 1e3,
+                pass == 0 ? " (cold)" : "");
+        }
+    }
+
+    Close_Movie(film);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "machine.h"
+
+#define MOVIE_VERSION 2
+#define MOVIE_KEYFRAME_INTERVAL 600 // frames, 10 seconds
+
+/*
+movie file:
+    movie_header
+    power-on save state (state_size bytes)
+    frame_count * ports bytes of controller state, bit n = button n
+    frame_count 64 bit Hash_Machine() totals, the machine at the start of
+    each frame with its pad applied. playback checks them, the first
+    miss is the frame a replay went out of sync
+
+keyframe index, <movie>.idx, rebuilt from the movie whenever it is
+missing or does not match:
+    movie_index_header
+    keyframe_count save states, keyframe k is the machine at the start of
+    frame k * keyframe_interval
+
+a frame is one Run_Frame(), the input for it is applied just before.
+*/
+typedef struct movie_header {
+
+    char magic[8]; // "NESMOVIE"
+    uint32_t version;
+    uint32_t crc32; // rom PRG+CHR
+    uint32_t frame_count;
+    uint32_t ports; // controller bytes per frame
+    uint32_t state_size;
+    uint32_t reserved;
+
+} movie_header;
+
+typedef struct movie_index_header {
+
+    char magic[8]; // "NESMVIDX"
+    uint32_t version;
+    uint32_t crc32;
+    uint32_t frame_count; // of the movie it was built from
+    uint32_t keyframe_interval;
+    uint32_t keyframe_count;
+    uint32_t state_size;
+
+} movie_index_header;
+
+typedef enum movie_mode {
+    MOVIE_RECORDING,
+    MOVIE_PLAYING
+} movie_mode;
+
+typedef struct movie {
+
+    nes_machine* nes;
+    movie_mode mode;
+    char path[512];
+
+    uint8_t* input;
+    int frame_count;
+    int input_capacity;
+    int frame; // next frame to record or play
+    uint64_t* hashes; // frame_count, like input
+    int desync_frame; // first frame that played back differently, -1 none
+
+    size_t state_size;
+    uint8_t* power_on;
+
+    int keyframe_interval;
+    uint8_t* keyframes;
+    int keyframe_count;
+    int keyframe_capacity;
+
+} movie;
+
+movie* Movie_Record(nes_machine* nes, const char* path);
+movie* Movie_Play(nes_machine* nes, const char* path);
+bool Close_Movie(movie* film);
+
+bool Movie_Frame(movie* film);
+bool Movie_Seek(movie* film, int frame);
+
+int Run_Movie_Bench(char* rom_path, char* movie_path, int seek_frame);
+
+#endif
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -20,22 +22,51 @@
 #include "processing/cpu.h"
 #include "memory/mem.h"
 #include "memory/rom.h"
+#include "memory/rom_db.h"
 #include "processing/ppu.h"
 #include "devices/display.h"
 #include "devices/controller.h"
+#include "devices/sound.h"
+#include "library/library.h"
+#include "batch/batch.h"
+#include "state.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "movie.h"
+#include "netplay/netplay.h"
+#include "search/search.h"
+#include "difftest/difftest.h"
+#include "processing/apu.h"
+#include "processing/resample.h"
+#include "nsf/nsf.h"
+#include "capture/capture.h"
+#include "input/input.h"
 
 SDL_Window *window = NULL;
 SDL_Renderer *renderer = NULL;
 
 int WIDTH = (256 * 2);// + (2 * 214) + 128;
 int HEIGHT = 240 * 2;
-const int CYCLES_PER_FRAME = 29780;
 
 double cycletime = (double)60/1790000;
-float time = 0;
 bool pause = true;
 
-int cycles_per_loop = 29780;
+// the console driven by the window (the core itself holds no globals)
+nes_machine* machine = NULL;
+nes_rom* rom = NULL;
+rewind_buffer* rewind_history = NULL;
+bool rewinding = false;
+runahead* run_ahead = NULL;
+movie* film = NULL;
+netplay* net = NULL;
+sound_device* sound = NULL;
+bool audio_master = false; // frames run when the sound card needs samples, not on a timer
+capture* recorder = NULL;
+capture_format capture_as = CAPTURE_Y4M;
+bool capture_direct = false;
+input_keyboard keyboard;
+input_movie movie_feed;
+input_source input; // the keyboard, or a movie while one is going
 
 uint16_t breakpoints[] = {0xc074};
 
@@ -43,6 +74,75 @@ int main(int argc, char *argv[]) {
 
     printf("NES Emulator By Nick Lowe - VERSION %d.%d\n", NES_VERSION_MAJOR, NES_VERSION_MINOR);
 
+    // library tools, no window
+    if(argc >= 3 && strcmp(argv[1], "--scan") == 0) {
+        Init_ROM_DB(ROM_DB_PATH, ROM_DB_CACHE_PATH, false);
+        int count = Scan_Library(argv[2], argc > 3 ? argv[3] : CATALOG_PATH, 0);
+        Shut_Down_ROM_DB();
+        return count < 0 ? 1 : 0;
+    }
+    if(argc >= 2 && strcmp(argv[1], "--catalog") == 0) {
+        rom_catalog catalog;
+        if(!Load_Catalog(argc > 2 ? argv[2] : CATALOG_PATH, &catalog)) {
+            printf("No catalog, run --scan first\n");
+            return 1;
+        }
+        Print_Catalog(&catalog, true);
+        Close_Catalog(&catalog);
+        return 0;
+    }
+    if(argc >= 4 && strcmp(argv[1], "--make-romdb") == 0) {
+        return Make_ROM_DB(argv[2], argv + 3, argc - 3);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        Init_ROM_DB(ROM_DB_PATH, ROM_DB_CACHE_PATH, false);
+        int result = Run_Batch_Bench(argv[2], argc > 3 ? atoi(argv[3]) : 64, argc > 4 ? atoi(argv[4]) : 600);
+        Shut_Down_ROM_DB();
+        return result;
+    }
+    if(argc >= 3 && strcmp(argv[1], "--state-bench") == 0) {
+        return Run_State_Bench(argv[2], argc > 3 ? atoi(argv[3]) : 100000);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--hash") == 0) {
+        return Run_Hash_Log(argv[2], argc > 3 ? atoi(argv[3]) : 600);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--audio-bench") == 0) {
+        return Run_Audio_Bench(argv[2], argc > 3 ? atoi(argv[3]) : 600, argc > 4 ? argv[4] : NULL);
+    }
+    if(argc >= 2 && strcmp(argv[1], "--mixer-bench") == 0) {
+        return Run_Mixer_Bench(argc > 2 ? atol(argv[2]) : 10000000);
+    }
+    if(argc >= 2 && strcmp(argv[1], "--resample-bench") == 0) {
+        return Run_Resample_Bench(argc > 2 ? atof(argv[2]) : 60);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--nsf") == 0) {
+        return Run_NSF_Render(argv[2], argc > 3 ? atof(argv[3]) : 150, argc > 4 ? argv[4] : "wav", argc > 5 ? atoi(argv[5]) : 0);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--rewind-bench") == 0) {
+        return Run_Rewind_Bench(argv[2], argc > 3 ? atoi(argv[3]) : 3600);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--runahead-bench") == 0) {
+        return Run_Runahead_Bench(argv[2], argc > 3 ? atoi(argv[3]) : 600, argc > 4 ? atoi(argv[4]) : 2);
+    }
+    if(argc >= 4 && strcmp(argv[1], "--movie") == 0) {
+        return Run_Movie_Bench(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : -1);
+    }
+    if(argc >= 5 && strcmp(argv[1], "--search") == 0) {
+        return Run_Search(argv[2], argv[3], argv[4], argc > 5 ? atoi(argv[5]) : 30, argc > 6 ? atoi(argv[6]) : 128,
+            argc > 7 ? atoi(argv[7]) : 4, argc > 8 ? atoi(argv[8]) : 0);
+    }
+    if(argc >= 3 && strcmp(argv[1], "--difftest") == 0) {
+        return Run_Difftest(argv[2], argc > 3 ? argv[3] : "norender", argc > 4 ? atoi(argv[4]) : 600);
+    }
+    if(argc >= 2 && strcmp(argv[1], "--fuzz") == 0) {
+        return Run_Fuzz(argc > 2 ? atoi(argv[2]) : 20, argc > 3 ? argv[3] : "norender",
+            argc > 4 ? strtoull(argv[4], NULL, 10) : 1);
+    }
+    if(argc >= 6 && strcmp(argv[1], "--netplay-test") == 0) {
+        return Run_Netplay_Test(argv[2], atoi(argv[3]) - 1, atoi(argv[4]), atoi(argv[5]),
+            argc > 6 ? atoi(argv[6]) : 1800, argc > 7 ? atoi(argv[7]) : 1);
+    }
+
     atexit(Shut_Down);
     
     if(!Initialize(argc, argv)) {
@@ -70,6 +170,9 @@ int main(int argc, char *argv[]) {
             if(event.type == SDL_MOUSEMOTION) {
                 Debug_Mouse_Motion(event, HEIGHT);
             }
+            if(Keyboard_Input_Event(&keyboard, &event)) {
+                continue;
+            }
             if(event.type == SDL_KEYDOWN) {
                 if(event.key.keysym.scancode == SDL_SCANCODE_P) {
                     pause = !pause;
@@ -82,31 +185,6 @@ int main(int argc, char *argv[]) {
                     pause = false;
                 }
 
-                if(event.key.keysym.scancode == SDL_SCANCODE_K) {
-                    button_down(0);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_L) {
-                    button_down(1);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_M) {
-                    button_down(2);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_N) {
-                    button_down(3);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_W) {
-                    button_down(4);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_S) {
-                    button_down(5);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_A) {
-                    button_down(6);
-                }
-                if(event.key.keysym.scancode == SDL_SCANCODE_D) {
-                    button_down(7);
-                }
-
                 if(event.key.keysym.scancode == SDL_SCANCODE_EQUALS) {
                     debug_on = !debug_on;
                     if(debug_on)
@@ -118,39 +196,63 @@ int main(int argc, char *argv[]) {
                 if(event.key.keysym.scancode == SDL_SCANCODE_MINUS) {
                     nametable_overlay_on = !nametable_overlay_on;
                 }
-            }
-            if(event.type == SDL_KEYUP) {
 
-                if(event.key.keysym.scancode == SDL_SCANCODE_K) {
-                    button_up(0);
+                // quick save / quick load
+                if(event.key.keysym.scancode == SDL_SCANCODE_F5) {
+                    Quick_State(true);
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_L) {
-                    button_up(1);
+                if(event.key.keysym.scancode == SDL_SCANCODE_F9 && !film) {
+                    Quick_State(false);
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_M) {
-                    button_up(2);
+
+                // movie record / playback, both start from power-on
+                if(event.key.keysym.scancode == SDL_SCANCODE_F6) {
+                    Toggle_Movie(true);
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_N) {
-                    button_up(3);
+                if(event.key.keysym.scancode == SDL_SCANCODE_F7) {
+                    Toggle_Movie(false);
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_W) {
-                    button_up(4);
+
+                // video and audio capture to disk
+                if(event.key.keysym.scancode == SDL_SCANCODE_F8) {
+                    Toggle_Capture();
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_S) {
-                    button_up(5);
+
+                // run-ahead frames 0-4, and whether a second instance on another thread does it
+                if(event.key.keysym.scancode == SDL_SCANCODE_F2) {
+                    Set_Runahead(run_ahead ? (run_ahead->frames + 1) % (RUNAHEAD_MAX_FRAMES + 1) : 1,
+                        run_ahead && run_ahead->second_instance);
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_A) {
-                    button_up(6);
+                if(event.key.keysym.scancode == SDL_SCANCODE_F3) {
+                    Set_Runahead(run_ahead ? run_ahead->frames : 1, !(run_ahead && run_ahead->second_instance));
                 }
-                if(event.key.keysym.scancode == SDL_SCANCODE_D) {
-                    button_up(7);
+
+                // hold to rewind
+                if(event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
+                    rewinding = true;
+                }
+            }
+            if(event.type == SDL_KEYUP) {
+
+                if(event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
+                    rewinding = false;
                 }
             }
         }
         
         delta +=  SDL_GetTicks() - lastTick;
         lastTick = SDL_GetTicks();
-        if(delta > (1000/60)) {
+        if(audio_master && sound && !pause) {
+            if(Sound_Wants_Frame(sound)) {
+                Update(0);
+                delta = 0;
+            }
+            else {
+                // the card drains a frame's worth in about 16 ms, no need to spin for it
+                SDL_Delay(1);
+            }
+        }
+        else if(delta > (1000/60)) {
             Update(0);
             delta = 0;
         }
@@ -182,11 +284,16 @@ bool Initialize(int argc, char *argv[]) {
 
     create_grid();
 
-    if(argc == 2)
+    Init_Keyboard_Input(&keyboard);
+    input = Keyboard_Input(&keyboard);
+
+    Init_ROM_DB(ROM_DB_PATH, ROM_DB_CACHE_PATH, false);
+
+    if(argc >= 2)
     {
         char rom_path[256] = "../../ROMS/Games/";
-        strcat(rom_path, argv[1]);
-        Load_Rom(rom_path);
+        strncat(rom_path, argv[1], sizeof(rom_path) - strlen(rom_path) - 1);
+        rom = Parse_Rom(rom_path);
     }
     else
     {
@@ -197,13 +304,53 @@ bool Initialize(int argc, char *argv[]) {
         //Load_Rom("./tests/nes-test-roms-master/instr_test-v3/rom_singles/02-immediate.nes");
         
         //Load_Rom("./tests/nestest.nes");
-        Load_Rom("../../ROMS/Games/ZELDA1.nes");
+        rom = Parse_Rom("../../ROMS/Games/ZELDA1.nes");
         //Load_Rom("./tests/supermario.nes");
         //Load_Rom("./tests/DK.nes");
         //Load_Rom("./tests/nes-test-roms-master/instr_misc/rom_singles/04-dummy_reads_apu.nes");
     }
 
-    Init_CPU();
+    if(!rom) {
+        return false;
+    }
+    ROM_Description(rom);
+
+    machine = Create_Machine(rom, NULL);
+    if(!machine) {
+        return false;
+    }
+    if(rom->header.battery && !Map_Save_RAM(machine)) {
+        printf("Battery RAM will not be saved\n");
+    }
+    printf("Program Counter initialised to 0x%04x\n", machine->cpu.pc);
+
+    // <rom> --netplay <player 1|2> <local port> <remote host> <remote port> [delay]
+    if(argc >= 7 && strcmp(argv[2], "--netplay") == 0) {
+        net = Create_Netplay(machine, atoi(argv[3]) - 1, atoi(argv[4]), argv[5], atoi(argv[6]), argc > 7 ? atoi(argv[7]) : 1);
+        if(!net) {
+            return false;
+        }
+        printf("Netplay as player %d\n", net->player + 1);
+    }
+
+    // <rom> ... --audio-master --capture-indexed --capture-direct
+    for(int i = 2; i < argc; i++) {
+        if(strcmp(argv[i], "--audio-master") == 0)
+            audio_master = true;
+        if(strcmp(argv[i], "--capture-indexed") == 0)
+            capture_as = CAPTURE_INDEXED;
+        if(strcmp(argv[i], "--capture-direct") == 0)
+            capture_direct = true;
+    }
+    sound = Create_Sound(machine, APU_SAMPLE_RATE);
+    if(!sound) {
+        printf("Audio disabled\n");
+    }
+
+    rewind_history = Create_Rewind(machine, REWIND_BUDGET, REWIND_INTERVAL);
+    if(!rewind_history) {
+        printf("Rewind disabled\n");
+    }
 
     if(!Init_Debug(WIDTH, HEIGHT)) {
         return false;
@@ -220,46 +367,177 @@ void Update(float elapsed) {
     SDL_SetRenderDrawColor(renderer, 0,0,0,255);
     SDL_RenderClear(renderer);
 
-    if(next_instruction)
-        cycles_per_loop = 1;
-
-    if(!pause) {
-        for(int i = 0; i < cycles_per_loop && !pause; i+=0) {
-
-            int cpu_cycles = Update_CPU();
-            i += cpu_cycles;
-
-            int prev_scanline = scanline;
-            for(int j = 0; j < cpu_cycles*3; j++) {
-                Update_PPU();
-                if(prev_scanline > scanline) {
-                    i = cycles_per_loop;
-                    break;
-                }
-                if(scanline == 241 && dot == 0) {
-                    copy_buffer(frame_buffer);
-                    clear_frame_buffer();
-                }
+    bool ran_ahead = false;
+    uint32_t (*presented)[256] = NULL;
+
+    if(net) {
+        // the netplay session owns the machine and both pads, frames only move when both sides can
+        uint8_t pads[CONTROLLER_PORTS];
+        input_source keys = Keyboard_Input(&keyboard);
+        if(!pause && keys.poll(keys.context, machine, pads) && Netplay_Tick(net, pads[0]))
+            presented = machine->frame_buffer;
+        else
+            Netplay_Poll(net);
+    }
+    else if(rewinding && rewind_history && !film) {
+        // step back a snapshot, its frame is drawn and the machine left on the snapshot
+        if(Rewind_Show_Step(rewind_history))
+            presented = machine->frame_buffer;
+    }
+    else if(!pause) {
+        if(next_instruction) {
+            Step_Machine(machine);
+        }
+        else {
+            if(!Input_Frame(machine, &input) && film) {
+                if(film->desync_frame >= 0)
+                    printf("Movie went out of sync at frame %d\n", film->desync_frame);
+                printf("Movie finished\n");
+                Close_Movie(film);
+                film = NULL;
+                input = Keyboard_Input(&keyboard);
             }
-            if(scanline == 240 && prev_scanline != 240 && next_frame) {
+            if(run_ahead) {
+                Runahead_Begin(run_ahead);
+                ran_ahead = true;
+            }
+            else {
+                Run_Frame(machine);
+            }
+            if(next_frame) {
                 pause = true;
                 next_frame = false;
             }
         }
+
+        if(machine->cpu.breakpoint) {
+            pause = true;
+            machine->cpu.breakpoint = false;
+        }
+        if(machine->ppu.frame_complete) {
+            Flush_Save_RAM(machine);
+            if(rewind_history)
+                Rewind_Capture(rewind_history);
+
+            // a second instance is still running ahead while the above is done
+            presented = ran_ahead ? Runahead_End(run_ahead) : machine->frame_buffer;
+        }
     }
 
     if(next_instruction || pause) {
-        cycles_per_loop = CYCLES_PER_FRAME;
         pause = true;
         next_instruction = false;
     }
 
+    if(presented)
+        copy_buffer(presented);
+
+    // the frame's audio goes to the card and the capture alike
+    int16_t samples[APU_OUTPUT_SAMPLES];
+    int count = machine->audio ? Apu_Read_Samples(machine->audio, samples, APU_OUTPUT_SAMPLES) : 0;
+    if(recorder)
+        Capture_Frame(recorder, presented, samples, count);
+    if(sound)
+        Sound_Frame(sound, samples, count);
+
     Render_Frame(renderer);
     if(debug_on)
         Update_Debug(renderer);
     SDL_RenderPresent(renderer);
 }
 
+/*
+one state slot per game, <rom>.state next to the rom
+*/
+void Quick_State(bool save) {
+
+    char state_path[512];
+    if(!rom_sibling_path(rom->path, ".state", state_path, sizeof(state_path)))
+        return;
+
+    if(save) {
+        if(Save_State_File(machine, state_path))
+            printf("State saved: %s\n", state_path);
+    }
+    else {
+        if(Load_State_File(machine, state_path))
+            printf("State loaded: %s\n", state_path);
+        else
+            printf("No usable state: %s\n", state_path);
+    }
+}
+
+/*
+one movie per game, <rom>.movie next to the rom. a second press stops
+*/
+void Toggle_Movie(bool record) {
+
+    if(film) {
+        bool recording = film->mode == MOVIE_RECORDING;
+        int frames = film->frame_count;
+        if(!Close_Movie(film) && recording)
+            printf("Movie could not be written\n");
+        else
+            printf("Movie stopped, %d frames\n", frames);
+        film = NULL;
+        input = Keyboard_Input(&keyboard);
+        return;
+    }
+
+    char movie_path[512];
+    if(!rom_sibling_path(rom->path, ".movie", movie_path, sizeof(movie_path)))
+        return;
+
+    film = record ? Movie_Record(machine, movie_path) : Movie_Play(machine, movie_path);
+    if(film) {
+        movie_feed = (input_movie) {film, Keyboard_Input(&keyboard)};
+        input = Movie_Input(&movie_feed);
+        printf("Movie %s: %s\n", record ? "recording" : "playing", movie_path);
+    }
+    else
+        printf("No usable movie: %s\n", movie_path);
+}
+
+/*
+<rom>.y4m (or .nesidx) and <rom>.wav next to the rom. a second press stops
+*/
+void Toggle_Capture(void) {
+
+    if(recorder) {
+        if(!Stop_Capture(recorder))
+            printf("Capture could not be written\n");
+        recorder = NULL;
+        return;
+    }
+
+    char video_path[512], audio_path[512];
+    if(!rom_sibling_path(rom->path, capture_as == CAPTURE_Y4M ? ".y4m" : ".nesidx", video_path, sizeof(video_path))
+        || !rom_sibling_path(rom->path, ".wav", audio_path, sizeof(audio_path)))
+        return;
+
+    recorder = Start_Capture(machine, video_path, audio_path, capture_as, capture_direct);
+    if(recorder)
+        printf("Capturing: %s, %s\n", video_path, audio_path);
+    else
+        printf("Capture could not start\n");
+}
+
+/*
+0 frames turns run-ahead off
+*/
+void Set_Runahead(int frames, bool second_instance) {
+
+    Destroy_Runahead(run_ahead);
+    run_ahead = NULL;
+
+    if(frames > 0)
+        run_ahead = Create_Runahead(machine, frames, second_instance);
+    if(run_ahead)
+        printf("Run-ahead %d frames%s\n", run_ahead->frames, second_instance ? " (second instance)" : "");
+    else
+        printf("Run-ahead off\n");
+}
+
 void Shut_Down(void) {
 
     if(renderer) {
@@ -269,7 +547,23 @@ void Shut_Down(void) {
         SDL_DestroyWindow(window);
     }
     Shut_Down_Debug();
-    Shut_Down_ROM();
+    Stop_Capture(recorder);
+    recorder = NULL;
+    Destroy_Sound(sound);
+    sound = NULL;
+    Destroy_Netplay(net);
+    net = NULL;
+    Close_Movie(film);
+    film = NULL;
+    Destroy_Runahead(run_ahead);
+    run_ahead = NULL;
+    Destroy_Rewind(rewind_history);
+    rewind_history = NULL;
+    Destroy_Machine(machine);
+    machine = NULL;
+    Free_Rom(rom);
+    rom = NULL;
+    Shut_Down_ROM_DB();
 
     SDL_Quit();
 }
\ No newline at end of file
@@ -1,6 +1,16 @@
+#include <stdbool.h>
+
+#include "machine.h"
+
 extern bool pause;
+extern nes_machine* machine;
+extern nes_rom* rom;
 
 bool Initialize(int argc, char *argv[]);
 void Render();
 void Shut_Down();
-void Update(float);
\ No newline at end of file
+void Update(float);
+void Quick_State(bool save);
+void Set_Runahead(int frames, bool second_instance);
+void Toggle_Movie(bool record);
+void Toggle_Capture(void);
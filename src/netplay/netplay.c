@@ -0,0 +1,357 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "netplay.h"
+#include "../state.h"
+#include "../memory/rom.h"
+#include "../devices/controller.h"
+
+static double now(void) {
+
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static uint8_t* snapshot(netplay* net, int frame) {
+
+    return net->snapshots + (net->state_size * (frame % NETPLAY_SNAPSHOTS));
+}
+
+/*
+both sides have to agree on this frame's hash, once each has one
+*/
+static void check_hash(netplay* net, int frame) {
+
+    int slot = frame % NETPLAY_RING;
+    if(frame > net->hashed || net->remote_hash_frame[slot] != frame || net->checked_frame[slot] == frame)
+        return;
+
+    net->checked_frame[slot] = frame;
+    net->hash_checks++;
+    int section = State_Hash_Diff(&net->hashes[slot], &net->remote_hashes[slot]);
+    if(section >= 0 && net->desyncs++ == 0) {
+        net->first_desync = frame;
+        net->desync_section = section < net->hashes[slot].count ? net->hashes[slot].ids[section] : 0;
+    }
+}
+
+/*
+the start of frame f is final once the remote input of every frame
+before it is known, any misprediction has been rolled back by then
+*/
+static void hash_confirmed(netplay* net) {
+
+    while(net->hashed < net->frame && net->hashed < net->remote_confirmed + 1) {
+        int frame = net->hashed + 1;
+        if(frame == net->frame)
+            Save_State(net->nes, snapshot(net, frame), net->state_size);
+
+        Hash_State(snapshot(net, frame), net->state_size, &net->hashes[frame % NETPLAY_RING]);
+        net->hashed = frame;
+        check_hash(net, frame);
+    }
+}
+
+/*
+remote input is the real one once known, otherwise the newest known one
+is held
+*/
+static void run_frame(netplay* net, int frame, bool render) {
+
+    nes_machine* nes = net->nes;
+    Save_State(nes, snapshot(net, frame), net->state_size);
+
+    uint8_t remote = 0;
+    if(frame <= net->remote_confirmed)
+        remote = net->remote_input[frame % NETPLAY_RING];
+    else if(net->remote_confirmed >= 0)
+        remote = net->remote_input[net->remote_confirmed % NETPLAY_RING];
+    net->remote_used[frame % NETPLAY_RING] = remote;
+
+    uint8_t local = net->local_input[frame % NETPLAY_RING];
+    button_set(nes, net->player == 0 ? local : remote);
+    button_set_2(nes, net->player == 0 ? remote : local);
+
+    nes->skip_render = !render;
+    Run_Frame(nes);
+    nes->skip_render = false;
+}
+
+static void rollback(netplay* net, int frame) {
+
+    double begin = now();
+
+    // these frames were heard once already, on the guessed input
+    apu_output* audio = net->nes->audio;
+    net->nes->audio = NULL;
+    Load_State(net->nes, snapshot(net, frame), net->state_size);
+    for(int f = frame; f < net->frame; f++) {
+        run_frame(net, f, f == net->frame - 1);
+    }
+    net->nes->audio = audio;
+
+    double elapsed = now() - begin;
+    net->rollbacks++;
+    net->resimulated += net->frame - frame;
+    if(net->frame - frame > net->deepest)
+        net->deepest = net->frame - frame;
+    if(elapsed > net->slowest)
+        net->slowest = elapsed;
+}
+
+static void send_packet(netplay* net) {
+
+    netplay_packet packet = {0};
+    memcpy(packet.magic, "NESN", 4);
+    packet.crc32 = net->nes->rom->identity.crc32;
+    packet.first_frame = net->remote_acked + 1;
+    packet.ack_frame = net->remote_confirmed;
+    packet.hash_frame = net->hashed;
+    if(net->hashed >= 0)
+        packet.hash = net->hashes[net->hashed % NETPLAY_RING];
+
+    for(int f = packet.first_frame; f <= net->local_latest && packet.input_count < NETPLAY_MAX_INPUTS; f++) {
+        packet.inputs[packet.input_count++] = net->local_input[f % NETPLAY_RING];
+    }
+
+    // nobody listening yet is fine, the inputs go out again next tick
+    send(net->socket, &packet, sizeof(packet), 0);
+}
+
+/*
+returns the oldest frame that ran on a wrong guess, or net->frame
+*/
+static int receive_packets(netplay* net) {
+
+    int rollback_frame = net->frame;
+    netplay_packet packet;
+
+    while(true) {
+        ssize_t size = recv(net->socket, &packet, sizeof(packet), 0);
+        if(size < 0 && errno == ECONNREFUSED)
+            continue; // the peer is not up yet
+        if(size < 0)
+            break;
+        if(size != sizeof(packet) || memcmp(packet.magic, "NESN", 4) != 0)
+            continue;
+        if(packet.crc32 != net->nes->rom->identity.crc32 || packet.input_count > NETPLAY_MAX_INPUTS
+            || packet.hash.count < 0 || packet.hash.count > STATE_MAX_SECTIONS)
+            continue;
+
+        for(int i = 0; i < packet.input_count; i++) {
+            int frame = packet.first_frame + i;
+            if(frame <= net->remote_confirmed)
+                continue;
+            if(frame != net->remote_confirmed + 1)
+                break;
+
+            int slot = frame % NETPLAY_RING;
+            net->remote_input[slot] = packet.inputs[i];
+            net->remote_confirmed = frame;
+            if(frame < net->frame && net->remote_used[slot] != packet.inputs[i] && frame < rollback_frame)
+                rollback_frame = frame;
+        }
+
+        if(packet.ack_frame > net->remote_acked)
+            net->remote_acked = packet.ack_frame;
+
+        if(packet.hash_frame >= 0 && packet.hash_frame > net->hashed - NETPLAY_RING) {
+            int slot = packet.hash_frame % NETPLAY_RING;
+            net->remote_hashes[slot] = packet.hash;
+            net->remote_hash_frame[slot] = packet.hash_frame;
+            check_hash(net, packet.hash_frame);
+        }
+    }
+
+    return rollback_frame;
+}
+
+/*
+power cycles the machine, both sides start from the same state. battery
+RAM has to match as well, a difference shows up as a desync
+*/
+netplay* Create_Netplay(nes_machine* nes, int player, int local_port, const char* host, int remote_port, int delay) {
+
+    netplay* net = calloc(1, sizeof(netplay));
+    if(!net)
+        return NULL;
+
+    net->nes = nes;
+    net->player = player ? 1 : 0;
+    net->delay = delay < 0 ? 0 : delay > NETPLAY_WINDOW ? NETPLAY_WINDOW : delay;
+    net->state_size = State_Size(nes);
+    net->snapshots = malloc(net->state_size * NETPLAY_SNAPSHOTS);
+    net->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(!net->snapshots || net->socket < 0) {
+        Destroy_Netplay(net);
+        return NULL;
+    }
+
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(local_port);
+
+    struct sockaddr_in remote = {0};
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(remote_port);
+
+    if(inet_pton(AF_INET, host, &remote.sin_addr) != 1
+        || bind(net->socket, (struct sockaddr*)&local, sizeof(local)) != 0
+        || connect(net->socket, (struct sockaddr*)&remote, sizeof(remote)) != 0
+        || fcntl(net->socket, F_SETFL, fcntl(net->socket, F_GETFL) | O_NONBLOCK) != 0) {
+        printf("Netplay: can't use udp %d -> %s:%d\n", local_port, host, remote_port);
+        Destroy_Netplay(net);
+        return NULL;
+    }
+
+    // the first delay frames have no input on either side
+    net->local_latest = net->delay - 1;
+    net->remote_confirmed = -1;
+    net->remote_acked = -1;
+    net->hashed = -1;
+    for(int i = 0; i < NETPLAY_RING; i++) {
+        net->remote_hash_frame[i] = -1;
+        net->checked_frame[i] = -1;
+    }
+
+    Reset_Machine(nes);
+
+    return net;
+}
+
+void Destroy_Netplay(netplay* net) {
+
+    if(!net)
+        return;
+
+    if(net->socket >= 0)
+        close(net->socket);
+    free(net->snapshots);
+    free(net);
+}
+
+/*
+network side of a tick without running a new frame: take in remote
+input, roll back if a guess was wrong, hash what became final, send
+*/
+void Netplay_Poll(netplay* net) {
+
+    int frame = receive_packets(net);
+    if(frame < net->frame)
+        rollback(net, frame);
+
+    hash_confirmed(net);
+    send_packet(net);
+}
+
+/*
+one host frame. pad is this side's controller now, it is applied delay
+frames later on both machines. false when stalled waiting for the remote
+side, the machine has not moved then
+*/
+bool Netplay_Tick(netplay* net, uint8_t pad) {
+
+    int frame = receive_packets(net);
+    if(frame < net->frame)
+        rollback(net, frame);
+    hash_confirmed(net);
+
+    if(net->frame > net->remote_confirmed + NETPLAY_WINDOW) {
+        send_packet(net);
+        poll(&(struct pollfd) {net->socket, POLLIN, 0}, 1, 1);
+        return false;
+    }
+
+    net->local_latest = net->frame + net->delay;
+    net->local_input[net->local_latest % NETPLAY_RING] = pad;
+
+    run_frame(net, net->frame, true);
+    net->frame++;
+
+    hash_confirmed(net);
+    send_packet(net);
+    return true;
+}
+
+/*
+scripted pad for the loopback test, changes often enough that guesses are
+regularly wrong
+*/
+static uint8_t test_pad(int player, int frame) {
+
+    uint32_t x = (uint32_t)(frame / 6) * 2654435761u ^ (uint32_t)(player + 1) * 0x9e3779b9u;
+    x ^= x >> 15;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    return x & 0xff;
+}
+
+/*
+--netplay-test: one side of a headless match against another process on
+127.0.0.1, both should print the same final hash and no desyncs
+*/
+int Run_Netplay_Test(char* rom_path, int player, int local_port, int remote_port, int frames, int delay) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    netplay* net = nes ? Create_Netplay(nes, player, local_port, "127.0.0.1", remote_port, delay) : NULL;
+    if(!net) {
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    double begin = now();
+    double deadline = begin + 60;
+    while(net->frame < frames && now() < deadline) {
+        Netplay_Tick(net, test_pad(net->player, net->frame + net->delay));
+    }
+
+    // wait until the last frame is final here and the other side has our input
+    while((net->hashed < frames || net->remote_acked < frames - 1) && now() < deadline) {
+        Netplay_Poll(net);
+        poll(&(struct pollfd) {net->socket, POLLIN, 0}, 1, 1);
+    }
+    bool finished = net->hashed >= frames && net->remote_acked >= frames - 1;
+
+    // keep answering for a moment so the other side gets our acks too
+    double linger = now() + 0.25;
+    while(now() < linger) {
+        Netplay_Poll(net);
+        poll(&(struct pollfd) {net->socket, POLLIN, 0}, 1, 1);
+    }
+
+    printf("player %d: %d frames in %.2fs, %d rollbacks (%d frames again, deepest %d, slowest %.2f ms)\n",
+        net->player + 1, net->frame, now() - begin, net->rollbacks, net->resimulated, net->deepest, net->slowest * 1e3);
+    if(finished)
+        printf("%d hash checks, %d desyncs, final hash %016llx\n",
+            net->hash_checks, net->desyncs, (unsigned long long)net->hashes[frames % NETPLAY_RING].total);
+    else
+        printf("timed out waiting for the other side\n");
+    if(net->desyncs)
+        printf("first desync at frame %d, in %.4s\n", net->first_desync, (const char*)&net->desync_section);
+
+    bool ok = finished && net->desyncs == 0;
+
+    Destroy_Netplay(net);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return ok ? 0 : 1;
+}
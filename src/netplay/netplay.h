@@ -0,0 +1,90 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../machine.h"
+#include "../state.h"
+
+#define NETPLAY_WINDOW 8 // frames a peer may run past the last remote input it has
+#define NETPLAY_RING 128 // frames of input and hash history
+#define NETPLAY_MAX_INPUTS 32 // per packet
+#define NETPLAY_SNAPSHOTS (NETPLAY_WINDOW + 2)
+
+/*
+sent every tick. carries all of the sender's inputs the other side has
+not acknowledged yet, so a lost packet is covered by the next one
+*/
+typedef struct netplay_packet {
+
+    char magic[4]; // "NESN"
+    uint32_t crc32; // rom, peers must run the same game
+    int32_t first_frame; // frame of inputs[0]
+    int32_t input_count;
+    int32_t ack_frame; // the sender has our inputs up to here
+    int32_t hash_frame; // newest confirmed frame the sender hashed, -1 none
+    state_hash hash; // state at the start of hash_frame
+    uint8_t inputs[NETPLAY_MAX_INPUTS];
+
+} netplay_packet;
+
+/*
+two player rollback netplay over udp. each side runs ahead on its own
+input (delayed by a few frames) and a guess of the remote one, the last
+remote input it has. a snapshot is taken at the start of every frame;
+when a remote input turns out different from the guess the machine goes
+back to that frame's snapshot and the frames since are run again in one
+burst without rendering.
+
+once both inputs of a frame are known the state after it is final, its
+hash is sent along and compared by the other side, any difference is a
+desync. section hashes are sent, so the desync can be put on a part of
+the machine.
+*/
+typedef struct netplay {
+
+    nes_machine* nes;
+    int player; // 0 drives pad 1, 1 drives pad 2
+    int delay; // local input frames
+    int socket;
+
+    int frame; // next frame to run
+    int local_latest; // local input known up to here
+    int remote_confirmed; // remote input known up to here
+    int remote_acked; // the remote has our input up to here
+    int hashed; // start of frame hashes up to here are final
+
+    uint8_t local_input[NETPLAY_RING];
+    uint8_t remote_input[NETPLAY_RING];
+    uint8_t remote_used[NETPLAY_RING]; // what each simulated frame ran with
+    state_hash hashes[NETPLAY_RING];
+    state_hash remote_hashes[NETPLAY_RING];
+    int remote_hash_frame[NETPLAY_RING];
+    int checked_frame[NETPLAY_RING];
+
+    size_t state_size;
+    uint8_t* snapshots; // start of frame f at slot f % NETPLAY_SNAPSHOTS
+
+    // stats
+    int rollbacks;
+    int resimulated;
+    int deepest;
+    double slowest; // seconds, longest rollback burst
+    int hash_checks;
+    int desyncs;
+    int first_desync;
+    uint32_t desync_section; // STATE_ID of the first section that differed
+
+} netplay;
+
+netplay* Create_Netplay(nes_machine* nes, int player, int local_port, const char* host, int remote_port, int delay);
+void Destroy_Netplay(netplay* net);
+
+bool Netplay_Tick(netplay* net, uint8_t pad);
+void Netplay_Poll(netplay* net);
+
+int Run_Netplay_Test(char* rom_path, int player, int local_port, int remote_port, int frames, int delay);
+
+#endif
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "nsf.h"
+#include "../processing/cpu.h"
+
+static uint16_t read_16(const uint8_t* data) {
+
+    return data[0] | (data[1] << 8);
+}
+
+static void read_text(char* out, const uint8_t* data) {
+
+    memcpy(out, data, 32);
+    out[32] = '\0';
+}
+
+/*
+ntsc only, the pal speed and the nsf2 fields are ignored
+*/
+bool Parse_NSF(const uint8_t* data, long size, nsf_header* header) {
+
+    if(size <= NSF_HEADER_SIZE || memcmp(data, "NESM\x1a", 5) != 0)
+        return false;
+
+    memset(header, 0, sizeof(nsf_header));
+    header->version = data[0x05];
+    header->song_count = data[0x06];
+    header->first_song = data[0x07];
+    header->load = read_16(data + 0x08);
+    header->init = read_16(data + 0x0a);
+    header->play = read_16(data + 0x0c);
+    read_text(header->name, data + 0x0e);
+    read_text(header->artist, data + 0x2e);
+    read_text(header->copyright, data + 0x4e);
+    header->play_period = read_16(data + 0x6e);
+    memcpy(header->banks, data + 0x70, 8);
+    header->chips = data[0x7b];
+
+    for(int i = 0; i < 8; i++) {
+        if(header->banks[i])
+            header->banked = true;
+    }
+
+    // some rips leave the speed at 0 and mean 60 Hz
+    if(header->play_period == 0)
+        header->play_period = 16639;
+    if(header->first_song < 1 || header->first_song > header->song_count)
+        header->first_song = 1;
+
+    return header->song_count > 0 && header->load >= 0x8000;
+}
+
+/*
+the tune laid out as a rom the NSF pseudo mapper can bank: 4kb pages
+after a 16 byte header whose bytes 8-15 are the initial $5ff8-$5fff.
+banked tunes start at load & $fff of their first page, the rest are
+padded to sit at load with pages 0-7 in $8000-$ffff
+*/
+nes_rom* Load_NSF(char* path, nsf_header* header) {
+
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        printf("\nNSF file not loaded: %s\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(file_size > 0 ? file_size : 1);
+    if(!data || file_size <= 0 || fread(data, 1, file_size, file) != (size_t)file_size) {
+        printf("\nNSF file could not be read: %s\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    if(!Parse_NSF(data, file_size, header)) {
+        printf("\nNot a valid NSF file: %s\n", path);
+        free(data);
+        return NULL;
+    }
+
+    long length = file_size - NSF_HEADER_SIZE;
+    long pad = header->banked ? (header->load & 0xfff) : header->load - 0x8000;
+    int pages = (pad + length + 0xfff) / 0x1000;
+    if(!header->banked && pages < 8)
+        pages = 8;
+    if(pages > 256)
+        pages = 256;
+
+    // anonymous and zero filled, Free_Rom() unmaps it like a rom file
+    long size = HEADER_SIZE + (long)pages * 0x1000;
+    uint8_t* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(image == MAP_FAILED) {
+        free(data);
+        return NULL;
+    }
+
+    for(int i = 0; i < 8; i++)
+        image[8 + i] = header->banked ? header->banks[i] : i;
+    long copied = pad + length > (long)pages * 0x1000 ? (long)pages * 0x1000 - pad : length;
+    memcpy(image + HEADER_SIZE + pad, data + NSF_HEADER_SIZE, copied);
+    free(data);
+
+    nes_rom* rom = calloc(1, sizeof(nes_rom));
+    if(!rom) {
+        munmap(image, size);
+        return NULL;
+    }
+    rom->data = image;
+    rom->size = size;
+    rom->prg_offset = HEADER_SIZE;
+    rom->prg_length = pages;
+    rom->chr_length = 0;
+    rom->header.mapper = MAPPER_NSF;
+    rom->header.prg_size = (long)pages * 0x1000;
+    rom->header.mirroring = 2;
+    snprintf(rom->path, sizeof(rom->path), "%s", path);
+
+    return rom;
+}
+
+// -- player --
+
+/*
+jsr to a routine and run it until its rts lands on NSF_RETURN
+*/
+static bool call(nsf_player* player, uint16_t addr, uint8_t a, uint8_t x) {
+
+    nes_machine* nes = player->nes;
+
+    StackPush(nes, (NSF_RETURN - 1) >> 8);
+    StackPush(nes, (NSF_RETURN - 1) & 0xff);
+    nes->cpu.accumulator = a;
+    nes->cpu.index_x = x;
+    nes->cpu.pc = addr;
+
+    uint64_t limit = nes->cpu.cycles + NSF_CALL_LIMIT;
+    while(nes->cpu.pc != NSF_RETURN) {
+        if(nes->cpu.cycles >= limit) {
+            player->stuck = true;
+            return false;
+        }
+        nes->cpu.cycles += Update_CPU(nes);
+    }
+    return true;
+}
+
+/*
+power up, clear the apu the way the spec asks and run INIT for a track
+(0 based). interrupts stay masked, nothing here would service them. the
+track starts with the first PLAY, what INIT made is left unread
+*/
+void NSF_Start_Track(nsf_player* player, nes_machine* nes, const nsf_header* header, int track) {
+
+    memset(player, 0, sizeof(nsf_player));
+    player->nes = nes;
+    player->header = header;
+
+    Reset_Machine(nes);
+    for(uint16_t addr = 0x4000; addr <= 0x4013; addr++)
+        apu_write(nes, addr, 0);
+    apu_write(nes, 0x4015, 0x00);
+    apu_write(nes, 0x4015, 0x0f);
+    apu_write(nes, 0x4017, 0x40);
+    nes->cpu.status |= FLAG_INTERRUPT;
+
+    call(player, header->init, track, 0);
+    Apu_End_Frame(nes);
+
+    player->play_period = (uint64_t)((double)header->play_period * CPU_CLOCK / 1000000.0 * 4294967296.0);
+    player->next_play = nes->cpu.cycles << 32;
+}
+
+/*
+one PLAY, then the clock jumps to the next one and the apu catches up to
+it. the samples for the span are ready to read afterwards
+*/
+void NSF_Play_Frame(nsf_player* player) {
+
+    nes_machine* nes = player->nes;
+
+    if(!player->stuck)
+        call(player, player->header->play, nes->cpu.accumulator, nes->cpu.index_x);
+
+    player->next_play += player->play_period;
+    if(nes->cpu.cycles < player->next_play >> 32)
+        nes->cpu.cycles = player->next_play >> 32;
+
+    Apu_End_Frame(nes);
+}
+
+// -- render --
+
+/*
+<nsf path minus .nsf>-<track, 1 based>.<extension>
+*/
+static bool track_path(const char* nsf_path, int track, const char* extension, char* out, size_t size) {
+
+    size_t length = strlen(nsf_path);
+    if(length > 4 && strcasecmp(nsf_path + length - 4, ".nsf") == 0)
+        length -= 4;
+
+    int written = snprintf(out, size, "%.*s-%02d.%s", (int)length, nsf_path, track + 1, extension);
+    return written > 0 && (size_t)written < size;
+}
+
+/*
+streamed out a frame at a time, a wav gets its header again once the
+length is known
+*/
+static bool render_track(nsf_render* render, nes_machine* nes, int track) {
+
+    char path[600];
+    if(!track_path(render->rom->path, track, render->raw ? "raw" : "wav", path, sizeof(path)))
+        return false;
+
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        printf("Could not write %s\n", path);
+        return false;
+    }
+
+    // a fresh output per track, nothing of the last one rings into it
+    apu_output* out = Create_Apu_Output(APU_SAMPLE_RATE);
+    if(!out) {
+        fclose(file);
+        return false;
+    }
+    nes->audio = out;
+
+    if(!render->raw)
+        write_wav_header(file, 0, APU_SAMPLE_RATE);
+
+    nsf_player player;
+    NSF_Start_Track(&player, nes, &render->header, track);
+
+    int16_t samples[APU_OUTPUT_SAMPLES];
+    Apu_Read_Samples(out, samples, APU_OUTPUT_SAMPLES);
+
+    uint64_t end = nes->cpu.cycles + (uint64_t)(render->seconds * CPU_CLOCK);
+    long count = 0;
+    while(nes->cpu.cycles < end) {
+        NSF_Play_Frame(&player);
+        int got = Apu_Read_Samples(out, samples, APU_OUTPUT_SAMPLES);
+        fwrite(samples, sizeof(int16_t), got, file);
+        count += got;
+    }
+
+    if(!render->raw) {
+        fseek(file, 0, SEEK_SET);
+        write_wav_header(file, count, APU_SAMPLE_RATE);
+    }
+
+    nes->audio = NULL;
+    Destroy_Apu_Output(out);
+
+    bool ok = !ferror(file);
+    if(fclose(file) != 0)
+        ok = false;
+
+    atomic_fetch_add(&render->samples, count);
+    printf("  %2d  %s%s\n", track + 1, path, player.stuck ? "  (stuck, PLAY stopped there)" : "");
+    return ok;
+}
+
+/*
+tracks are handed out one at a time from an atomic counter, each worker
+plays them on a machine of its own
+*/
+static void* render_worker(void* arg) {
+
+    nsf_render* render = arg;
+
+    nes_machine* nes = Create_Machine(render->rom, NULL);
+    if(!nes) {
+        atomic_fetch_add(&render->failed, 1);
+        return NULL;
+    }
+
+    int track;
+    while((track = atomic_fetch_add(&render->next_track, 1)) < render->header.song_count) {
+        if(!render_track(render, nes, track))
+            atomic_fetch_add(&render->failed, 1);
+    }
+
+    Destroy_Machine(nes);
+    return NULL;
+}
+
+static double seconds_since(const struct timespec* begin) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - begin->tv_sec) + (now.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--nsf: every track of a tune to a wav (or raw s16le) next to it, as fast
+as the cpus allow. threads 0 = one per online cpu
+*/
+int Run_NSF_Render(char* path, double seconds, const char* format, int threads) {
+
+    nsf_render* render = calloc(1, sizeof(nsf_render));
+    if(!render)
+        return 1;
+
+    render->rom = Load_NSF(path, &render->header);
+    if(!render->rom) {
+        free(render);
+        return 1;
+    }
+    render->seconds = seconds > 0 ? seconds : 150;
+    render->raw = format && strcmp(format, "raw") == 0;
+    atomic_init(&render->next_track, 0);
+    atomic_init(&render->samples, 0);
+    atomic_init(&render->failed, 0);
+
+    nsf_header* header = &render->header;
+    printf("%s - %s (%s)\n", header->name, header->artist, header->copyright);
+    printf("%d tracks, load $%04x init $%04x play $%04x every %u us%s\n", header->song_count,
+        header->load, header->init, header->play, header->play_period, header->banked ? ", banked" : "");
+    if(header->chips)
+        printf("Expansion audio ($%02x) is not played, only the 2A03's channels\n", header->chips);
+
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > header->song_count)
+        threads = header->song_count;
+    if(threads < 1)
+        threads = 1;
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    // the caller is one of the workers
+    pthread_t* workers = calloc(threads, sizeof(pthread_t));
+    int started = 0;
+    for(int i = 1; workers && i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, render_worker, render) != 0)
+            break;
+        started++;
+    }
+    render_worker(render);
+    for(int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    double elapsed = seconds_since(&begin);
+    double audio = (double)atomic_load(&render->samples) / APU_SAMPLE_RATE;
+    printf("%.0f s of audio on %d threads in %.2f s, %.0fx realtime\n", audio, started + 1, elapsed, audio / elapsed);
+
+    int failed = atomic_load(&render->failed);
+    if(failed)
+        printf("%d tracks failed\n", failed);
+
+    free(workers);
+    Free_Rom(render->rom);
+    free(render);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef NSF_H
+#define NSF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "../machine.h"
+#include "../memory/rom.h"
+#include "../processing/apu.h"
+
+#define NSF_HEADER_SIZE 0x80
+#define NSF_RETURN 0x4100 // INIT and PLAY return here, it is never executed
+#define NSF_CALL_LIMIT CPU_CLOCK // cycles a call gets before the tune counts as stuck
+
+/*
+the parts of the 128 byte NSF header the player uses
+*/
+typedef struct nsf_header {
+
+    uint8_t version;
+    int song_count;
+    int first_song; // 1 based
+    uint16_t load;
+    uint16_t init;
+    uint16_t play;
+    char name[33];
+    char artist[33];
+    char copyright[33];
+    uint32_t play_period; // microseconds between PLAY calls, ntsc
+    uint8_t banks[8]; // initial $5ff8-$5fff
+    bool banked;
+    uint8_t chips; // expansion audio, not played
+
+} nsf_header;
+
+/*
+one track on one machine. the cpu only runs INIT and PLAY, in between it
+would spin in a loop so the clock just skips to the next PLAY with the
+apu caught up. the ppu is never stepped
+*/
+typedef struct nsf_player {
+
+    nes_machine* nes;
+    const nsf_header* header;
+    uint64_t play_period; // cpu cycles, 32.32
+    uint64_t next_play; // cpu cycle, 32.32
+    bool stuck; // a call did not come back, the rest is silence
+
+} nsf_player;
+
+/*
+--nsf: every track rendered to a file of its own by a pool of workers,
+each with its own machine on the shared image
+*/
+typedef struct nsf_render {
+
+    nes_rom* rom;
+    nsf_header header;
+    double seconds; // per track
+    bool raw; // headerless s16le instead of wav
+
+    atomic_int next_track;
+    atomic_long samples;
+    atomic_int failed;
+
+} nsf_render;
+
+bool Parse_NSF(const uint8_t* data, long size, nsf_header* header);
+nes_rom* Load_NSF(char* path, nsf_header* header);
+
+void NSF_Start_Track(nsf_player* player, nes_machine* nes, const nsf_header* header, int track);
+void NSF_Play_Frame(nsf_player* player);
+
+int Run_NSF_Render(char* path, double seconds, const char* format, int threads);
+
+#endif
@@ -1,8 +1,17 @@
 #include "apu.h"
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "../memory/mem.h"
+#include "../memory/rom.h"
+#include "cpu.h"
 
-uint8_t apu_reg[0x18];
 // register numbers:
 const int PLS1_ENVELOPE = 0x0;
 const int PLS1_SWEEP = 0x1;
@@ -14,7 +23,7 @@ const int PLS2_SWEEP = 0x5;
 const int PLS2_TIMER = 0x6;
 const int PLS2_LENGTH_COUNTER = 0x7;
 
-const int TRI_LINEAR_COUNTER =0x8; 
+const int TRI_LINEAR_COUNTER =0x8;
 const int TRI_TIMER = 0xa;
 const int TRI_LENGTH_COUNTER = 0xb;
 
@@ -30,18 +39,894 @@ const int DMC_SAMPLE_LENGTH = 0x13;
 const int APU_STATUS = 0x15;
 const int FRAME_COUNTER = 0x17;
 
-uint8_t apu_read(uint16_t addr) {
-    addr %= 0x4000;
+#define MIX_SCALE 32000 // full mixer output, in samples
+#define NEVER UINT32_MAX // timer of a channel that is not stepping
+
+static const uint8_t length_table[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t duty_table[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1}
+};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// cpu cycles
+static const uint16_t noise_periods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t dmc_periods[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// frame sequencer steps, cpu cycles after it starts over
+static const uint32_t four_step[4] = {7457, 14913, 22371, 29829};
+static const uint32_t five_step[5] = {7457, 14913, 22371, 29829, 37281};
+#define FOUR_STEP_PERIOD 29830
+#define FIVE_STEP_PERIOD 37282
+
+#define DMC_DMA_CYCLES 4 // the cpu is halted this long for each sample byte
+
+void Init_APU(nes_machine* nes) {
+
+    apu_state* apu = &nes->apu;
+    apu->noise.shift = 1;
+    apu->noise.period = noise_periods[0];
+    apu->dmc.period = dmc_periods[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->pulse[0].period = apu->pulse[1].period = 2;
+    apu->frame_next = four_step[0];
+    apu->event_next = four_step[3];
+}
+
+// -- mixer --
+
+/*
+the mixer is non-linear, but the pulses only ever show up as their sum
+and triangle, noise and dmc close enough to 3t + 2n + d that one table
+per group does it: 31 and 203 entries, made once
+*/
+static int32_t pulse_table[31];
+static int32_t tnd_table[203];
+static pthread_once_t mixer_once = PTHREAD_ONCE_INIT;
+
+// the formulas themselves, in samples
+static double pulse_formula(int pulse1, int pulse2) {
+
+    int pulse = pulse1 + pulse2;
+    return pulse ? 95.88 / (8128.0 / pulse + 100.0) * MIX_SCALE : 0;
+}
+
+static double tnd_formula(int triangle, int noise, int dmc) {
+
+    if(!triangle && !noise && !dmc)
+        return 0;
+    double sum = triangle / 8227.0 + noise / 12241.0 + dmc / 22638.0;
+    return 159.79 / (1.0 / sum + 100.0) * MIX_SCALE;
+}
+
+static void build_mixer_tables(void) {
+
+    for(int n = 0; n < 31; n++)
+        pulse_table[n] = lround(pulse_formula(n, 0));
+    for(int n = 1; n < 203; n++)
+        tnd_table[n] = lround(163.67 / (24329.0 / n + 100.0) * MIX_SCALE);
+}
+
+// -- output --
+
+static void output_delta(apu_output* out, uint64_t time, int32_t delta) {
+
+    Blip_Add_Delta(&out->blip, time - out->frame_start, delta);
+}
+
+/*
+everything before time is final, turn it into samples
+*/
+static void output_end_frame(apu_output* out, uint64_t time) {
+
+    Blip_End_Frame(&out->blip, time - out->frame_start);
+    out->frame_start = time;
+
+    out->sample_count += Blip_Read_Samples(&out->blip, out->samples + out->sample_count, APU_OUTPUT_SAMPLES - out->sample_count);
+    out->dropped += Blip_Read_Samples(&out->blip, NULL, BLIP_MAX_SAMPLES);
+}
+
+apu_output* Create_Apu_Output(int rate) {
+
+    apu_output* out = calloc(1, sizeof(apu_output));
+    if(!out)
+        return NULL;
+
+    pthread_once(&mixer_once, build_mixer_tables);
+
+    out->rate = rate;
+    Init_Blip(&out->blip, CPU_CLOCK, rate);
+    out->frame_cycles = out->blip.max_clocks;
+    return out;
+}
+
+void Destroy_Apu_Output(apu_output* out) {
+
+    free(out);
+}
+
+/*
+takes up to max samples, oldest first. returns how many
+*/
+int Apu_Read_Samples(apu_output* out, int16_t* samples, int max) {
+
+    int count = out->sample_count < max ? out->sample_count : max;
+    memcpy(samples, out->samples, sizeof(int16_t) * count);
+    memmove(out->samples, out->samples + count, sizeof(int16_t) * (out->sample_count - count));
+    out->sample_count -= count;
+    return count;
+}
+
+static void mix_pulses(nes_machine* nes, uint64_t time) {
+
+    apu_output* out = nes->audio;
+    int32_t level = pulse_table[nes->apu.pulse[0].output + nes->apu.pulse[1].output];
+    if(level != out->pulse_level) {
+        output_delta(out, time, level - out->pulse_level);
+        out->pulse_level = level;
+    }
+}
+
+static void mix_tnd(nes_machine* nes, uint64_t time) {
+
+    apu_output* out = nes->audio;
+    int32_t level = tnd_table[3 * nes->apu.triangle.output + 2 * nes->apu.noise.output + nes->apu.dmc.output];
+    if(level != out->tnd_level) {
+        output_delta(out, time, level - out->tnd_level);
+        out->tnd_level = level;
+    }
+}
+
+// -- channels --
+
+static uint8_t envelope_volume(apu_envelope* envelope) {
+
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
+
+static void clock_envelope(apu_envelope* envelope) {
+
+    if(envelope->start) {
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    }
+    else if(envelope->divider == 0) {
+        envelope->divider = envelope->volume;
+        if(envelope->decay > 0)
+            envelope->decay--;
+        else if(envelope->loop)
+            envelope->decay = 15;
+    }
+    else {
+        envelope->divider--;
+    }
+}
+
+static uint16_t sweep_target(apu_pulse* pulse, int channel) {
+
+    uint16_t change = pulse->timer_reload >> pulse->sweep_shift;
+    if(!pulse->sweep_negate)
+        return pulse->timer_reload + change;
+    // pulse 1 subtracts in ones' complement
+    return pulse->timer_reload - change - (channel == 0 ? 1 : 0);
+}
+
+static bool pulse_muted(apu_pulse* pulse, int channel) {
+
+    return pulse->timer_reload < 8 || (!pulse->sweep_negate && sweep_target(pulse, channel) > 0x7ff);
+}
+
+static void pulse_output(apu_pulse* pulse, int channel) {
+
+    bool on = pulse->length > 0 && !pulse_muted(pulse, channel) && duty_table[pulse->duty][pulse->step];
+    pulse->output = on ? envelope_volume(&pulse->envelope) : 0;
+}
+
+/*
+a pulse that stays silent whatever step it is on
+*/
+static bool pulse_silent(apu_pulse* pulse, int channel) {
+
+    return pulse->length == 0 || pulse_muted(pulse, channel) || envelope_volume(&pulse->envelope) == 0;
+}
+
+static void clock_sweep(apu_pulse* pulse, int channel) {
+
+    if(pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 && !pulse_muted(pulse, channel)) {
+        pulse->timer_reload = sweep_target(pulse, channel);
+        pulse->period = 2 * (pulse->timer_reload + 1);
+    }
+    if(pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    }
+    else {
+        pulse->sweep_divider--;
+    }
+}
+
+/*
+closed form: steps taken over a span of cycles
+*/
+static uint32_t advance_timer(uint32_t* timer, uint32_t period, uint32_t cycles) {
+
+    if(cycles < *timer) {
+        *timer -= cycles;
+        return 0;
+    }
+    cycles -= *timer;
+    *timer = period - (cycles % period);
+    return 1 + (cycles / period);
+}
+
+static bool triangle_stepping(apu_triangle* triangle) {
+
+    // periods under 2 are ultrasonic, the sequencer is held instead
+    return triangle->length > 0 && triangle->linear > 0 && triangle->timer_reload >= 2;
+}
+
+static void clock_noise(apu_noise* noise) {
+
+    uint16_t feedback = (noise->shift ^ (noise->shift >> (noise->mode ? 6 : 1))) & 1;
+    noise->shift = (noise->shift >> 1) | (feedback << 14);
+    noise->output = (noise->shift & 1) || noise->length == 0 ? 0 : envelope_volume(&noise->envelope);
+}
+
+static void dmc_fetch(nes_machine* nes) {
+
+    apu_dmc* dmc = &nes->apu.dmc;
+    if(dmc->buffer_full || dmc->bytes_remaining == 0)
+        return;
+
+    dmc->buffer = read(nes, dmc->address);
+    dmc->buffer_full = true;
+    nes->cpu.stall += DMC_DMA_CYCLES;
+    dmc->address = dmc->address == 0xffff ? 0x8000 : dmc->address + 1;
+
+    if(--dmc->bytes_remaining == 0) {
+        if(dmc->loop) {
+            dmc->address = dmc->sample_address;
+            dmc->bytes_remaining = dmc->sample_length;
+        }
+        else if(dmc->irq_enabled) {
+            dmc->irq = true;
+        }
+    }
+}
+
+static void clock_dmc(nes_machine* nes) {
+
+    apu_dmc* dmc = &nes->apu.dmc;
+
+    if(!dmc->silence) {
+        if(dmc->shift & 1) {
+            if(dmc->output <= 125)
+                dmc->output += 2;
+        }
+        else if(dmc->output >= 2) {
+            dmc->output -= 2;
+        }
+    }
+    dmc->shift >>= 1;
+
+    if(--dmc->bits == 0) {
+        dmc->bits = 8;
+        dmc->silence = !dmc->buffer_full;
+        if(dmc->buffer_full) {
+            dmc->shift = dmc->buffer;
+            dmc->buffer_full = false;
+        }
+        dmc_fetch(nes);
+    }
+}
+
+/*
+both pulses over a span, merged in time order since the mixer takes their
+sum. silent ones just have their sequencer moved on
+*/
+static void run_pulses(nes_machine* nes, uint64_t time, uint32_t cycles) {
+
+    apu_pulse* a = &nes->apu.pulse[0];
+    apu_pulse* b = &nes->apu.pulse[1];
+
+    bool a_silent = !nes->audio || pulse_silent(a, 0);
+    bool b_silent = !nes->audio || pulse_silent(b, 1);
+    if(a_silent) {
+        a->step = (a->step + advance_timer(&a->timer, a->period, cycles)) & 7;
+        pulse_output(a, 0);
+    }
+    if(b_silent) {
+        b->step = (b->step + advance_timer(&b->timer, b->period, cycles)) & 7;
+        pulse_output(b, 1);
+    }
+    if(a_silent && b_silent)
+        return;
+
+    while(true) {
+        uint32_t a_timer = a_silent ? NEVER : a->timer;
+        uint32_t b_timer = b_silent ? NEVER : b->timer;
+        uint32_t step = a_timer < b_timer ? a_timer : b_timer;
+        if(step > cycles)
+            step = cycles;
+
+        if(!a_silent)
+            a->timer -= step;
+        if(!b_silent)
+            b->timer -= step;
+        cycles -= step;
+        time += step;
+
+        if(!a_silent && a->timer == 0) {
+            a->timer = a->period;
+            a->step = (a->step + 1) & 7;
+            pulse_output(a, 0);
+        }
+        if(!b_silent && b->timer == 0) {
+            b->timer = b->period;
+            b->step = (b->step + 1) & 7;
+            pulse_output(b, 1);
+        }
+        if(cycles == 0)
+            break;
+        mix_pulses(nes, time);
+    }
+    mix_pulses(nes, time);
+}
+
+/*
+triangle, noise and dmc the same way. without audio the triangle moves in
+one go, noise and dmc still step (lfsr, sample fetches), just unmixed
+*/
+static void run_tnd(nes_machine* nes, uint64_t time, uint32_t cycles) {
+
+    apu_triangle* triangle = &nes->apu.triangle;
+    apu_noise* noise = &nes->apu.noise;
+    apu_dmc* dmc = &nes->apu.dmc;
+
+    bool triangle_on = triangle_stepping(triangle);
+    triangle->output = triangle_table[triangle->step];
+    if(!nes->audio) {
+        if(triangle_on)
+            triangle->step = (triangle->step + advance_timer(&triangle->timer, triangle->timer_reload + 1, cycles)) & 31;
+        triangle->output = triangle_table[triangle->step];
+
+        for(uint32_t n = advance_timer(&noise->timer, noise->period, cycles); n > 0; n--)
+            clock_noise(noise);
+        for(uint32_t n = advance_timer(&dmc->timer, dmc->period, cycles); n > 0; n--)
+            clock_dmc(nes);
+        return;
+    }
+
+    while(true) {
+        uint32_t triangle_timer = triangle_on ? triangle->timer : NEVER;
+        uint32_t step = triangle_timer < noise->timer ? triangle_timer : noise->timer;
+        if(dmc->timer < step)
+            step = dmc->timer;
+        if(step > cycles)
+            step = cycles;
+
+        if(triangle_on)
+            triangle->timer -= step;
+        noise->timer -= step;
+        dmc->timer -= step;
+        cycles -= step;
+        time += step;
+
+        if(triangle_on && triangle->timer == 0) {
+            triangle->timer = triangle->timer_reload + 1;
+            triangle->step = (triangle->step + 1) & 31;
+            triangle->output = triangle_table[triangle->step];
+        }
+        if(noise->timer == 0) {
+            noise->timer = noise->period;
+            clock_noise(noise);
+        }
+        if(dmc->timer == 0) {
+            dmc->timer = dmc->period;
+            clock_dmc(nes);
+        }
+        if(cycles == 0)
+            break;
+        mix_tnd(nes, time);
+    }
+    mix_tnd(nes, time);
+}
+
+/*
+channel outputs after something other than a timer changed them
+*/
+static void update_outputs(nes_machine* nes) {
+
+    apu_state* apu = &nes->apu;
+    pulse_output(&apu->pulse[0], 0);
+    pulse_output(&apu->pulse[1], 1);
+    apu->noise.output = (apu->noise.shift & 1) || apu->noise.length == 0 ? 0 : envelope_volume(&apu->noise.envelope);
+
+    if(nes->audio) {
+        mix_pulses(nes, apu->cycle);
+        mix_tnd(nes, apu->cycle);
+    }
+}
+
+static void quarter_frame(apu_state* apu) {
+
+    clock_envelope(&apu->pulse[0].envelope);
+    clock_envelope(&apu->pulse[1].envelope);
+    clock_envelope(&apu->noise.envelope);
+
+    apu_triangle* triangle = &apu->triangle;
+    if(triangle->linear_reload_flag)
+        triangle->linear = triangle->linear_reload;
+    else if(triangle->linear > 0)
+        triangle->linear--;
+    if(!triangle->control)
+        triangle->linear_reload_flag = false;
+}
+
+static void half_frame(apu_state* apu) {
+
+    for(int i = 0; i < 2; i++) {
+        apu_pulse* pulse = &apu->pulse[i];
+        if(!pulse->envelope.loop && pulse->length > 0)
+            pulse->length--;
+        clock_sweep(pulse, i);
+    }
+    if(!apu->triangle.control && apu->triangle.length > 0)
+        apu->triangle.length--;
+    if(!apu->noise.envelope.loop && apu->noise.length > 0)
+        apu->noise.length--;
+}
+
+static void frame_sequencer_step(apu_state* apu) {
+
+    int step = apu->frame_step;
+    if(apu->frame_five_step) {
+        if(step != 3)
+            quarter_frame(apu);
+        if(step == 1 || step == 4)
+            half_frame(apu);
+    }
+    else {
+        quarter_frame(apu);
+        if(step == 1 || step == 3)
+            half_frame(apu);
+        if(step == 3 && !apu->frame_irq_inhibit)
+            apu->frame_irq = true;
+    }
+
+    int steps = apu->frame_five_step ? 5 : 4;
+    if(++apu->frame_step == steps) {
+        apu->frame_step = 0;
+        apu->frame_start += apu->frame_five_step ? FIVE_STEP_PERIOD : FOUR_STEP_PERIOD;
+    }
+    const uint32_t* offsets = apu->frame_five_step ? five_step : four_step;
+    apu->frame_next = apu->frame_start + offsets[apu->frame_step];
+}
+
+/*
+catch the channels up to a cpu cycle. they run in spans cut only at frame
+sequencer steps, and at the end of the audio buffer's room
+*/
+void Apu_Run(nes_machine* nes, uint64_t until) {
 
-    if(addr == APU_STATUS)
-        return apu_reg[APU_STATUS];
+    apu_state* apu = &nes->apu;
+
+    // the machine was reset or a state loaded, the output picks up from here
+    apu_output* out = nes->audio;
+    if(out && (apu->cycle < out->frame_start || apu->cycle > out->frame_start + out->frame_cycles))
+        out->frame_start = apu->cycle;
+
+    while(apu->cycle < until) {
+        uint64_t end = until < apu->frame_next ? until : apu->frame_next;
+        if(nes->audio && end > nes->audio->frame_start + nes->audio->frame_cycles)
+            end = nes->audio->frame_start + nes->audio->frame_cycles;
+
+        run_pulses(nes, apu->cycle, end - apu->cycle);
+        run_tnd(nes, apu->cycle, end - apu->cycle);
+        apu->cycle = end;
+
+        if(end == apu->frame_next) {
+            frame_sequencer_step(apu);
+            update_outputs(nes);
+        }
+        if(nes->audio && end == nes->audio->frame_start + nes->audio->frame_cycles)
+            output_end_frame(nes->audio, end);
+    }
+}
+
+/*
+the cpu's irq line from the apu's two flags
+*/
+static void irq_line(nes_machine* nes) {
+
+    if(nes->apu.frame_irq)
+        nes->cpu.irq |= IRQ_FRAME;
+    else
+        nes->cpu.irq &= ~IRQ_FRAME;
+
+    if(nes->apu.dmc.irq)
+        nes->cpu.irq |= IRQ_DMC;
     else
+        nes->cpu.irq &= ~IRQ_DMC;
+}
+
+/*
+the next cpu cycle something in the apu concerns the cpu: the 4-step
+sequence's frame irq, or a dmc fetch, which halts the cpu and can end
+the sample with an irq. between events only writes to $4010-$4013, $4015
+and $4017 can move it, so it is worked out there and after each event
+and the cpu just compares its clock against it
+*/
+static void schedule(nes_machine* nes) {
+
+    apu_state* apu = &nes->apu;
+    uint64_t next = UINT64_MAX;
+
+    if(!apu->frame_five_step && !apu->frame_irq_inhibit) {
+        uint64_t irq = apu->frame_start + four_step[3];
+        if(irq < next)
+            next = irq;
+    }
+
+    // the byte is fetched as the shift register empties
+    apu_dmc* dmc = &apu->dmc;
+    if(dmc->bytes_remaining > 0) {
+        uint64_t fetch = apu->cycle + dmc->timer + (uint64_t)(dmc->bits - 1) * dmc->period;
+        if(fetch < next)
+            next = fetch;
+    }
+
+    apu->event_next = next;
+}
+
+/*
+called by the cpu before an instruction once its clock reaches
+event_next. the cycles dmc fetches took are left in cpu.stall
+*/
+void Apu_Event(nes_machine* nes) {
+
+    Apu_Run(nes, nes->cpu.cycles);
+    irq_line(nes);
+    schedule(nes);
+}
+
+/*
+called by Run_Frame(), the frame's samples are ready to read afterwards
+*/
+void Apu_End_Frame(nes_machine* nes) {
+
+    Apu_Run(nes, nes->cpu.cycles);
+    if(nes->audio)
+        output_end_frame(nes->audio, nes->apu.cycle);
+}
+
+uint8_t apu_read(nes_machine* nes, uint16_t addr) {
+    addr %= 0x4000;
+
+    if(addr != APU_STATUS)
         return 0;
+
+    Apu_Run(nes, nes->cpu.cycles);
+
+    apu_state* apu = &nes->apu;
+    uint8_t status = (apu->pulse[0].length > 0 ? 0x01 : 0)
+        | (apu->pulse[1].length > 0 ? 0x02 : 0)
+        | (apu->triangle.length > 0 ? 0x04 : 0)
+        | (apu->noise.length > 0 ? 0x08 : 0)
+        | (apu->dmc.bytes_remaining > 0 ? 0x10 : 0)
+        | (apu->frame_irq ? 0x40 : 0)
+        | (apu->dmc.irq ? 0x80 : 0);
+
+    apu->frame_irq = false;
+    irq_line(nes);
+    return status;
+}
+
+static void write_pulse(apu_state* apu, int channel, int reg, uint8_t data) {
+
+    apu_pulse* pulse = &apu->pulse[channel];
+
+    switch(reg) {
+        case 0:
+            pulse->duty = data >> 6;
+            pulse->envelope.loop = data & 0x20;
+            pulse->envelope.constant = data & 0x10;
+            pulse->envelope.volume = data & 0x0f;
+            break;
+        case 1:
+            pulse->sweep_enabled = data & 0x80;
+            pulse->sweep_period = (data >> 4) & 7;
+            pulse->sweep_negate = data & 0x08;
+            pulse->sweep_shift = data & 7;
+            pulse->sweep_reload = true;
+            break;
+        case 2:
+            pulse->timer_reload = (pulse->timer_reload & 0x700) | data;
+            break;
+        case 3:
+            pulse->timer_reload = (pulse->timer_reload & 0xff) | ((data & 7) << 8);
+            if(apu->enabled & (1 << channel))
+                pulse->length = length_table[data >> 3];
+            pulse->step = 0;
+            pulse->envelope.start = true;
+            break;
+    }
+    pulse->period = 2 * (pulse->timer_reload + 1);
 }
 
-void apu_write(uint16_t addr, uint8_t data) {
+void apu_write(nes_machine* nes, uint16_t addr, uint8_t data) {
 
     addr %= 0x4000;
 
-    apu_reg[addr] = data;
-}
\ No newline at end of file
+    nes->apu_reg[addr] = data;
+
+    Apu_Run(nes, nes->cpu.cycles);
+    apu_state* apu = &nes->apu;
+
+    if(addr <= PLS1_LENGTH_COUNTER) {
+        write_pulse(apu, 0, addr - PLS1_ENVELOPE, data);
+    }
+    else if(addr <= PLS2_LENGTH_COUNTER) {
+        write_pulse(apu, 1, addr - PLS2_ENVELOPE, data);
+    }
+    else if(addr == TRI_LINEAR_COUNTER) {
+        apu->triangle.control = data & 0x80;
+        apu->triangle.linear_reload = data & 0x7f;
+    }
+    else if(addr == TRI_TIMER) {
+        apu->triangle.timer_reload = (apu->triangle.timer_reload & 0x700) | data;
+    }
+    else if(addr == TRI_LENGTH_COUNTER) {
+        apu->triangle.timer_reload = (apu->triangle.timer_reload & 0xff) | ((data & 7) << 8);
+        if(apu->enabled & 0x04)
+            apu->triangle.length = length_table[data >> 3];
+        apu->triangle.linear_reload_flag = true;
+    }
+    else if(addr == NOISE_ENVELOPE) {
+        apu->noise.envelope.loop = data & 0x20;
+        apu->noise.envelope.constant = data & 0x10;
+        apu->noise.envelope.volume = data & 0x0f;
+    }
+    else if(addr == NOISE_PERIOD) {
+        apu->noise.mode = data & 0x80;
+        apu->noise.period = noise_periods[data & 0x0f];
+    }
+    else if(addr == NOISE_LENGTH_COUNTER) {
+        if(apu->enabled & 0x08)
+            apu->noise.length = length_table[data >> 3];
+        apu->noise.envelope.start = true;
+    }
+    else if(addr == DMC_FREQ) {
+        apu->dmc.irq_enabled = data & 0x80;
+        apu->dmc.loop = data & 0x40;
+        apu->dmc.period = dmc_periods[data & 0x0f];
+        if(!apu->dmc.irq_enabled)
+            apu->dmc.irq = false;
+    }
+    else if(addr == DMC_COUNTER) {
+        apu->dmc.output = data & 0x7f;
+    }
+    else if(addr == DMC_SAMPLE_ADDR) {
+        apu->dmc.sample_address = 0xc000 + (data * 64);
+    }
+    else if(addr == DMC_SAMPLE_LENGTH) {
+        apu->dmc.sample_length = (data * 16) + 1;
+    }
+    else if(addr == APU_STATUS) {
+        apu->enabled = data & 0x1f;
+        if(!(data & 0x01))
+            apu->pulse[0].length = 0;
+        if(!(data & 0x02))
+            apu->pulse[1].length = 0;
+        if(!(data & 0x04))
+            apu->triangle.length = 0;
+        if(!(data & 0x08))
+            apu->noise.length = 0;
+
+        if(!(data & 0x10)) {
+            apu->dmc.bytes_remaining = 0;
+        }
+        else if(apu->dmc.bytes_remaining == 0) {
+            apu->dmc.address = apu->dmc.sample_address;
+            apu->dmc.bytes_remaining = apu->dmc.sample_length;
+            dmc_fetch(nes);
+        }
+        apu->dmc.irq = false;
+    }
+    else if(addr == FRAME_COUNTER) {
+        apu->frame_five_step = data & 0x80;
+        apu->frame_irq_inhibit = data & 0x40;
+        if(apu->frame_irq_inhibit)
+            apu->frame_irq = false;
+
+        apu->frame_step = 0;
+        apu->frame_start = apu->cycle;
+        apu->frame_next = apu->cycle + four_step[0];
+        if(apu->frame_five_step) {
+            quarter_frame(apu);
+            half_frame(apu);
+        }
+    }
+
+    if((addr >= DMC_FREQ && addr <= DMC_SAMPLE_LENGTH) || addr == APU_STATUS || addr == FRAME_COUNTER) {
+        irq_line(nes);
+        schedule(nes);
+    }
+
+    update_outputs(nes);
+}
+
+/*
+16 bit mono, WAV_HEADER_SIZE bytes. written again once the count is
+known when streaming
+*/
+void make_wav_header(uint32_t header[11], long count, int rate) {
+
+    uint32_t data_size = count * sizeof(int16_t);
+    uint32_t fields[11] = {
+        0x46464952, 36 + data_size, 0x45564157, // "RIFF" size "WAVE"
+        0x20746d66, 16, 1 | (1 << 16), rate, rate * 2, 2 | (16 << 16), // "fmt " pcm mono 16 bit
+        0x61746164, data_size // "data"
+    };
+    memcpy(header, fields, sizeof(fields));
+}
+
+void write_wav_header(FILE* file, long count, int rate) {
+
+    uint32_t header[11];
+    make_wav_header(header, count, rate);
+    fwrite(header, sizeof(header), 1, file);
+}
+
+static void write_wav(FILE* file, const int16_t* samples, int count, int rate) {
+
+    write_wav_header(file, count, rate);
+    fwrite(samples, sizeof(int16_t), count, file);
+}
+
+static double run_frames(nes_machine* nes, int frames, int16_t* samples, int* count) {
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for(int f = 0; f < frames; f++) {
+        Run_Frame(nes);
+        if(nes->audio)
+            *count += Apu_Read_Samples(nes->audio, samples + *count, APU_OUTPUT_SAMPLES);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+/*
+--audio-bench: frame time with and without making samples, and the
+samples as a wav if asked for
+*/
+int Run_Audio_Bench(char* rom_path, int frames, char* wav_path) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    apu_output* out = Create_Apu_Output(APU_SAMPLE_RATE);
+    int16_t* samples = malloc(sizeof(int16_t) * ((size_t)frames + 1) * BLIP_MAX_SAMPLES);
+    if(!nes || !out || !samples) {
+        free(samples);
+        Destroy_Apu_Output(out);
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    int count = 0;
+    double silent = run_frames(nes, frames, samples, &count);
+
+    nes->audio = out;
+    Reset_Machine(nes);
+    double audible = run_frames(nes, frames, samples, &count);
+
+    printf("%d frames: %.3f ms/frame without audio, %.3f ms/frame with, %+.1f%%\n",
+        frames, silent * 1e3 / frames, audible * 1e3 / frames, (audible / silent - 1) * 100);
+    printf("%d samples at %d Hz, %ld dropped\n", count, out->rate, out->dropped);
+
+    bool ok = true;
+    if(wav_path) {
+        FILE* file = fopen(wav_path, "wb");
+        ok = file != NULL;
+        if(file) {
+            write_wav(file, samples, count, out->rate);
+            ok = fclose(file) == 0;
+        }
+    }
+
+    free(samples);
+    nes->audio = NULL;
+    Destroy_Apu_Output(out);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return ok ? 0 : 1;
+}
+
+/*
+--mixer-bench: the tables against working the formulas out every time,
+over random channel outputs, and how far apart the two land
+*/
+int Run_Mixer_Bench(long count) {
+
+    pthread_once(&mixer_once, build_mixer_tables);
+
+    // pulse 1, pulse 2, triangle, noise, dmc
+    enum { INPUTS = 4096 };
+    static uint8_t inputs[INPUTS][5];
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for(int i = 0; i < INPUTS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        inputs[i][0] = seed & 15;
+        inputs[i][1] = (seed >> 4) & 15;
+        inputs[i][2] = (seed >> 8) & 15;
+        inputs[i][3] = (seed >> 12) & 15;
+        inputs[i][4] = (seed >> 16) & 127;
+    }
+
+    double worst = 0;
+    for(int t = 0; t < 16; t++) {
+        for(int n = 0; n < 16; n++) {
+            for(int d = 0; d < 128; d++) {
+                double error = fabs(tnd_table[3 * t + 2 * n + d] - tnd_formula(t, n, d));
+                if(error > worst)
+                    worst = error;
+            }
+        }
+    }
+
+    struct timespec begin, end;
+    volatile int64_t sink;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    int64_t total = 0;
+    for(long i = 0; i < count; i++) {
+        const uint8_t* in = inputs[i & (INPUTS - 1)];
+        total += pulse_table[in[0] + in[1]] + tnd_table[3 * in[2] + 2 * in[3] + in[4]];
+    }
+    sink = total;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double table_time = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    total = 0;
+    for(long i = 0; i < count; i++) {
+        const uint8_t* in = inputs[i & (INPUTS - 1)];
+        total += (int32_t)pulse_formula(in[0], in[1]) + (int32_t)tnd_formula(in[2], in[3], in[4]);
+    }
+    sink = total;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double formula_time = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    (void)sink;
+
+    printf("%ld mixes: tables %.2f ns, formulas %.2f ns, %.1fx\n",
+        count, table_time * 1e9 / count, formula_time * 1e9 / count, formula_time / table_time);
+    printf("tnd table off the formula by %.0f at most, %.2f%% of full scale\n", worst, worst * 100 / MIX_SCALE);
+    return 0;
+}
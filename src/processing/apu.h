@@ -1,7 +1,54 @@
+#ifndef APU_H
+#define APU_H
+
 #include <stdint.h>
 #include <stdio.h>
 
-extern uint8_t apu_reg[0x18];
+#include "../machine.h"
+#include "blip.h"
+
+#define CPU_CLOCK 1789773 // ntsc, Hz
+#define APU_SAMPLE_RATE 48000
+#define APU_OUTPUT_SAMPLES 8192 // made but not read yet
+#define WAV_HEADER_SIZE 44
+
+/*
+where a machine's audio goes. the channels post changes of the mixer
+output, per channel group, as deltas at the cpu cycle they happen and
+the blip buffer turns them into band-limited samples once a frame
+*/
+typedef struct apu_output {
+
+    int rate;
+    uint64_t frame_start; // cpu cycle of blip clock 0
+    uint64_t frame_cycles; // longest frame the blip buffer has room for
+    blip_buffer blip;
+
+    int32_t pulse_level; // mixer output last posted, per channel group
+    int32_t tnd_level;
+
+    int16_t samples[APU_OUTPUT_SAMPLES];
+    int sample_count;
+    long dropped; // samples lost because nobody read them
+
+} apu_output;
+
+void Init_APU(nes_machine* nes);
+void Apu_Run(nes_machine* nes, uint64_t until);
+void Apu_End_Frame(nes_machine* nes);
+void Apu_Event(nes_machine* nes);
+
+uint8_t apu_read(nes_machine* nes, uint16_t addr);
+void apu_write(nes_machine* nes, uint16_t addr, uint8_t data);
+
+apu_output* Create_Apu_Output(int rate);
+void Destroy_Apu_Output(apu_output* out);
+int Apu_Read_Samples(apu_output* out, int16_t* samples, int max);
+
+void make_wav_header(uint32_t header[11], long count, int rate);
+void write_wav_header(FILE* file, long count, int rate);
+
+int Run_Audio_Bench(char* rom_path, int frames, char* wav_path);
+int Run_Mixer_Bench(long count);
 
-uint8_t apu_read(uint16_t addr);
-void apu_write(uint16_t addr, uint8_t data);
\ No newline at end of file
+#endif
@@ -0,0 +1,160 @@
+#include "blip.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define BLIP_UNIT_BITS 15 // a kernel adds up to 1 << BLIP_UNIT_BITS
+#define BLIP_CUTOFF 0.45 // of the sample rate, -3 dB near 20 kHz at 48 kHz
+#define BLIP_BASS_SHIFT 13 // integrator leak, keeps the output around zero
+#define BLIP_INTERP_BITS 15 // between two kernel phases
+
+/*
+kernel[p] holds the taps of a step BLIP_WIDTH / 2 - 1 + p / BLIP_PHASES
+samples into the span, interleaved with those of phase p + 1 so one
+multiply-add of a pair gives the kernel for any point in between
+*/
+static int16_t kernel[BLIP_PHASES][BLIP_WIDTH][2];
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/*
+blackman windowed sinc, each phase rounded so its taps add up to exactly
+one, otherwise every step would leave a little dc behind
+*/
+static void build_phase(int16_t* taps, int phase) {
+
+    double raw[BLIP_WIDTH];
+    double total = 0;
+    for(int j = 0; j < BLIP_WIDTH; j++) {
+        double t = j - (BLIP_WIDTH / 2 - 1) - (double)phase / BLIP_PHASES;
+        double x = M_PI * t / (BLIP_WIDTH / 2);
+        double window = 0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);
+        double sinc = t == 0 ? 1 : sin(2 * M_PI * BLIP_CUTOFF * t) / (2 * M_PI * BLIP_CUTOFF * t);
+        raw[j] = sinc * window;
+        total += raw[j];
+    }
+
+    int sum = 0;
+    int peak = 0;
+    for(int j = 0; j < BLIP_WIDTH; j++) {
+        taps[j] = (int16_t)lround(raw[j] / total * (1 << BLIP_UNIT_BITS));
+        sum += taps[j];
+        if(taps[j] > taps[peak])
+            peak = j;
+    }
+    taps[peak] += (1 << BLIP_UNIT_BITS) - sum;
+}
+
+static void build_kernel(void) {
+
+    int16_t phases[BLIP_PHASES + 1][BLIP_WIDTH];
+    for(int p = 0; p <= BLIP_PHASES; p++)
+        build_phase(phases[p], p);
+
+    for(int p = 0; p < BLIP_PHASES; p++) {
+        for(int j = 0; j < BLIP_WIDTH; j++) {
+            kernel[p][j][0] = phases[p][j];
+            kernel[p][j][1] = phases[p + 1][j];
+        }
+    }
+}
+
+void Init_Blip(blip_buffer* blip, uint32_t clock_rate, uint32_t sample_rate) {
+
+    pthread_once(&kernel_once, build_kernel);
+
+    Blip_Set_Rates(blip, clock_rate, sample_rate);
+    Blip_Clear(blip);
+}
+
+/*
+for stretching the output a little, only between frames
+*/
+void Blip_Set_Rates(blip_buffer* blip, double clock_rate, double sample_rate) {
+
+    blip->factor = (uint64_t)(sample_rate / clock_rate * 4294967296.0);
+    blip->max_clocks = ((uint64_t)BLIP_MAX_SAMPLES << 32) / blip->factor - 1;
+}
+
+void Blip_Clear(blip_buffer* blip) {
+
+    blip->offset = 0;
+    blip->avail = 0;
+    blip->integrator = 0;
+    memset(blip->buffer, 0, sizeof(blip->buffer));
+}
+
+/*
+the step lands between two samples, the fraction picks a kernel phase and
+how far towards the next one to go
+*/
+void Blip_Add_Delta(blip_buffer* blip, uint32_t clock, int32_t delta) {
+
+    uint64_t position = blip->offset + clock * blip->factor;
+    int32_t* out = blip->buffer + (position >> 32);
+    int phase = (position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+    int32_t interp = (position >> (32 - BLIP_PHASE_BITS - BLIP_INTERP_BITS)) & ((1 << BLIP_INTERP_BITS) - 1);
+
+    int32_t next = (delta * interp) >> BLIP_INTERP_BITS;
+    int32_t here = delta - next;
+
+#ifdef __SSE2__
+    __m128i pair = _mm_set1_epi32((int32_t)((uint32_t)(uint16_t)here | ((uint32_t)(uint16_t)next << 16)));
+    const __m128i* taps = (const __m128i*)kernel[phase];
+    for(int j = 0; j < BLIP_WIDTH; j += 4, taps++) {
+        __m128i sum = _mm_loadu_si128((__m128i*)(out + j));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_loadu_si128(taps), pair));
+        _mm_storeu_si128((__m128i*)(out + j), sum);
+    }
+#else
+    for(int j = 0; j < BLIP_WIDTH; j++)
+        out[j] += kernel[phase][j][0] * here + kernel[phase][j][1] * next;
+#endif
+}
+
+/*
+nothing can land before clock `clocks` any more, the samples up to there
+are done. returns how many are ready to read
+*/
+int Blip_End_Frame(blip_buffer* blip, uint32_t clocks) {
+
+    blip->offset += clocks * blip->factor;
+    blip->avail = blip->offset >> 32;
+    return blip->avail;
+}
+
+/*
+integrates up to max finished samples into samples, or throws them away
+if samples is NULL. returns how many
+*/
+int Blip_Read_Samples(blip_buffer* blip, int16_t* samples, int max) {
+
+    int count = blip->avail < max ? blip->avail : max;
+    int32_t sum = blip->integrator;
+
+    for(int i = 0; i < count; i++) {
+        sum += blip->buffer[i];
+        int32_t sample = sum >> BLIP_UNIT_BITS;
+        sum -= sum >> BLIP_BASS_SHIFT;
+
+        if(sample > 32767)
+            sample = 32767;
+        if(sample < -32768)
+            sample = -32768;
+        if(samples)
+            samples[i] = sample;
+    }
+    blip->integrator = sum;
+
+    // what is left, finished or not, moves to the front
+    int left = blip->avail - count + BLIP_WIDTH;
+    memmove(blip->buffer, blip->buffer + count, sizeof(int32_t) * left);
+    memset(blip->buffer + left, 0, sizeof(int32_t) * count);
+    blip->avail -= count;
+    blip->offset -= (uint64_t)count << 32;
+    return count;
+}
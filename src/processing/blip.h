@@ -0,0 +1,42 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stdint.h>
+
+#define BLIP_WIDTH 16 // samples one step is spread over
+#define BLIP_PHASE_BITS 5 // kernels per sample, interpolated in between
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_MAX_SAMPLES 2048 // one frame's worth at most
+
+/*
+band-limited step synthesis, after blip_buf. a change of the input level
+is posted as a delta at the clock it happens, and instead of a hard step
+a windowed sinc kernel is added to the differences around it. reading
+integrates the differences into samples. the cost is per delta, not per
+clock, and there is nothing above half the sample rate left to alias.
+
+deltas must fit in 16 bits. time is in clocks since the end of the last
+frame, a frame can be up to max_clocks long and all of its samples have
+to be read before the next one ends.
+*/
+typedef struct blip_buffer {
+
+    uint64_t factor; // samples per clock, 32.32
+    uint64_t offset; // where clock 0 of this frame is, 32.32 samples from buffer[0]
+    uint32_t max_clocks;
+    int avail; // finished samples at the start of buffer
+    int32_t integrator;
+
+    int32_t buffer[BLIP_MAX_SAMPLES + BLIP_WIDTH];
+
+} blip_buffer;
+
+void Init_Blip(blip_buffer* blip, uint32_t clock_rate, uint32_t sample_rate);
+void Blip_Set_Rates(blip_buffer* blip, double clock_rate, double sample_rate);
+void Blip_Clear(blip_buffer* blip);
+
+void Blip_Add_Delta(blip_buffer* blip, uint32_t clock, int32_t delta);
+int Blip_End_Frame(blip_buffer* blip, uint32_t clocks);
+int Blip_Read_Samples(blip_buffer* blip, int16_t* samples, int max);
+
+#endif
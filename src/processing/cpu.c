@@ -1,75 +1,116 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
 
-#include "../nes.h"
 #include "cpu.h"
 #include "../memory/mem.h"
 #include "ppu.h"
+#include "apu.h"
 
-// registers
-uint16_t pc = 0;
-uint8_t sp = 0xfd;
-uint8_t status = 0b100;
+/*
+opcode_table is a list, so it is expanded once into a table indexed by
+opcode. read-only afterwards and shared by every machine in the process.
+unknown opcodes decode as opcode_table[0], as the old linear search did.
+*/
+static opcode decode_table[256];
+static pthread_once_t decode_table_once = PTHREAD_ONCE_INIT;
 
-uint8_t accumulator = 0;
-uint8_t index_x = 0;
-uint8_t index_y = 0;
+static void build_decode_table(void) {
 
-void Init_CPU() {
+    bool found[256] = {false};
 
-    pc = read(0xfffc);
-    pc += (read(0xfffd) << 8);
+    for(int i = 0; i < 256; i++) {
+        uint8_t op = opcode_table[i].OPCODE;
+        if(!found[op]) {
+            decode_table[op] = opcode_table[i];
+            found[op] = true;
+        }
+    }
+    for(int op = 0; op < 256; op++) {
+        if(!found[op])
+            decode_table[op] = opcode_table[0];
+    }
+}
 
-    printf("Program Counter initialised to 0x%04x\n", pc);
+void Init_CPU(nes_machine* nes) {
+
+    pthread_once(&decode_table_once, build_decode_table);
+
+    nes->cpu.pc = read(nes, 0xfffc);
+    nes->cpu.pc += (read(nes, 0xfffd) << 8);
 }
 
-int Update_CPU() {
+int Update_CPU(nes_machine* nes) {
+
+    int interrupt_cycles = 0;
+
+    // frame irqs and dmc fetches come due on a schedule, not by polling the apu
+    if(nes->cpu.cycles >= nes->apu.event_next)
+        Apu_Event(nes);
+
+    // dma halts the cpu between instructions
+    if(nes->cpu.stall) {
+        interrupt_cycles = nes->cpu.stall + (nes->cpu.stall_align ? (nes->cpu.cycles & 1) : 0);
+        nes->cpu.stall = 0;
+        nes->cpu.stall_align = false;
+    }
 
-    if(NMI) {
+    if(nes->cpu.nmi) {
 
-        status |= 0b00010000;
-        StackPush(status);
-        StackPush(pc >> 8);
-        StackPush(pc);
+        Interrupt(nes, 0xfffa);
+        nes->cpu.nmi = 0;
+        interrupt_cycles += 7;
+    }
+    else if(nes->cpu.irq && !(nes->cpu.status & FLAG_INTERRUPT)) {
 
-        pc = read(0xfffa);
-        pc += (read(0xfffb) << 8);
-        NMI = 0;
+        // level triggered, stays asserted until the source is acknowledged
+        Interrupt(nes, 0xfffe);
+        interrupt_cycles += 7;
     }
 
-    uint8_t opcode = FetchInstruction();
+    uint8_t opcode = FetchInstruction(nes);
     struct opcode op = OpcodeLookup(opcode);
-    if((pc & 0xfff0) == 0xfff0)
-        pause = true;
-    return ExecuteInstruction(op);
+    if((nes->cpu.pc & 0xfff0) == 0xfff0)
+        nes->cpu.breakpoint = true;
+    return ExecuteInstruction(nes, op) + interrupt_cycles;
+}
+
+/*
+hardware interrupt (NMI/IRQ): push pc and status with the break flag
+clear, then jump through the vector with further IRQs masked
+*/
+void Interrupt(nes_machine* nes, uint16_t vector) {
+
+    StackPush(nes, nes->cpu.pc >> 8);
+    StackPush(nes, nes->cpu.pc);
+    StackPush(nes, (nes->cpu.status | FLAG_5) & ~FLAG_BREAK);
+    nes->cpu.status |= FLAG_INTERRUPT;
+
+    nes->cpu.pc = read(nes, vector);
+    nes->cpu.pc += (read(nes, vector + 1) << 8);
 }
 
-uint8_t FetchInstruction() {
+uint8_t FetchInstruction(nes_machine* nes) {
 
-    uint8_t opcode = read(pc);
-    pc ++;
+    uint8_t opcode = read(nes, nes->cpu.pc);
+    nes->cpu.pc ++;
     return opcode;
 }
 
 opcode OpcodeLookup(uint8_t opcode) {
 
-    for(int i = 0; i < 256; i++) {
-        if (opcode_table[i].OPCODE == opcode) {
-            return opcode_table[i];
-        }
-    }
-    return opcode_table[0];
+    return decode_table[opcode];
 }
 
-int ExecuteInstruction(opcode opcode) {
+int ExecuteInstruction(nes_machine* nes, opcode opcode) {
  
     int cycles = opcode.cycles;
     int page_cross = 0;
 
     enum INSTRUCTION instruction = opcode.INSTRUCTION;
     enum ADDRESS_MODE mode = opcode.MODE;
-    uint16_t addr = GetAddress(mode, &page_cross);
+    uint16_t addr = GetAddress(nes, mode, &page_cross);
 
 //    FILE* file_ptr = fopen("log.txt", "a");
 /*
@@ -93,181 +134,181 @@ int ExecuteInstruction(opcode opcode) {
     switch (instruction) {
 
         case ADC:
-            cycles += adc6502(mode, addr);
+            cycles += adc6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case AND:
-            cycles += and6502(mode, addr);
+            cycles += and6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case ASL:
-            cycles += asl6502(mode, addr);
+            cycles += asl6502(nes, mode, addr);
             break;
         case BCC:
-            cycles += bcc6502(mode, addr);
+            cycles += bcc6502(nes, mode, addr);
             break;
         case BCS:
-            cycles += bcs6502(mode, addr);
+            cycles += bcs6502(nes, mode, addr);
             break;
         case BEQ:
-            cycles += beq6502(mode, addr);
+            cycles += beq6502(nes, mode, addr);
             break;
         case BIT:
-            cycles += bit6502(mode, addr);
+            cycles += bit6502(nes, mode, addr);
             break;
         case BMI:
-            cycles += bmi6502(mode, addr);
+            cycles += bmi6502(nes, mode, addr);
             break;
         case BNE:
-            cycles += bne6502(mode, addr);
+            cycles += bne6502(nes, mode, addr);
             break;
         case BPL:
-            cycles += bpl6502(mode, addr);
+            cycles += bpl6502(nes, mode, addr);
             break;
         case BRK:
-            cycles += brk6502(mode, addr);
+            cycles += brk6502(nes, mode, addr);
             break;
         case BVC:
-            cycles += bvc6502(mode, addr);
+            cycles += bvc6502(nes, mode, addr);
             break;
         case BVS:
-            cycles += bvs6502(mode, addr);
+            cycles += bvs6502(nes, mode, addr);
             break;
         case CLC:
-            cycles += clc6502(mode, addr);
+            cycles += clc6502(nes, mode, addr);
             break;
         case CLD:
-            cycles += cld6502(mode, addr);
+            cycles += cld6502(nes, mode, addr);
             break;
         case CLI:
-            cycles += cli6502(mode, addr);
+            cycles += cli6502(nes, mode, addr);
             break;
         case CLV:
-            cycles += clv6502(mode, addr);
+            cycles += clv6502(nes, mode, addr);
             break;
         case CMP:
-            cycles += cmp6502(mode, addr);
+            cycles += cmp6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case CPX:
-            cycles += cpx6502(mode, addr);
+            cycles += cpx6502(nes, mode, addr);
             break;
         case CPY:
-            cycles += cpy6502(mode, addr);
+            cycles += cpy6502(nes, mode, addr);
             break;
         case DEC:
-            cycles += dec6502(mode, addr);
+            cycles += dec6502(nes, mode, addr);
             break;
         case DEX:
-            cycles += dex6502(mode, addr);
+            cycles += dex6502(nes, mode, addr);
             break;
         case DEY:
-            cycles += dey6502(mode, addr);
+            cycles += dey6502(nes, mode, addr);
             break;
         case EOR:
-            cycles += eor6502(mode, addr);
+            cycles += eor6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case INC:
-            cycles += inc6502(mode, addr);
+            cycles += inc6502(nes, mode, addr);
             break;
         case INX:
-            cycles += inx6502(mode, addr);
+            cycles += inx6502(nes, mode, addr);
             break;
         case INY:
-            cycles += iny6502(mode, addr);
+            cycles += iny6502(nes, mode, addr);
             break;
         case JMP:
-            cycles += jmp6502(mode, addr);
+            cycles += jmp6502(nes, mode, addr);
             break;
         case JSR:
-            cycles += jsr6502(mode, addr);
+            cycles += jsr6502(nes, mode, addr);
             break;
         case LDA:
-            cycles += lda6502(mode, addr);
+            cycles += lda6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case LDX:
-            cycles += ldx6502(mode, addr);
+            cycles += ldx6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case LDY:
-            cycles += ldy6502(mode, addr);
+            cycles += ldy6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case LSR:
-            cycles += lsr6502(mode, addr);
+            cycles += lsr6502(nes, mode, addr);
             break;
         case NOP:
-            cycles += nop6502(mode, addr);
+            cycles += nop6502(nes, mode, addr);
             break;
         case ORA:
-            cycles += ora6502(mode, addr);
+            cycles += ora6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case PHA:
-            cycles += pha6502(mode, addr);
+            cycles += pha6502(nes, mode, addr);
             break;
         case PHP:
-            cycles += php6502(mode, addr);
+            cycles += php6502(nes, mode, addr);
             break;
         case PLA:
-            cycles += pla6502(mode, addr);
+            cycles += pla6502(nes, mode, addr);
             break;
         case PLP:
-            cycles += plp6502(mode, addr);
+            cycles += plp6502(nes, mode, addr);
             break;
         case ROL:
-            cycles += rol6502(mode, addr);
+            cycles += rol6502(nes, mode, addr);
             break;
         case ROR:
-            cycles += ror6502(mode, addr);
+            cycles += ror6502(nes, mode, addr);
             break;
         case RTI:
-            cycles += rti6502(mode, addr);
+            cycles += rti6502(nes, mode, addr);
             break;
         case RTS:
-            cycles += rts6502(mode, addr);
+            cycles += rts6502(nes, mode, addr);
             break;
         case SBC:
-            cycles += sbc6502(mode, addr);
+            cycles += sbc6502(nes, mode, addr);
             cycles += page_cross;
             break;
         case SEC:
-            cycles += sec6502(mode, addr);
+            cycles += sec6502(nes, mode, addr);
             break;
         case SED:
-            cycles += sed6502(mode, addr);
+            cycles += sed6502(nes, mode, addr);
             break;
         case SEI:
-            cycles += sei6502(mode, addr);
+            cycles += sei6502(nes, mode, addr);
             break;
         case STA:
-            cycles += sta6502(mode, addr);
+            cycles += sta6502(nes, mode, addr);
             break;
         case STX:
-            cycles += stx6502(mode, addr);
+            cycles += stx6502(nes, mode, addr);
             break;
         case STY:
-            cycles += sty6502(mode, addr);
+            cycles += sty6502(nes, mode, addr);
             break;
         case TAX:
-            cycles += tax6502(mode, addr);
+            cycles += tax6502(nes, mode, addr);
             break;
         case TAY:
-            cycles += tay6502(mode, addr);
+            cycles += tay6502(nes, mode, addr);
             break;
         case TSX:
-            cycles += tsx6502(mode, addr);
+            cycles += tsx6502(nes, mode, addr);
             break;
         case TXA:
-            cycles += txa6502(mode, addr);
+            cycles += txa6502(nes, mode, addr);
             break;
         case TXS:
-            cycles += txs6502(mode, addr);
+            cycles += txs6502(nes, mode, addr);
             break;
         case TYA:
-            cycles += tya6502(mode, addr);
+            cycles += tya6502(nes, mode, addr);
             break;
     }
 
@@ -276,7 +317,7 @@ int ExecuteInstruction(opcode opcode) {
 
 // address modes
 
-uint16_t GetAddress(enum ADDRESS_MODE mode, int* page_cross) {
+uint16_t GetAddress(nes_machine* nes, enum ADDRESS_MODE mode, int* page_cross) {
     
     uint16_t addr = 0x0000;
     uint16_t ptr = 0x0000;
@@ -290,92 +331,92 @@ uint16_t GetAddress(enum ADDRESS_MODE mode, int* page_cross) {
             break;
 
         case IMMEDIATE:
-            addr = read(pc);
-            pc ++;
+            addr = read(nes, nes->cpu.pc);
+            nes->cpu.pc ++;
             break;
 
         case ZERO_PAGE:
-            addr = read(pc);
+            addr = read(nes, nes->cpu.pc);
             addr &= 0x00ff;
-            pc ++;
+            nes->cpu.pc ++;
             break;
 
         case ZERO_PAGE_X:
-            addr = read(pc) + index_x;
+            addr = read(nes, nes->cpu.pc) + nes->cpu.index_x;
             addr &= 0xff;
-            pc ++;
+            nes->cpu.pc ++;
             break;
 
         case ZERO_PAGE_Y:
-            addr = read(pc) + index_y;
+            addr = read(nes, nes->cpu.pc) + nes->cpu.index_y;
             addr &= 0xff;
-            pc ++;
+            nes->cpu.pc ++;
             break;
 
         case ABSOLUTE:
-            addr = read(pc);
-            pc ++;
-            addr += (read(pc) << 8);
-            pc ++;
+            addr = read(nes, nes->cpu.pc);
+            nes->cpu.pc ++;
+            addr += (read(nes, nes->cpu.pc) << 8);
+            nes->cpu.pc ++;
             break;
 
         case ABSOLUTE_X:
-            addr = read(pc);
-            pc ++;
-            addr += (read(pc) << 8);
-            pc ++;
+            addr = read(nes, nes->cpu.pc);
+            nes->cpu.pc ++;
+            addr += (read(nes, nes->cpu.pc) << 8);
+            nes->cpu.pc ++;
 
-            if((addr & 0xff) + index_x > 255) {
+            if((addr & 0xff) + nes->cpu.index_x > 255) {
                 (*page_cross)++;
             }
-            addr += index_x;
+            addr += nes->cpu.index_x;
             break;
 
         case ABSOLUTE_Y:
-            addr = read(pc);
-            pc ++;
-            addr += (read(pc) << 8);
-            pc ++;
+            addr = read(nes, nes->cpu.pc);
+            nes->cpu.pc ++;
+            addr += (read(nes, nes->cpu.pc) << 8);
+            nes->cpu.pc ++;
 
-            if((addr & 0xff) + index_y > 255) {
+            if((addr & 0xff) + nes->cpu.index_y > 255) {
                 (*page_cross)++;
             }
-            addr += index_y;
+            addr += nes->cpu.index_y;
             break;
 
         case INDIRECT:
-            ptr = read(pc) + (read(pc+1) << 8);
-            addr = read(ptr);
-            pc ++;
+            ptr = read(nes, nes->cpu.pc) + (read(nes, nes->cpu.pc+1) << 8);
+            addr = read(nes, ptr);
+            nes->cpu.pc ++;
             if((ptr & 0xff) == 0xff)
-                addr += read(ptr-0xff) << 8;
+                addr += read(nes, ptr-0xff) << 8;
             else
-                addr += read(ptr+1) << 8;
-            pc ++;
+                addr += read(nes, ptr+1) << 8;
+            nes->cpu.pc ++;
             break;
 
         case INDIRECT_X:
-            ptr = (read(pc) + index_x) & 0xff;
-            addr = read(ptr);
-            addr += read((uint8_t)(ptr + 1)) << 8;
-            pc ++;
+            ptr = (read(nes, nes->cpu.pc) + nes->cpu.index_x) & 0xff;
+            addr = read(nes, ptr);
+            addr += read(nes, (uint8_t)(ptr + 1)) << 8;
+            nes->cpu.pc ++;
             break;
 
         case INDIRECT_Y:
-            ptr = read(pc);
-            addr = read(ptr);
-            addr += read((uint8_t)(ptr+1)) << 8;
+            ptr = read(nes, nes->cpu.pc);
+            addr = read(nes, ptr);
+            addr += read(nes, (uint8_t)(ptr+1)) << 8;
 
-            if((addr & 0xff) + index_y > 255) {
+            if((addr & 0xff) + nes->cpu.index_y > 255) {
                 (*page_cross)++;
             }
-            addr += index_y; 
-            pc ++;
+            addr += nes->cpu.index_y; 
+            nes->cpu.pc ++;
             break;
 
         case RELATIVE:
-            addr = read(pc);
-            pc ++;
+            addr = read(nes, nes->cpu.pc);
+            nes->cpu.pc ++;
             break;
     }
     return addr;
@@ -383,51 +424,51 @@ uint16_t GetAddress(enum ADDRESS_MODE mode, int* page_cross) {
 
 // instructions
 
-int adc6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int adc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t accumulator_initial = accumulator;
-    uint8_t value = (mode == IMMEDIATE) ? addr : read(addr);
+    uint8_t accumulator_initial = nes->cpu.accumulator;
+    uint8_t value = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    uint16_t result = accumulator + value + (status & FLAG_CARRY ? 1 : 0);
-    accumulator = result & 0xff;
+    uint16_t result = nes->cpu.accumulator + value + (nes->cpu.status & FLAG_CARRY ? 1 : 0);
+    nes->cpu.accumulator = result & 0xff;
  
-    SetFlag(FLAG_CARRY, result > 255);
+    SetFlag(nes, FLAG_CARRY, result > 255);
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, accumulator & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.accumulator & FLAG_NEGATIVE);
 
-    SetFlag(FLAG_OVERFLOW, (accumulator_initial ^ accumulator) & (value ^ accumulator) & 0x80);
+    SetFlag(nes, FLAG_OVERFLOW, (accumulator_initial ^ nes->cpu.accumulator) & (value ^ nes->cpu.accumulator) & 0x80);
 
     return 0;
 }
 
-int and6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int and6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE ? addr : read(addr));
+    uint8_t value = (mode == IMMEDIATE ? addr : read(nes, addr));
 
-    accumulator &= value;
+    nes->cpu.accumulator &= value;
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, accumulator & FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.accumulator & FLAG_NEGATIVE); 
 
     return 0;
 }
 
-int asl6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int asl6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == ACCUMULATOR) ? accumulator : read(addr);
+    uint8_t value = (mode == ACCUMULATOR) ? nes->cpu.accumulator : read(nes, addr);
 
-    SetFlag(FLAG_CARRY, (value << 1) > 255);
+    SetFlag(nes, FLAG_CARRY, (value << 1) > 255);
 
     value <<= 1;
 
-    SetFlag(FLAG_ZERO, value == 0);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & value) == FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, value == 0);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & value) == FLAG_NEGATIVE);
 
     if(mode == ACCUMULATOR) 
-        accumulator = value;
+        nes->cpu.accumulator = value;
     else
-        write(addr, value);
+        write(nes, addr, value);
 
     return 0;
 }
@@ -436,14 +477,14 @@ int asl6502(enum ADDRESS_MODE mode, uint16_t addr) {
 branch if carry flag 0. requires more cycles if successful
 and also if pc moves to different page.
 */
-int bcc6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bcc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (!(status & FLAG_CARRY)) {
+    if (!(nes->cpu.status & FLAG_CARRY)) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -451,14 +492,14 @@ int bcc6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int bcs6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bcs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (status & FLAG_CARRY) {
+    if (nes->cpu.status & FLAG_CARRY) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -466,14 +507,14 @@ int bcs6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int beq6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int beq6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (status & FLAG_ZERO) {
+    if (nes->cpu.status & FLAG_ZERO) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if branches to different page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if branches to different page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -481,26 +522,26 @@ int beq6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int bit6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bit6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
     
-    uint8_t value = read(addr);
+    uint8_t value = read(nes, addr);
 
-    SetFlag(FLAG_NEGATIVE, value & FLAG_NEGATIVE);
-    SetFlag(FLAG_OVERFLOW, value & FLAG_OVERFLOW);
+    SetFlag(nes, FLAG_NEGATIVE, value & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_OVERFLOW, value & FLAG_OVERFLOW);
 
-    SetFlag(FLAG_ZERO, !(value & accumulator));
+    SetFlag(nes, FLAG_ZERO, !(value & nes->cpu.accumulator));
     
     return 0;
 }
 
-int bmi6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bmi6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (status & FLAG_NEGATIVE) {
+    if (nes->cpu.status & FLAG_NEGATIVE) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -508,28 +549,28 @@ int bmi6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int bne6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bne6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (!(status & FLAG_ZERO)) {
+    if (!(nes->cpu.status & FLAG_ZERO)) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
         return extra_cycles;
     }
 
     return 0;
 }
 
-int bpl6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bpl6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (!(status & FLAG_NEGATIVE)) {
+    if (!(nes->cpu.status & FLAG_NEGATIVE)) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -537,29 +578,29 @@ int bpl6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int brk6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int brk6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
     
-    StackPush(pc >> 8);
-    StackPush(pc);
-    status |= 0b00110000;
-    StackPush(status);
+    StackPush(nes, nes->cpu.pc >> 8);
+    StackPush(nes, nes->cpu.pc);
+    nes->cpu.status |= 0b00110000;
+    StackPush(nes, nes->cpu.status);
 
-    pc = read(0xfffe);
-    pc += read(0xffff) << 8;
+    nes->cpu.pc = read(nes, 0xfffe);
+    nes->cpu.pc += read(nes, 0xffff) << 8;
 
-    SetFlag(FLAG_BREAK, true);
+    SetFlag(nes, FLAG_BREAK, true);
 
     return 0;
 }
 
-int bvc6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bvc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (!(status & FLAG_OVERFLOW)) {
+    if (!(nes->cpu.status & FLAG_OVERFLOW)) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -567,14 +608,14 @@ int bvc6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int bvs6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int bvs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     char pc_displacement = (char) addr;
 
-    if (status & FLAG_OVERFLOW) {
+    if (nes->cpu.status & FLAG_OVERFLOW) {
 
-        int extra_cycles = ((0xff00 & pc) != (0xff00 & (pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
-        pc += pc_displacement;
+        int extra_cycles = ((0xff00 & nes->cpu.pc) != (0xff00 & (nes->cpu.pc + pc_displacement))) ? 2 : 1; // if pc moves to new page
+        nes->cpu.pc += pc_displacement;
 
         return extra_cycles;
     }
@@ -582,200 +623,200 @@ int bvs6502(enum ADDRESS_MODE mode, uint16_t addr) {
     return 0;
 }
 
-int cmp6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int cmp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE) ? addr : read(addr);
+    uint8_t value = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    SetFlag(FLAG_CARRY, accumulator >= value); 
-    SetFlag(FLAG_ZERO, accumulator == value);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & (accumulator - value)) == FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_CARRY, nes->cpu.accumulator >= value); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == value);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & (nes->cpu.accumulator - value)) == FLAG_NEGATIVE);
 
     return 0;
 }
 
-int cpx6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int cpx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE ? addr : read(addr));
+    uint8_t value = (mode == IMMEDIATE ? addr : read(nes, addr));
 
-    SetFlag(FLAG_CARRY, index_x >= value);
-    SetFlag(FLAG_ZERO, index_x == value);
-    SetFlag(FLAG_NEGATIVE, (index_x - value) & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_CARRY, nes->cpu.index_x >= value);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_x == value);
+    SetFlag(nes, FLAG_NEGATIVE, (nes->cpu.index_x - value) & FLAG_NEGATIVE);
 
     return 0;    
 }
 
-int cpy6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int cpy6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE) ? addr : read(addr);
+    uint8_t value = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    SetFlag(FLAG_CARRY, index_y >= value);
-    SetFlag(FLAG_ZERO, index_y == value);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & (index_y - value));
+    SetFlag(nes, FLAG_CARRY, nes->cpu.index_y >= value);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_y == value);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & (nes->cpu.index_y - value));
 
     return 0;
 }
 
-int dec6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int dec6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = read(addr);
+    uint8_t value = read(nes, addr);
     value--;
-    write(addr, value);
+    write(nes, addr, value);
 
-    SetFlag(FLAG_ZERO,!value);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & value);
+    SetFlag(nes, FLAG_ZERO,!value);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & value);
 
     return 0;
 }
 
-int dex6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int dex6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
     
-    index_x--;
+    nes->cpu.index_x--;
 
-    SetFlag(FLAG_ZERO, index_x == 0);
-    SetFlag(FLAG_NEGATIVE, index_x & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_x == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.index_x & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int dey6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int dey6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
     
-    index_y--;
+    nes->cpu.index_y--;
 
-    SetFlag(FLAG_ZERO, index_y == 0);
-    SetFlag(FLAG_NEGATIVE, index_y & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_y == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.index_y & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int eor6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int eor6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE) ? addr : read(addr);
+    uint8_t value = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    accumulator ^= value;
+    nes->cpu.accumulator ^= value;
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, accumulator & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.accumulator & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int inc6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int inc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = read(addr);
+    uint8_t value = read(nes, addr);
     value++;
-    write(addr, value);
+    write(nes, addr, value);
 
-    SetFlag(FLAG_ZERO, value == 0);
-    SetFlag(FLAG_NEGATIVE, value & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, value == 0);
+    SetFlag(nes, FLAG_NEGATIVE, value & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int inx6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int inx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    index_x++;
+    nes->cpu.index_x++;
 
-    SetFlag(FLAG_ZERO, index_x == 0);
-    SetFlag(FLAG_NEGATIVE, index_x & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_x == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.index_x & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int iny6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int iny6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    index_y++;
+    nes->cpu.index_y++;
 
-    SetFlag(FLAG_ZERO, !index_y);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & index_y);
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.index_y);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.index_y);
 
     return 0;
 }
 
-int jmp6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int jmp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    pc = addr;
+    nes->cpu.pc = addr;
 
     return 0;
 }
 
-int jsr6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int jsr6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = read(addr);
+    uint8_t value = read(nes, addr);
 
-    pc--;
-    StackPush(pc >> 8);
-    StackPush(pc);
-    pc = addr;
+    nes->cpu.pc--;
+    StackPush(nes, nes->cpu.pc >> 8);
+    StackPush(nes, nes->cpu.pc);
+    nes->cpu.pc = addr;
 
     return 0;
 }
 
-int lda6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int lda6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    accumulator = ((mode == IMMEDIATE) ? addr : read(addr));
+    nes->cpu.accumulator = ((mode == IMMEDIATE) ? addr : read(nes, addr));
 
-    SetFlag(FLAG_ZERO, !accumulator);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & accumulator); 
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.accumulator);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.accumulator); 
     
     return 0;
 }
 
-int ldx6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int ldx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
  
-    index_x = (mode == IMMEDIATE) ? addr : read(addr);
+    nes->cpu.index_x = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    SetFlag(FLAG_ZERO, !index_x);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & index_x) == FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.index_x);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & nes->cpu.index_x) == FLAG_NEGATIVE); 
     
     return 0;
 }
 
-int ldy6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int ldy6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    index_y = (mode == IMMEDIATE) ? addr : read(addr);
+    nes->cpu.index_y = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    SetFlag(FLAG_ZERO, !index_y);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & index_y) == FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.index_y);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & nes->cpu.index_y) == FLAG_NEGATIVE); 
     
     return 0;
 }
 
-int lsr6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int lsr6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = read(addr);
+    uint8_t value = read(nes, addr);
 
     if(mode == ACCUMULATOR)
-        value = accumulator;
+        value = nes->cpu.accumulator;
 
-    status &= ~FLAG_CARRY;
-    status |= (FLAG_CARRY & value);
+    nes->cpu.status &= ~FLAG_CARRY;
+    nes->cpu.status |= (FLAG_CARRY & value);
 
     value >>= 1;
 
-    SetFlag(FLAG_ZERO, !value);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & value) == FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, !value);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & value) == FLAG_NEGATIVE); 
 
     if(mode == ACCUMULATOR)
-        accumulator = value;
+        nes->cpu.accumulator = value;
     else
-        write(addr, value);
+        write(nes, addr, value);
 
     return 0;
 }
 
-int nop6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int nop6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
     return 0;
 }
 
-int ora6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int ora6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == IMMEDIATE) ? addr : read(addr);
+    uint8_t value = (mode == IMMEDIATE) ? addr : read(nes, addr);
 
-    accumulator |= value;
+    nes->cpu.accumulator |= value;
 
-    SetFlag(FLAG_ZERO, !accumulator);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & accumulator) == FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.accumulator);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & nes->cpu.accumulator) == FLAG_NEGATIVE); 
 
     return 0;
 }
@@ -783,263 +824,254 @@ int ora6502(enum ADDRESS_MODE mode, uint16_t addr) {
 /*
 pushes copy of the accumulator to stack
 */
-int pha6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int pha6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    StackPush(accumulator);
+    StackPush(nes, nes->cpu.accumulator);
 
     return 0;
 }
 
-int php6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int php6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    status |= 0b00110000;
-    StackPush(status);
+    nes->cpu.status |= 0b00110000;
+    StackPush(nes, nes->cpu.status);
 
     return 0;
 }
 
-int pla6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int pla6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    accumulator = StackPop();
+    nes->cpu.accumulator = StackPop(nes);
 
-    SetFlag(FLAG_ZERO, !accumulator);
-    SetFlag(FLAG_NEGATIVE, (FLAG_NEGATIVE & accumulator) == FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, !nes->cpu.accumulator);
+    SetFlag(nes, FLAG_NEGATIVE, (FLAG_NEGATIVE & nes->cpu.accumulator) == FLAG_NEGATIVE); 
 
     return 0;
 }
 
-int plp6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int plp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    status = StackPop();
+    nes->cpu.status = StackPop(nes);
 
     return 0;
 }
 
-int rol6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int rol6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == ACCUMULATOR ? accumulator : read(addr));
+    uint8_t value = (mode == ACCUMULATOR ? nes->cpu.accumulator : read(nes, addr));
 
-    uint8_t carry = (status & FLAG_CARRY ? 1 : 0);
-    SetFlag(FLAG_CARRY, value & 0b10000000);
+    uint8_t carry = (nes->cpu.status & FLAG_CARRY ? 1 : 0);
+    SetFlag(nes, FLAG_CARRY, value & 0b10000000);
 
     value = value << 1;
     value |= carry;
 
     if(mode == ACCUMULATOR) {
-        accumulator = value;
+        nes->cpu.accumulator = value;
     } else {
-        write(addr, value);
+        write(nes, addr, value);
     }
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, value & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, value & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int ror6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int ror6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t value = (mode == ACCUMULATOR ? accumulator : read(addr));
+    uint8_t value = (mode == ACCUMULATOR ? nes->cpu.accumulator : read(nes, addr));
 
-    uint8_t carry = (status & FLAG_CARRY ? 0b10000000 : 0);
-    SetFlag(FLAG_CARRY, value & 0b00000001);
+    uint8_t carry = (nes->cpu.status & FLAG_CARRY ? 0b10000000 : 0);
+    SetFlag(nes, FLAG_CARRY, value & 0b00000001);
 
     value = value >> 1;
     value |= carry;
 
     if(mode == ACCUMULATOR) {
-        accumulator = value;
+        nes->cpu.accumulator = value;
     } else {
-        write(addr, value);
+        write(nes, addr, value);
     }
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, value & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, value & FLAG_NEGATIVE);
 
     return 0;
 }
 
-int rti6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int rti6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    pc = StackPop();
-    pc += StackPop() << 8;
-    status = StackPop();
+    nes->cpu.status = StackPop(nes);
+    nes->cpu.pc = StackPop(nes);
+    nes->cpu.pc += StackPop(nes) << 8;
 
     return 0;
 }
 
-int rts6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int rts6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    pc = StackPop();
-    pc += StackPop() << 8;
+    nes->cpu.pc = StackPop(nes);
+    nes->cpu.pc += StackPop(nes) << 8;
 
-    pc++;
+    nes->cpu.pc++;
 
     return 0;
 }
 
-int sbc6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int sbc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    uint8_t accumulator_initial = accumulator;
-    uint8_t value = (mode == IMMEDIATE ? addr : read(addr));
+    uint8_t accumulator_initial = nes->cpu.accumulator;
+    uint8_t value = (mode == IMMEDIATE ? addr : read(nes, addr));
     value ^= 0xff;
 
-    uint16_t result = accumulator + value + (status & FLAG_CARRY ? 1 : 0);
-    accumulator = result & 0xff;
+    uint16_t result = nes->cpu.accumulator + value + (nes->cpu.status & FLAG_CARRY ? 1 : 0);
+    nes->cpu.accumulator = result & 0xff;
  
-    SetFlag(FLAG_CARRY, result > 255);
+    SetFlag(nes, FLAG_CARRY, result > 255);
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, accumulator & FLAG_NEGATIVE);
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.accumulator & FLAG_NEGATIVE);
 
-    SetFlag(FLAG_OVERFLOW, (accumulator_initial ^ accumulator) & (value ^ accumulator) & 0x80);
+    SetFlag(nes, FLAG_OVERFLOW, (accumulator_initial ^ nes->cpu.accumulator) & (value ^ nes->cpu.accumulator) & 0x80);
 
     return 0;
 }
 
-int sta6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int sta6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    write(addr, accumulator);
-    
-    if(addr == 0x4014)
-        return 513;
+    write(nes, addr, nes->cpu.accumulator);
     return 0;
 }
 
-int stx6502(enum ADDRESS_MODE mode, uint16_t addr) {
-
-    write(addr, index_x);
+int stx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    if(addr == 0x4014)
-        return 513;
+    write(nes, addr, nes->cpu.index_x);
     return 0;
 }
 
-int sty6502(enum ADDRESS_MODE mode, uint16_t addr) {
-
-    write(addr, index_y);
+int sty6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    if(addr == 0x4014)
-        return 513;
+    write(nes, addr, nes->cpu.index_y);
     return 0;
 }
 
-int tax6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int tax6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    index_x = accumulator;
+    nes->cpu.index_x = nes->cpu.accumulator;
 
-    SetFlag(FLAG_ZERO, index_x == 0);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & index_x); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_x == 0);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.index_x); 
 
     return 0;
 }
 
-int tay6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int tay6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
     
-    index_y = accumulator;
+    nes->cpu.index_y = nes->cpu.accumulator;
 
-    SetFlag(FLAG_ZERO, index_y == 0);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & index_y); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_y == 0);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.index_y); 
 
     return 0;
 }
 
-int tsx6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int tsx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    index_x = sp;
+    nes->cpu.index_x = nes->cpu.sp;
 
-    SetFlag(FLAG_ZERO, index_x == 0);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & index_x); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.index_x == 0);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.index_x); 
 
     return 0;
 }
 
-int txa6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int txa6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    accumulator = index_x;
+    nes->cpu.accumulator = nes->cpu.index_x;
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, FLAG_NEGATIVE & accumulator); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, FLAG_NEGATIVE & nes->cpu.accumulator); 
 
     return 0;
 }
 
-int txs6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int txs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    sp = index_x;
+    nes->cpu.sp = nes->cpu.index_x;
 
     return 0;
 }
 
-int tya6502(enum ADDRESS_MODE mode, uint16_t addr) {
+int tya6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
 
-    accumulator = index_y;
+    nes->cpu.accumulator = nes->cpu.index_y;
 
-    SetFlag(FLAG_ZERO, accumulator == 0);
-    SetFlag(FLAG_NEGATIVE, accumulator & FLAG_NEGATIVE); 
+    SetFlag(nes, FLAG_ZERO, nes->cpu.accumulator == 0);
+    SetFlag(nes, FLAG_NEGATIVE, nes->cpu.accumulator & FLAG_NEGATIVE); 
 
     return 0;
 }
 
-int sec6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_CARRY, 1);
+int sec6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_CARRY, 1);
     return 0;
 }
 
-int sed6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_DECIMAL, 1);
+int sed6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_DECIMAL, 1);
     return 0;
 }
 
-int sei6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_INTERRUPT, 1);
+int sei6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_INTERRUPT, 1);
     return 0;
 }
 
-int clc6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_CARRY, 0);
+int clc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_CARRY, 0);
     return 0;
 }
 
-int cld6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_DECIMAL, 0);
+int cld6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_DECIMAL, 0);
     return 0;
 }
 
-int cli6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_INTERRUPT, 0);
+int cli6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_INTERRUPT, 0);
     return 0;
 }
 
-int clv6502(enum ADDRESS_MODE mode, uint16_t addr) {
-    SetFlag(FLAG_OVERFLOW, 0);
+int clv6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr) {
+    SetFlag(nes, FLAG_OVERFLOW, 0);
     return 0;
 }
 
 // set flags
 
-void SetFlag(int flag, bool condition) {
+void SetFlag(nes_machine* nes, int flag, bool condition) {
 
     if(condition)
-        status |= flag;
+        nes->cpu.status |= flag;
     else
-        status &= ~flag;
+        nes->cpu.status &= ~flag;
 }
 
 // stack functions
 
-void StackPush(uint8_t value) {
+void StackPush(nes_machine* nes, uint8_t value) {
 
-    write(0x100 + sp, value);
-    sp--;
-    sp = (uint8_t)sp;
+    write(nes, 0x100 + nes->cpu.sp, value);
+    nes->cpu.sp--;
+    nes->cpu.sp = (uint8_t)nes->cpu.sp;
 }
 
-uint8_t StackPop(void) {
+uint8_t StackPop(nes_machine* nes) {
 
-    sp++;
-    sp = (uint8_t)sp;
-    return read(0x100 + sp);
+    nes->cpu.sp++;
+    nes->cpu.sp = (uint8_t)nes->cpu.sp;
+    return read(nes, 0x100 + nes->cpu.sp);
 }
 
 
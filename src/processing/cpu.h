@@ -1,4 +1,10 @@
+#ifndef CPU_H
+#define CPU_H
+
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "../machine.h"
 
 // addressing modes
 enum ADDRESS_MODE
@@ -44,6 +50,14 @@ enum FLAG
     FLAG_NEGATIVE = 1 << 7,
 };
 
+// sources driving the shared IRQ line, cleared by whoever raised them
+enum IRQ_SOURCE
+{
+    IRQ_MAPPER = 1 << 0,
+    IRQ_FRAME = 1 << 1, // apu frame counter
+    IRQ_DMC = 1 << 2, // dmc sample finished
+};
+
 typedef struct opcode {
     unsigned char OPCODE;
     enum ADDRESS_MODE MODE;
@@ -53,82 +67,78 @@ typedef struct opcode {
 
 extern opcode opcode_table[256];
 
-unsigned char FetchInstruction(void);
+unsigned char FetchInstruction(nes_machine* nes);
 opcode OpcodeLookup(unsigned char op);
-int ExecuteInstruction(opcode opcode);
-uint16_t GetAddress(enum ADDRESS_MODE mode, int* page_cross);
-
-void SetFlag(int flag, bool condition);
+int ExecuteInstruction(nes_machine* nes, opcode opcode);
+uint16_t GetAddress(nes_machine* nes, enum ADDRESS_MODE mode, int* page_cross);
 
-int adc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int and6502(enum ADDRESS_MODE mode, uint16_t addr);
-int asl6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bcc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bcs6502(enum ADDRESS_MODE mode, uint16_t addr);
-int beq6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bit6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bmi6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bne6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bpl6502(enum ADDRESS_MODE mode, uint16_t addr);
-int brk6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bvc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int bvs6502(enum ADDRESS_MODE mode, uint16_t addr);
-int clv6502(enum ADDRESS_MODE mode, uint16_t addr);
-int cmp6502(enum ADDRESS_MODE mode, uint16_t addr);
-int cpx6502(enum ADDRESS_MODE mode, uint16_t addr);
-int cpy6502(enum ADDRESS_MODE mode, uint16_t addr);
-int dec6502(enum ADDRESS_MODE mode, uint16_t addr);
-int dex6502(enum ADDRESS_MODE mode, uint16_t addr);
-int dey6502(enum ADDRESS_MODE mode, uint16_t addr);
-int eor6502(enum ADDRESS_MODE mode, uint16_t addr);
-int inc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int inx6502(enum ADDRESS_MODE mode, uint16_t addr);
-int iny6502(enum ADDRESS_MODE mode, uint16_t addr);
-int jmp6502(enum ADDRESS_MODE mode, uint16_t addr);
-int jsr6502(enum ADDRESS_MODE mode, uint16_t addr);
-int lda6502(enum ADDRESS_MODE mode, uint16_t addr);
-int ldx6502(enum ADDRESS_MODE mode, uint16_t addr);
-int ldy6502(enum ADDRESS_MODE mode, uint16_t addr);
-int lsr6502(enum ADDRESS_MODE mode, uint16_t addr);
-int nop6502(enum ADDRESS_MODE mode, uint16_t addr);
-int ora6502(enum ADDRESS_MODE mode, uint16_t addr);
-int pha6502(enum ADDRESS_MODE mode, uint16_t addr);
-int php6502(enum ADDRESS_MODE mode, uint16_t addr);
-int pla6502(enum ADDRESS_MODE mode, uint16_t addr);
-int plp6502(enum ADDRESS_MODE mode, uint16_t addr);
-int rol6502(enum ADDRESS_MODE mode, uint16_t addr);
-int ror6502(enum ADDRESS_MODE mode, uint16_t addr);
-int rti6502(enum ADDRESS_MODE mode, uint16_t addr);
-int rts6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sbc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sta6502(enum ADDRESS_MODE mode, uint16_t addr);
-int stx6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sty6502(enum ADDRESS_MODE mode, uint16_t addr);
-int tax6502(enum ADDRESS_MODE mode, uint16_t addr);
-int tay6502(enum ADDRESS_MODE mode, uint16_t addr);
-int tsx6502(enum ADDRESS_MODE mode, uint16_t addr);
-int txa6502(enum ADDRESS_MODE mode, uint16_t addr);
-int txs6502(enum ADDRESS_MODE mode, uint16_t addr);
-int tya6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sec6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sei6502(enum ADDRESS_MODE mode, uint16_t addr);
-int sed6502(enum ADDRESS_MODE mode, uint16_t addr);
-int clc6502(enum ADDRESS_MODE mode, uint16_t addr);
-int cli6502(enum ADDRESS_MODE mode, uint16_t addr);
-int cld6502(enum ADDRESS_MODE mode, uint16_t addr);
+void SetFlag(nes_machine* nes, int flag, bool condition);
 
-void Init_CPU();
-int Update_CPU();
+int adc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int and6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int asl6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bcc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bcs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int beq6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bit6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bmi6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bne6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bpl6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int brk6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bvc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int bvs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int clv6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int cmp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int cpx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int cpy6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int dec6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int dex6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int dey6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int eor6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int inc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int inx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int iny6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int jmp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int jsr6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int lda6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int ldx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int ldy6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int lsr6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int nop6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int ora6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int pha6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int php6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int pla6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int plp6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int rol6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int ror6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int rti6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int rts6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sbc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sta6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int stx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sty6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int tax6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int tay6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int tsx6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int txa6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int txs6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int tya6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sec6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sei6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int sed6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int clc6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int cli6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
+int cld6502(nes_machine* nes, enum ADDRESS_MODE mode, uint16_t addr);
 
-void StackPush(unsigned char value);
-unsigned char StackPop(void);
+void Init_CPU(nes_machine* nes);
+int Update_CPU(nes_machine* nes);
 
-extern unsigned char accumulator;
-extern unsigned char index_x;
-extern unsigned char index_y;
-extern unsigned char status;
-extern uint16_t pc;
-extern unsigned char sp;
+void StackPush(nes_machine* nes, unsigned char value);
+unsigned char StackPop(nes_machine* nes);
+void Interrupt(nes_machine* nes, uint16_t vector);
 
 char * get_opcode_name(unsigned char op);
-char * get_address_mode_string(unsigned char address_num);
\ No newline at end of file
+char * get_address_mode_string(unsigned char address_num);
+
+#endif
@@ -3,10 +3,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include "../memory/mem.h"
 #include "../memory/ram.h"
+#include "../memory/rom.h"
 #include "ppu.h"
 #include "palette.h"
 
@@ -67,102 +69,89 @@ const int PPUSCROLL = 0x0005; //xxxx xxxx | fine scroll position (two writes x,
 const int PPUADDR = 0x0006; //aaaa aaaa | PPU read/write address (two writes, high nibble, low nibble)
 const int PPUDATA = 0x0007; //dddd dddd | PPU data read/write
 
-uint8_t ppu_reg[0x8];
-uint8_t OAM_memory[0x100];
-uint8_t OAM_memory_secondary[0x40];
+void Update_PPU(nes_machine* nes) {
 
-uint32_t frame_buffer[240][256]; 
-uint8_t data_buffer = 0;
-
-uint16_t ppu_address_temp;  // 't' register
-uint16_t ppu_address;  // 'v' register
-uint8_t fine_x = 0;   // 'x' register
-
-int rendering_enabled = 0;
-
-int frame = 0;
-int scanline = -1;
-int dot = 0;
-int latch = 0;  // 'w register'
-int NMI = 0;
-
-uint8_t sprite_priority[240][256];
-
-int render_s0 = 0;
-
-void Update_PPU() {
+    // MMC3 scanline clock. while rendering, the A12 rise always lands on the
+    // same dot so it is predicted here instead of testing every fetch address
+    if(nes->ppu.dot == nes->ppu.a12_rise_dot && nes->ppu.rendering_enabled && nes->ppu.scanline >= 0 && (nes->ppu.scanline < 240 || nes->ppu.scanline == 261)) {
+        mapper_a12_rise(nes);
+    }
 
-    if(scanline == -1) {
+    if(nes->ppu.scanline == -1) {
 
         //idle
     }
-    else if(scanline < 240) {
+    else if(nes->ppu.scanline < 240) {
 
         // visible scanlines
-        Draw_Scanline();
+        Draw_Scanline(nes);
     }
-    else if(scanline == 240) {
+    else if(nes->ppu.scanline == 240) {
 
         // idle
     }
-    else if(scanline < 261) { 
+    else if(nes->ppu.scanline < 261) { 
 
         // post-render scanlines
-        if(scanline == 241 && dot == 1) {
-            // VBlank period begins
-            ppu_reg[PPUSTATUS] |= V_BLANK_BIT; 
+        if(nes->ppu.scanline == 241 && nes->ppu.dot == 1) {
+            // VBlank period begins, frame_buffer holds the finished frame
+            nes->ppu.ppu_reg[PPUSTATUS] |= V_BLANK_BIT; 
+            nes->ppu.frame_complete = true;
         }
-        if(scanline == 241 && dot == 1) {
+        if(nes->ppu.scanline == 241 && nes->ppu.dot == 1) {
             // active NMI (non maskable interrupt)
-            if(ppu_reg[PPUCTRL] & NMI_BIT) {
-                NMI = 1;
+            if(nes->ppu.ppu_reg[PPUCTRL] & NMI_BIT) {
+                nes->cpu.nmi = 1;
             }
         }
     }
     else {
 
         // pre-render line, switch off status flags
-        if(dot == 1) {
-            render_s0 = 0;
-            ppu_reg[PPUSTATUS] &= ~S0_HIT_BIT;
-            ppu_reg[PPUSTATUS] &= ~SPRITE_OVERFLOW_BIT;
-            ppu_reg[PPUSTATUS] &= ~V_BLANK_BIT;
+        if(nes->ppu.dot == 0) {
+            clear_frame_buffer(nes);
+        }
+        if(nes->ppu.dot == 1) {
+            nes->ppu.render_s0 = 0;
+            nes->ppu.ppu_reg[PPUSTATUS] &= ~S0_HIT_BIT;
+            nes->ppu.ppu_reg[PPUSTATUS] &= ~SPRITE_OVERFLOW_BIT;
+            nes->ppu.ppu_reg[PPUSTATUS] &= ~V_BLANK_BIT;
         }
-        if(((dot > 0 && dot <= 256)/* || dot >= 328 */) && dot%8 == 0) {
-            increment_hori();
+        if(((nes->ppu.dot > 0 && nes->ppu.dot <= 256)/* || dot >= 328 */) && nes->ppu.dot%8 == 0) {
+            increment_hori(nes);
         }
-        if(dot == 256) {
-            increment_vert();
+        if(nes->ppu.dot == 256) {
+            increment_vert(nes);
         }
-        if(dot == 257) {
-            copy_hori();
+        if(nes->ppu.dot == 257) {
+            copy_hori(nes);
         }
-        if(dot >= 280 && dot <= 304) {
-            copy_vert();
+        if(nes->ppu.dot >= 280 && nes->ppu.dot <= 304) {
+            copy_vert(nes);
         }
-        if(dot == 339) { 
+        if(nes->ppu.dot == 339) { 
             // ensures NMI is disabled
-            NMI = 0;
+            nes->cpu.nmi = 0;
 
             // on odd frames, first dot is skipped
-            if(frame % 2 == 1) {
+            if(nes->ppu.frame % 2 == 1) {
 
-                dot = 0;
-                scanline = 0;
+                nes->ppu.dot = 0;
+                nes->ppu.scanline = 0;
             } 
         }
     }
 
-    dot++;
-    if(dot > 340) {
+    nes->ppu.dot++;
+    if(nes->ppu.dot > 340) {
 
-        scanline++;
+        nes->ppu.scanline++;
         //end of frame
-        if(scanline > 261) {
-            frame++;
-            scanline = 0;
+        if(nes->ppu.scanline > 261) {
+            nes->ppu.frame++;
+            nes->ppu.scanline = 0;
         }
-        dot = 0;
+        nes->ppu.dot = 0;
     }
 
     //if(scanline == 0 && dot == 100)
@@ -174,59 +163,60 @@ void Update_PPU() {
     }*/
 }
 
-uint8_t read_ppu(uint16_t addr) {
+uint8_t read_ppu(nes_machine* nes, uint16_t addr) {
 
     uint8_t return_data;
 
     switch(addr) {
 
         case 0x00:
-            return ppu_reg[PPUADDR];
+            return nes->ppu.ppu_reg[PPUADDR];
             break;
 
         case 0x01:
-            return ppu_reg[PPUMASK];
+            return nes->ppu.ppu_reg[PPUMASK];
             break;
 
         case 0x02:
-            return_data = ppu_reg[PPUSTATUS];
+            return_data = nes->ppu.ppu_reg[PPUSTATUS];
 
-            ppu_reg[PPUSTATUS] &= ~V_BLANK_BIT; // VERT BLANK BIT CLEARED AFTER $2002 READ
-            latch = 0;
+            nes->ppu.ppu_reg[PPUSTATUS] &= ~V_BLANK_BIT; // VERT BLANK BIT CLEARED AFTER $2002 READ
+            nes->ppu.latch = 0;
 
             return return_data;
             break;
 
         case 0x03:
-            return ppu_reg[OAMADDR];
+            return nes->ppu.ppu_reg[OAMADDR];
             break;
 
         case 0x04:
-            if(dot < 65 && scanline < 240)
+            if(nes->ppu.dot < 65 && nes->ppu.scanline < 240)
                 return 0xff;
-            return OAM_memory[ppu_reg[OAMADDR]];
+            return nes->ppu.OAM_memory[nes->ppu.ppu_reg[OAMADDR]];
             break;
 
         case 0x05:
-            return ppu_reg[PPUSCROLL];
+            return nes->ppu.ppu_reg[PPUSCROLL];
             break;
 
         case 0x06: 
-            return ppu_reg[PPUADDR];
+            return nes->ppu.ppu_reg[PPUADDR];
             break;
 
         case 0x07:
                 
-            return_data = data_buffer;
-            data_buffer = read_vram(ppu_address);
+            return_data = nes->ppu.data_buffer;
+            nes->ppu.data_buffer = read_vram(nes, nes->ppu.ppu_address);
 
-            int increment = (ppu_reg[PPUCTRL]) & ADDR_INCREMENT_BIT ? 32 : 1;
-            ppu_address += increment;
-            ppu_reg[PPUADDR] += increment;
+            int increment = (nes->ppu.ppu_reg[PPUCTRL]) & ADDR_INCREMENT_BIT ? 32 : 1;
+            nes->ppu.ppu_address += increment;
+            nes->ppu.ppu_reg[PPUADDR] += increment;
+            a12_edge(nes, nes->ppu.ppu_address);
 
-            if(ppu_address >= 0x3f00) {
-                data_buffer = read_vram(ppu_address - 0x1000);
-                return read_vram(ppu_address);
+            if(nes->ppu.ppu_address >= 0x3f00) {
+                nes->ppu.data_buffer = read_vram(nes, nes->ppu.ppu_address - 0x1000);
+                return read_vram(nes, nes->ppu.ppu_address);
             }
 
             return return_data;
@@ -235,116 +225,155 @@ uint8_t read_ppu(uint16_t addr) {
     return 0;
 }
 
-void write_ppu(uint16_t addr, uint8_t data) {
+void write_ppu(nes_machine* nes, uint16_t addr, uint8_t data) {
 
     switch(addr) {
 
         case 0x00:
-            ppu_reg[PPUCTRL] = data;
-            ppu_address_temp &= 0b1110011111111111;
-            ppu_address_temp |= ((data & 0b11) << 11);
+            if((nes->ppu.ppu_reg[PPUCTRL] ^ data) & SPRITE_HEIGHT_BIT)
+                nes->sprites.dirty = true;
+            nes->ppu.ppu_reg[PPUCTRL] = data;
+            nes->ppu.ppu_address_temp &= 0b1110011111111111;
+            nes->ppu.ppu_address_temp |= ((data & 0b11) << 11);
+            update_a12_rise_dot(nes);
             break;
 
         case 0x01:
-            ppu_reg[PPUMASK] = data;
+            nes->ppu.ppu_reg[PPUMASK] = data;
             if((data & 0x10) || (data & 0x08))
-                rendering_enabled = 1;
+                nes->ppu.rendering_enabled = 1;
             else
-                rendering_enabled = 0;
+                nes->ppu.rendering_enabled = 0;
             break;
 
         case 0x02:
-            ppu_reg[PPUSTATUS] = data;
+            nes->ppu.ppu_reg[PPUSTATUS] = data;
             break;
 
         case 0x03:
-            ppu_reg[OAMADDR] = data;
+            nes->ppu.ppu_reg[OAMADDR] = data;
             break;
 
         case 0x04:
-            if(scanline < 262) {
-                OAM_memory[ppu_reg[OAMADDR]] = data;
+            if(nes->ppu.scanline < 262) {
+                nes->ppu.OAM_memory[nes->ppu.ppu_reg[OAMADDR]] = data;
+                nes->sprites.dirty = true;
                 //printf("Writing %02x to OAM addr: %02x\n", data, ppu_reg[OAMADDR]);
-                ppu_reg[OAMADDR]++;
-                ppu_reg[OAMADDR] &= 0xff;
+                nes->ppu.ppu_reg[OAMADDR]++;
+                nes->ppu.ppu_reg[OAMADDR] &= 0xff;
             }
             break;
 
         case 0x05:
-            if(latch == 0) {
-                fine_x = data & 0b111;
-                ppu_address_temp &= ~0b11111;
-                ppu_address_temp |= (data >> 3);
-                latch = 1;
+            if(nes->ppu.latch == 0) {
+                nes->ppu.fine_x = data & 0b111;
+                nes->ppu.ppu_address_temp &= ~0b11111;
+                nes->ppu.ppu_address_temp |= (data >> 3);
+                nes->ppu.latch = 1;
             }
             else {
-                ppu_address_temp &= 0b000110000011111;
-                ppu_address_temp |= ((data & 0b111) << 12);
-                ppu_address_temp |= (((data & 0b11111000) >> 3) << 5);
-                latch = 0;
+                nes->ppu.ppu_address_temp &= 0b000110000011111;
+                nes->ppu.ppu_address_temp |= ((data & 0b111) << 12);
+                nes->ppu.ppu_address_temp |= (((data & 0b11111000) >> 3) << 5);
+                nes->ppu.latch = 0;
             }
             break;
 
         case 0x06:
-            if(latch == 0) {
-                ppu_address_temp &= ~0b111111100000000;
-                ppu_address_temp |= ((data & 0b111111) << 8);
-                latch = 1;
+            if(nes->ppu.latch == 0) {
+                nes->ppu.ppu_address_temp &= ~0b111111100000000;
+                nes->ppu.ppu_address_temp |= ((data & 0b111111) << 8);
+                nes->ppu.latch = 1;
             } else {
-                ppu_address_temp &= 0xff00;
-                ppu_address_temp |= (data & 0xff);
-                ppu_address = ppu_address_temp;
-                latch = 0;
+                nes->ppu.ppu_address_temp &= 0xff00;
+                nes->ppu.ppu_address_temp |= (data & 0xff);
+                nes->ppu.ppu_address = nes->ppu.ppu_address_temp;
+                nes->ppu.latch = 0;
+                a12_edge(nes, nes->ppu.ppu_address);
             }
             //printf("\nppu_addr: %04x\n\n", ppu_address);
             break;
 
         case 0x07: 
             if(1/*(ppu_reg[PPUSTATUS] & V_BLANK_BIT) || !((ppu_reg[PPUMASK] & SHOW_BG_BIT) || (ppu_reg[PPUMASK] & SHOW_SPRITES_BIT))*/) { //unsure on logic, commented code created problems
-                write_vram(ppu_address, data);
+                write_vram(nes, nes->ppu.ppu_address, data);
                 //printf("\nWriting %02x to addr: %04x\n\n", data, ppu_address);
                     
-                int increment = (ppu_reg[PPUCTRL]) & ADDR_INCREMENT_BIT ? 32 : 1;
-                ppu_address += increment;
-                ppu_reg[PPUADDR] += increment;
+                int increment = (nes->ppu.ppu_reg[PPUCTRL]) & ADDR_INCREMENT_BIT ? 32 : 1;
+                nes->ppu.ppu_address += increment;
+                nes->ppu.ppu_reg[PPUADDR] += increment;
+                a12_edge(nes, nes->ppu.ppu_address);
             }
             break;
     }
 }
 
-void Draw_Scanline() {
+/*
+sprites fetch at dots 257-320 and the background at 321-336 (for the next
+line), so whichever reads from $1000 decides where A12 goes high
+*/
+void update_a12_rise_dot(nes_machine* nes) {
+
+    bool bg_high = nes->ppu.ppu_reg[PPUCTRL] & BACKGROUND_PATTERN_TABLE_BIT;
+    bool sprites_high = (nes->ppu.ppu_reg[PPUCTRL] & SPRITE_PATTERN_TABLE_BIT) || (nes->ppu.ppu_reg[PPUCTRL] & SPRITE_HEIGHT_BIT);
+
+    if(sprites_high && !bg_high)
+        nes->ppu.a12_rise_dot = 260;
+    else if(bg_high && !sprites_high)
+        nes->ppu.a12_rise_dot = 324;
+    else
+        nes->ppu.a12_rise_dot = -1;
+}
+
+/*
+A12 edge detect for cpu driven $2006/$2007 accesses, only needed when
+rendering is off (otherwise the rise is predicted in Update_PPU)
+*/
+void a12_edge(nes_machine* nes, uint16_t addr) {
 
-    if(dot == 1) {
-        clear_OAM();
+    if(nes->ppu.rendering_enabled)
+        return;
+
+    uint8_t a12_new = (addr >> 12) & 1;
+    if(a12_new && !nes->ppu.a12) {
+        mapper_a12_rise(nes);
+    }
+    nes->ppu.a12 = a12_new;
+}
+
+void Draw_Scanline(nes_machine* nes) {
+
+    if(nes->ppu.dot == 1) {
+        clear_OAM(nes);
     }
-    else if(dot == 65) {
-        sprite_eval();
+    else if(nes->ppu.dot == 65) {
+        sprite_eval(nes);
         //dump_OAM_secondary();
     }
 
-    if(((dot > 0 && dot <= 256))&& dot%8 == 0) {
-        increment_hori();
+    if(((nes->ppu.dot > 0 && nes->ppu.dot <= 256))&& nes->ppu.dot%8 == 0) {
+        increment_hori(nes);
     }
 
-    if(dot%8 == 1 && dot < 255) {
-        if(ppu_reg[PPUMASK] & SHOW_BG_BIT) {
-            Draw_Nametable();
+    if(nes->ppu.dot%8 == 1 && nes->ppu.dot < 255) {
+        if(nes->ppu.ppu_reg[PPUMASK] & SHOW_BG_BIT) {
+            Draw_Nametable(nes);
         }
     }
-    if(dot == 255) {
-        if(ppu_reg[PPUMASK] & SHOW_SPRITES_BIT && scanline < 239) {
-            Draw_Sprites();
+    if(nes->ppu.dot == 255) {
+        if(nes->ppu.ppu_reg[PPUMASK] & SHOW_SPRITES_BIT && nes->ppu.scanline < 239) {
+            Draw_Sprites(nes);
         }
     }
-    if(dot == 256) {
-        increment_vert();
+    if(nes->ppu.dot == 256) {
+        increment_vert(nes);
     }
-    if(dot == 257) {
-        copy_hori();
+    if(nes->ppu.dot == 257) {
+        copy_hori(nes);
     }
 }
 
-void Draw_Sprites() {
+void Draw_Sprites(nes_machine* nes) {
     
     uint8_t sprite_y;
     uint8_t pattern_index;
@@ -356,36 +385,36 @@ void Draw_Sprites() {
 
     for(int sprite_num = 0; sprite_num < 32; sprite_num+=4) {
 
-        sprite_y = OAM_memory_secondary[sprite_num];
-        pattern_index = OAM_memory_secondary[sprite_num+1];
-        attributes = OAM_memory_secondary[sprite_num+2];
-        sprite_x = OAM_memory_secondary[sprite_num+3];
+        sprite_y = nes->ppu.OAM_memory_secondary[sprite_num];
+        pattern_index = nes->ppu.OAM_memory_secondary[sprite_num+1];
+        attributes = nes->ppu.OAM_memory_secondary[sprite_num+2];
+        sprite_x = nes->ppu.OAM_memory_secondary[sprite_num+3];
 
         int pattern_table_addr;
-        if(ppu_reg[PPUCTRL] & SPRITE_HEIGHT_BIT) {  // 8x16 sprites
+        if(nes->ppu.ppu_reg[PPUCTRL] & SPRITE_HEIGHT_BIT) {  // 8x16 sprites
 
             pattern_table_addr = pattern_index & 0x1 ? 0x1000 : 0x0000;
-            int sprite_row = scanline+1 - sprite_y;
+            int sprite_row = nes->ppu.scanline+1 - sprite_y;
 
             if(attributes & 0b10000000) { 
                 sprite_row = sprite_row % 8;
                 sprite_row = 7 - sprite_row;
-                if(scanline+1 - sprite_y < 8) {
+                if(nes->ppu.scanline+1 - sprite_y < 8) {
                     sprite_row += 16;
                 }
             }
-            sprite_lower = read_vram((0x10 * pattern_index) + pattern_table_addr + sprite_row);
-            sprite_upper = read_vram((0x10 * pattern_index) + pattern_table_addr  + 8 + sprite_row);
+            sprite_lower = read_vram(nes, (0x10 * pattern_index) + pattern_table_addr + sprite_row);
+            sprite_upper = read_vram(nes, (0x10 * pattern_index) + pattern_table_addr  + 8 + sprite_row);
         }
         else {  // 8x8 sprites
 
-            pattern_table_addr = (ppu_reg[PPUCTRL] & SPRITE_PATTERN_TABLE_BIT) ? 0x1000 : 0x0000;
-            int sprite_row = scanline+1 - sprite_y;
+            pattern_table_addr = (nes->ppu.ppu_reg[PPUCTRL] & SPRITE_PATTERN_TABLE_BIT) ? 0x1000 : 0x0000;
+            int sprite_row = nes->ppu.scanline+1 - sprite_y;
             if(attributes & 0b10000000) {
                 sprite_row = 7 - sprite_row;
             }
-            sprite_lower = read_vram((0x10 * pattern_index) + pattern_table_addr + sprite_row);
-            sprite_upper = read_vram((0x10 * pattern_index) + pattern_table_addr  + 8 + sprite_row);
+            sprite_lower = read_vram(nes, (0x10 * pattern_index) + pattern_table_addr + sprite_row);
+            sprite_upper = read_vram(nes, (0x10 * pattern_index) + pattern_table_addr  + 8 + sprite_row);
         }
 
         int palette_id = attributes & 0b11;
@@ -406,51 +435,50 @@ void Draw_Sprites() {
                     val += ((sprite_upper >> (7-pixel)) & 0b1) << 1;
                 }
 
-                color = palette[read_vram(palette_addr + val)];
-                
-                if(sprite_x + pixel < 0xff && sprite_y < 0xff) {
-                    if(sprite_priority[scanline+1][sprite_x+pixel] == 0) {
-                        frame_buffer[scanline+1][sprite_x+pixel] = 0xff000000 + (color.r << 16);
-                        frame_buffer[scanline+1][sprite_x+pixel] += (color.g << 8);
-                        frame_buffer[scanline+1][sprite_x+pixel] += (color.b);
+                if(sprite_x + pixel < 0xff && sprite_y < 0xff && !nes->skip_render) {
+                    if(nes->sprite_priority[nes->ppu.scanline+1][sprite_x+pixel] == 0) {
+                        color = palette[read_vram(nes, palette_addr + val)];
+                        nes->frame_buffer[nes->ppu.scanline+1][sprite_x+pixel] = 0xff000000 + (color.r << 16);
+                        nes->frame_buffer[nes->ppu.scanline+1][sprite_x+pixel] += (color.g << 8);
+                        nes->frame_buffer[nes->ppu.scanline+1][sprite_x+pixel] += (color.b);
                     }
                 }
 
-                if(!(attributes & 0b00100000) && val > 0 || sprite_priority[scanline+1][sprite_x+pixel] == 1)
-                    sprite_priority[scanline+1][sprite_x+pixel] = 1;
+                if(!(attributes & 0b00100000) && val > 0 || nes->sprite_priority[nes->ppu.scanline+1][sprite_x+pixel] == 1)
+                    nes->sprite_priority[nes->ppu.scanline+1][sprite_x+pixel] = 1;
                 else if ((attributes & 0b00100000) && val > 0) {
-                    sprite_priority[scanline+1][sprite_x+pixel] = 2;
+                    nes->sprite_priority[nes->ppu.scanline+1][sprite_x+pixel] = 2;
                 }
                 else
-                    sprite_priority[scanline+1][sprite_x+pixel] = 0;
+                    nes->sprite_priority[nes->ppu.scanline+1][sprite_x+pixel] = 0;
             }
         }
     }
 }
 
-void Draw_Nametable() {
+void Draw_Nametable(nes_machine* nes) {
 
     SDL_Color color;
 
     /*
     Read pattern table id from nametable to find sprite
     */
-    int NAME_TABLE_ID = ppu_reg[0] & NAME_TABLE_1_BIT ? 1 : 0;
-    int section = (dot/8) * 8;
-    int pattern_id = peek_vram(0x2000 | (ppu_address & 0xfff));
+    int NAME_TABLE_ID = nes->ppu.ppu_reg[0] & NAME_TABLE_1_BIT ? 1 : 0;
+    int section = (nes->ppu.dot/8) * 8;
+    int pattern_id = peek_vram(nes, 0x2000 | (nes->ppu.ppu_address & 0xfff));
 
     /*
     Calculate address in VRAM of sprite and then the byte
     needed for the current scanline. One bit of each pixel
     is stored in seperate bytes.
     */
-    int pattern_table_addr = (ppu_reg[PPUCTRL] & BACKGROUND_PATTERN_TABLE_BIT) ? 0x1000 : 0x0000;
+    int pattern_table_addr = (nes->ppu.ppu_reg[PPUCTRL] & BACKGROUND_PATTERN_TABLE_BIT) ? 0x1000 : 0x0000;
     int pattern_addr = pattern_id * 0x10;
     pattern_addr += pattern_table_addr;
-    pattern_addr += scanline % 8;
+    pattern_addr += nes->ppu.scanline % 8;
 
-    uint8_t pattern_byte = peek_vram(pattern_addr);
-    uint8_t pattern_byte_2 = peek_vram(pattern_addr + 8);
+    uint8_t pattern_byte = peek_vram(nes, pattern_addr);
+    uint8_t pattern_byte_2 = peek_vram(nes, pattern_addr + 8);
 
     for(int i = 0; i < 8; i++) { 
 
@@ -458,141 +486,175 @@ void Draw_Nametable() {
         Each pixel is assigned a 2-bit value (0-3). The value is matched to one of
         four colours from a colour palette.
         */
+        uint8_t value = (pattern_byte >> (7-(i%8))) & 0b1;
+        value += ((pattern_byte_2 >> (7-(i%8))) & 0b1) << 1;
 
-        int palette_tile_x = dot / 32;
-        int palette_tile_y = scanline / 32;
-        int quadrant = (dot % 32) < 16 ? 0b0 : 0b1;
-        quadrant += (scanline % 32) < 16 ? 0b00 : 0b10;
+        if(nes->sprite_priority[nes->ppu.scanline][section+i] == 0 || (nes->sprite_priority[nes->ppu.scanline][section+i] == 2 && value > 0)) {
+            if(nes->skip_render)
+                continue;
+        }
+        else {
+            if(value > 0 && !(nes->ppu.ppu_reg[PPUSTATUS] & S0_HIT_BIT) && nes->ppu.render_s0) {
+                //printf("SPRITE 0 HIT at frame [%d] line [%d]\n", frame, scanline);
+                nes->ppu.ppu_reg[PPUSTATUS] |= S0_HIT_BIT; 
+            }
+            continue;
+        }
+
+        int palette_tile_x = nes->ppu.dot / 32;
+        int palette_tile_y = nes->ppu.scanline / 32;
+        int quadrant = (nes->ppu.dot % 32) < 16 ? 0b0 : 0b1;
+        quadrant += (nes->ppu.scanline % 32) < 16 ? 0b00 : 0b10;
         
         uint16_t attr_addr = 0x23c0 + palette_tile_x + (8 * palette_tile_y);
         //uint16_t attr_addr = 0x23c0 | (ppu_address & 0x0c00) | ((ppu_address >> 4) & 0x38) | ((ppu_address >> 2) & 0x07);
 
-        uint8_t palette_id = read_vram(attr_addr);
+        uint8_t palette_id = read_vram(nes, attr_addr);
         palette_id = (palette_id >> (2 * quadrant)) & 0b11;
         uint16_t palette_addr = 0x3f00 + (4*palette_id);
-    
-        uint8_t value = (pattern_byte >> (7-(i%8))) & 0b1;
-        value += ((pattern_byte_2 >> (7-(i%8))) & 0b1) << 1;
 
         if(value == 0)
-            color = palette[read_vram(0x3f00)];
+            color = palette[read_vram(nes, 0x3f00)];
         else
-            color = palette[read_vram(palette_addr + value)];
+            color = palette[read_vram(nes, palette_addr + value)];
 
-        if(sprite_priority[scanline][section+i] == 0 || (sprite_priority[scanline][section+i] == 2 && value > 0)) {
-            frame_buffer[scanline][section+i] = 0xff000000 + (color.r << 16);
-            frame_buffer[scanline][section+i] += (color.g << 8);
-            frame_buffer[scanline][section+i] += (color.b);
-        }
-        else {
-            if(value > 0 && !(ppu_reg[PPUSTATUS] & S0_HIT_BIT) && render_s0) {
-                //printf("SPRITE 0 HIT at frame [%d] line [%d]\n", frame, scanline);
-                ppu_reg[PPUSTATUS] |= S0_HIT_BIT; 
-            }
-        }
+        nes->frame_buffer[nes->ppu.scanline][section+i] = 0xff000000 + (color.r << 16);
+        nes->frame_buffer[nes->ppu.scanline][section+i] += (color.g << 8);
+        nes->frame_buffer[nes->ppu.scanline][section+i] += (color.b);
     }
 }
 
-void OAM_DMA(uint8_t data) {
-
-    uint16_t ram_addr = 0x100 * data;
-    uint8_t oam_addr = ppu_reg[OAMADDR];
+/*
+$4014: a page into OAM from OAMADDR on, wrapping, which leaves OAMADDR
+where it was. ram, prg ram and rom pages are one block of memory so they
+are copied in one go; registers and the expansion area are read a byte
+at a time for their side effects, as is everything while the bus is
+traced. the cpu is halted for 513 cycles, 514 from an odd one
+*/
+void OAM_DMA(nes_machine* nes, uint8_t data) {
 
-    for(int i = 0; oam_addr + i < 256; i++) { 
+    uint16_t page = data << 8;
+    uint8_t oam_addr = nes->ppu.ppu_reg[OAMADDR];
+    uint8_t* oam = nes->ppu.OAM_memory;
 
-        //printf("Writing %02x to OAM[0x%02x]\n", read(ram_addr + i), oam_addr + i);
-        OAM_memory[oam_addr + i] = read(ram_addr + i);
+    if((page < 0x2000 || page >= 0x6000) && !nes->trace) {
+        const uint8_t* source = memory_map(nes, page);
+        memcpy(oam + oam_addr, source, 256 - oam_addr);
+        memcpy(oam, source + (256 - oam_addr), oam_addr);
+    }
+    else {
+        for(int i = 0; i < 256; i++)
+            oam[(oam_addr + i) & 0xff] = read(nes, page + i);
     }
+
+    nes->sprites.dirty = true;
+    nes->cpu.stall += 513;
+    nes->cpu.stall_align = true;
 }
 
-void clear_OAM(void) {
+void clear_OAM(nes_machine* nes) {
 
     for(int i = 0; i < 8*4; i++) {
-        OAM_memory_secondary[i] = 0xff;
+        nes->ppu.OAM_memory_secondary[i] = 0xff;
     }
 }
 
-void sprite_eval() {
+/*
+a sprite at OAM y covers lines y+1 on, 8 or 16 of them. y 0 and anything
+starting below the screen never shows
+*/
+static void build_sprite_lines(nes_machine* nes) {
+
+    sprite_lines* sprites = &nes->sprites;
+    int height = (nes->ppu.ppu_reg[PPUCTRL] & SPRITE_HEIGHT_BIT) ? 16 : 8;
 
-    int n = 0; 
+    memset(sprites->count, 0, sizeof(sprites->count));
     for(int i = 0; i < 64; i++) {
+        int top = nes->ppu.OAM_memory[i*4] - 1;
+        if(top < 0 || top >= 240)
+            continue;
+
+        for(int line = top; line < top + height && line < 240; line++) {
+            if(sprites->count[line] < 8)
+                sprites->index[line][sprites->count[line]] = i;
+            if(sprites->count[line] < 9)
+                sprites->count[line]++;
+        }
+    }
+    sprites->dirty = false;
+}
 
-        int height_offset = 7;
-        if(ppu_reg[PPUCTRL] & SPRITE_HEIGHT_BIT)
-            height_offset = 15;
-        
-        if((OAM_memory[i*4]) > 0 && (OAM_memory[i*4]-1) <= scanline && (OAM_memory[i*4]-1)+height_offset >= scanline && (OAM_memory[i*4]-1) < 240) {
+void sprite_eval(nes_machine* nes) {
 
-            if(n == 8) {
-                ppu_reg[PPUSTATUS] |= SPRITE_OVERFLOW_BIT;
-            }
-            else {
-                
-                if(i == 0 && !render_s0) {
-                    render_s0 = 1;
-                }
+    if(nes->sprites.dirty)
+        build_sprite_lines(nes);
 
-                OAM_memory_secondary[(n*4)] = OAM_memory[(i*4)];
-                OAM_memory_secondary[(n*4) + 1] = OAM_memory[(i*4) + 1];
-                OAM_memory_secondary[(n*4) + 2] = OAM_memory[(i*4) + 2];
-                OAM_memory_secondary[(n*4) + 3] = OAM_memory[(i*4) + 3];
-                n++;
-            }
-        }
+    int line = nes->ppu.scanline;
+    int n = nes->sprites.count[line];
+    if(n > 8) {
+        nes->ppu.ppu_reg[PPUSTATUS] |= SPRITE_OVERFLOW_BIT;
+        n = 8;
     }
-}
 
-void clear_frame_buffer() {
-    for (int i = 0; i < 256; i++) {
-        for (int j = 0; j< 240; j++) {
-            frame_buffer[j][i] = 0;
-            sprite_priority[j][i] = 0;
+    for(int k = 0; k < n; k++) {
+        int i = nes->sprites.index[line][k];
+        if(i == 0 && !nes->ppu.render_s0) {
+            nes->ppu.render_s0 = 1;
         }
+        memcpy(nes->ppu.OAM_memory_secondary + (k*4), nes->ppu.OAM_memory + (i*4), 4);
     }
 }
 
-void dump_OAM() {
+void clear_frame_buffer(nes_machine* nes) {
+
+    // sprite priority is still needed for sprite 0 hits when not rendering
+    memset(nes->sprite_priority, 0, sizeof(nes->sprite_priority));
+    if(!nes->skip_render)
+        memset(nes->frame_buffer, 0, sizeof(uint32_t) * 240 * 256);
+}
+
+void dump_OAM(nes_machine* nes) {
     
     printf("OAM MEMORY:\n");
     for (int i = 0; i < 256; i+=4) {
-        printf("SPRITE[%d]   %02x %02x %02x %02x\n", i/4, OAM_memory[i+0], OAM_memory[i+1], OAM_memory[i+2], OAM_memory[i+3]);
+        printf("SPRITE[%d]   %02x %02x %02x %02x\n", i/4, nes->ppu.OAM_memory[i+0], nes->ppu.OAM_memory[i+1], nes->ppu.OAM_memory[i+2], nes->ppu.OAM_memory[i+3]);
     }
     printf("\n");
 }
 
-void dump_OAM_secondary() {
+void dump_OAM_secondary(nes_machine* nes) {
     
     printf("SECONDARY OAM MEMORY:\n");
     for (int i = 0; i < 64; i+=4) {
-        printf("SPRITE[%d]   %02x %02x %02x %02x\n", i/4, OAM_memory_secondary[i+0], OAM_memory_secondary[i+1], OAM_memory_secondary[i+2], OAM_memory_secondary[i+3]);
+        printf("SPRITE[%d]   %02x %02x %02x %02x\n", i/4, nes->ppu.OAM_memory_secondary[i+0], nes->ppu.OAM_memory_secondary[i+1], nes->ppu.OAM_memory_secondary[i+2], nes->ppu.OAM_memory_secondary[i+3]);
     }
     printf("\n");
 }
 
-void increment_hori() {
+void increment_hori(nes_machine* nes) {
     
-    if(rendering_enabled) {
-        if((ppu_address & 0x001f) == 31) {
-            ppu_address &= ~0x001f;
-            ppu_address ^= 0x0400;
+    if(nes->ppu.rendering_enabled) {
+        if((nes->ppu.ppu_address & 0x001f) == 31) {
+            nes->ppu.ppu_address &= ~0x001f;
+            nes->ppu.ppu_address ^= 0x0400;
         } else {
-            ppu_address++;
+            nes->ppu.ppu_address++;
         }
     }
 }
 
-void increment_vert() {
+void increment_vert(nes_machine* nes) {
 
-    if(rendering_enabled) {
-        if((ppu_address & 0x7000) != 0x7000) {
-            ppu_address += 0x1000;
+    if(nes->ppu.rendering_enabled) {
+        if((nes->ppu.ppu_address & 0x7000) != 0x7000) {
+            nes->ppu.ppu_address += 0x1000;
         }
         else {
-            ppu_address &= ~0x7000;
-            int y = (ppu_address & 0x03e0) >> 5;
+            nes->ppu.ppu_address &= ~0x7000;
+            int y = (nes->ppu.ppu_address & 0x03e0) >> 5;
             if(y == 29) {
                 y = 0;
-                ppu_address ^= 0x0800;
+                nes->ppu.ppu_address ^= 0x0800;
             }
             else if(y == 31) {
                 y = 0;
@@ -601,27 +663,27 @@ void increment_vert() {
                 y++;
             }
 
-            ppu_address = (ppu_address & ~0x03e0) | (y << 5);
+            nes->ppu.ppu_address = (nes->ppu.ppu_address & ~0x03e0) | (y << 5);
         }
     }
 }
 
-void copy_hori() {
+void copy_hori(nes_machine* nes) {
 
-    if(rendering_enabled) {
-        uint16_t temp_copy = ppu_address_temp;
+    if(nes->ppu.rendering_enabled) {
+        uint16_t temp_copy = nes->ppu.ppu_address_temp;
         temp_copy &= 0b10000011111;
-        ppu_address &= ~0b000010000011111;
-        ppu_address |= temp_copy;
+        nes->ppu.ppu_address &= ~0b000010000011111;
+        nes->ppu.ppu_address |= temp_copy;
     }
 }
 
-void copy_vert() {
+void copy_vert(nes_machine* nes) {
 
-    if(rendering_enabled) {
-        uint16_t temp_copy = ppu_address_temp;
+    if(nes->ppu.rendering_enabled) {
+        uint16_t temp_copy = nes->ppu.ppu_address_temp;
         temp_copy &= 0b111101111100000;
-        ppu_address &= ~0b111101111100000;
-        ppu_address |= temp_copy;
+        nes->ppu.ppu_address &= ~0b111101111100000;
+        nes->ppu.ppu_address |= temp_copy;
     }
 }
\ No newline at end of file
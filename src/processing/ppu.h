@@ -1,30 +1,26 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-extern unsigned char ppu_reg[8];
-extern bool pause;
-extern int steps;
-extern int scanline;
-extern int dot;
-extern uint32_t frame_buffer[240][256];
-extern int NMI;
-extern uint16_t ppu_address;
+#include "../machine.h"
 
-void Update_PPU();
-unsigned char read_ppu(uint16_t addr);
-void write_ppu(uint16_t addr, unsigned char data);
-void OAM_DMA(uint8_t data);
+void Update_PPU(nes_machine* nes);
+unsigned char read_ppu(nes_machine* nes, uint16_t addr);
+void write_ppu(nes_machine* nes, uint16_t addr, unsigned char data);
+void OAM_DMA(nes_machine* nes, uint8_t data);
 
-void Draw_Scanline();
-void Draw_Nametable();
-void Draw_Sprites();
-void clear_OAM();
-void sprite_eval();
-void clear_frame_buffer();
-void dump_OAM();
-void dump_OAM_secondary();
+void Draw_Scanline(nes_machine* nes);
+void Draw_Nametable(nes_machine* nes);
+void Draw_Sprites(nes_machine* nes);
+void clear_OAM(nes_machine* nes);
+void sprite_eval(nes_machine* nes);
+void clear_frame_buffer(nes_machine* nes);
+void dump_OAM(nes_machine* nes);
+void dump_OAM_secondary(nes_machine* nes);
 
-void increment_vert();
-void increment_hori();
-void copy_hori();
-void copy_vert();
\ No newline at end of file
+void increment_vert(nes_machine* nes);
+void increment_hori(nes_machine* nes);
+void copy_hori(nes_machine* nes);
+void copy_vert(nes_machine* nes);
+
+void update_a12_rise_dot(nes_machine* nes);
+void a12_edge(nes_machine* nes, uint16_t addr);
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include "resample.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__GNUC__) && defined(__SSE2__)
+#define RESAMPLE_AVX2 // built in whatever the flags, used when the cpu has it
+#include <immintrin.h>
+#endif
+
+#define PHASE_BITS 8 // log2 RESAMPLE_PHASES
+#define PASSBAND 0.92 // of the lower nyquist, the rest is for the filter to roll off
+
+/*
+blackman windowed sinc, a row per phase, each adding up to one so the
+level does not ripple with the phase
+*/
+static float* build_filters(double cutoff) {
+
+    float* filters = aligned_alloc(32, sizeof(float) * (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS);
+    if(!filters)
+        return NULL;
+
+    for(int p = 0; p <= RESAMPLE_PHASES; p++) {
+        float* row = filters + p * RESAMPLE_TAPS;
+        double raw[RESAMPLE_TAPS];
+        double total = 0;
+        for(int j = 0; j < RESAMPLE_TAPS; j++) {
+            double t = j - (RESAMPLE_TAPS / 2 - 1) - (double)p / RESAMPLE_PHASES;
+            double x = M_PI * t / (RESAMPLE_TAPS / 2);
+            double window = 0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);
+            double sinc = t == 0 ? 1 : sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+            raw[j] = sinc * window;
+            total += raw[j];
+        }
+        for(int j = 0; j < RESAMPLE_TAPS; j++)
+            row[j] = raw[j] / total;
+    }
+    return filters;
+}
+
+/*
+the input against two neighbouring filters at once, it is loaded once
+for both
+*/
+static void dot_two(const float* input, const float* a, const float* b, float* sum_a, float* sum_b) {
+
+    float total_a = 0;
+    float total_b = 0;
+    for(int j = 0; j < RESAMPLE_TAPS; j++) {
+        total_a += input[j] * a[j];
+        total_b += input[j] * b[j];
+    }
+    *sum_a = total_a;
+    *sum_b = total_b;
+}
+
+#ifdef RESAMPLE_AVX2
+static inline void sum_pairs(__m128 half_a, __m128 half_b, float* sum_a, float* sum_b) {
+
+    // both horizontal sums in one go: a0+a2 a1+a3 b0+b2 b1+b3
+    __m128 pairs = _mm_add_ps(_mm_movelh_ps(half_a, half_b), _mm_movehl_ps(half_b, half_a));
+    pairs = _mm_add_ps(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1)));
+    *sum_a = _mm_cvtss_f32(pairs);
+    *sum_b = _mm_cvtss_f32(_mm_movehl_ps(pairs, pairs));
+}
+
+static void dot_two_sse2(const float* input, const float* a, const float* b, float* sum_a, float* sum_b) {
+
+    __m128 half_a = _mm_setzero_ps();
+    __m128 half_b = _mm_setzero_ps();
+    for(int j = 0; j < RESAMPLE_TAPS; j += 4) {
+        __m128 x = _mm_loadu_ps(input + j);
+        half_a = _mm_add_ps(half_a, _mm_mul_ps(x, _mm_load_ps(a + j)));
+        half_b = _mm_add_ps(half_b, _mm_mul_ps(x, _mm_load_ps(b + j)));
+    }
+    sum_pairs(half_a, half_b, sum_a, sum_b);
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_two_avx2(const float* input, const float* a, const float* b, float* sum_a, float* sum_b) {
+
+    __m256 total_a = _mm256_setzero_ps();
+    __m256 total_b = _mm256_setzero_ps();
+    for(int j = 0; j < RESAMPLE_TAPS; j += 8) {
+        __m256 x = _mm256_loadu_ps(input + j);
+        total_a = _mm256_fmadd_ps(x, _mm256_load_ps(a + j), total_a);
+        total_b = _mm256_fmadd_ps(x, _mm256_load_ps(b + j), total_b);
+    }
+    __m128 half_a = _mm_add_ps(_mm256_castps256_ps128(total_a), _mm256_extractf128_ps(total_a, 1));
+    __m128 half_b = _mm_add_ps(_mm256_castps256_ps128(total_b), _mm256_extractf128_ps(total_b, 1));
+    sum_pairs(half_a, half_b, sum_a, sum_b);
+}
+#endif
+
+static resample_dot pick_dot(void) {
+
+#ifdef RESAMPLE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return dot_two_avx2;
+    return dot_two_sse2;
+#else
+    return dot_two;
+#endif
+}
+
+bool Init_Resampler(resampler* resampler, double input_rate, double output_rate) {
+
+    memset(resampler, 0, sizeof(*resampler));
+    resampler->dot = pick_dot();
+    return Resampler_Set_Rates(resampler, input_rate, output_rate);
+}
+
+void Shut_Down_Resampler(resampler* resampler) {
+
+    free(resampler->filters);
+    resampler->filters = NULL;
+}
+
+/*
+can be called between any two Resample() calls. false if a new table was
+needed and there was no memory for it, the old one stays
+*/
+bool Resampler_Set_Rates(resampler* resampler, double input_rate, double output_rate) {
+
+    double cutoff = 0.5 * PASSBAND * (output_rate < input_rate ? output_rate / input_rate : 1);
+    if(!resampler->filters || fabs(cutoff - resampler->cutoff) > resampler->cutoff * 0.01) {
+        float* filters = build_filters(cutoff);
+        if(!filters)
+            return false;
+        free(resampler->filters);
+        resampler->filters = filters;
+        resampler->cutoff = cutoff;
+    }
+
+    resampler->input_rate = input_rate;
+    resampler->output_rate = output_rate;
+    resampler->step = (uint64_t)(input_rate / output_rate * 4294967296.0);
+    return true;
+}
+
+static int16_t to_sample(float value) {
+
+    long sample = lrintf(value);
+    if(sample > 32767)
+        sample = 32767;
+    if(sample < -32768)
+        sample = -32768;
+    return sample;
+}
+
+/*
+every output sample whose taps are all in, then the used input goes
+*/
+static int run_block(resampler* resampler, int16_t* output, bool linear) {
+
+    int produced = 0;
+    int reach = linear ? 2 : RESAMPLE_TAPS;
+    while((int)(resampler->position >> 32) + reach <= resampler->input_count) {
+        const float* input = resampler->input + (resampler->position >> 32);
+        uint32_t fraction = (uint32_t)resampler->position;
+
+        if(linear) {
+            float mix = fraction * (1.0f / 4294967296.0f);
+            output[produced++] = to_sample(input[0] + (input[1] - input[0]) * mix);
+        }
+        else {
+            const float* filter = resampler->filters + (fraction >> (32 - PHASE_BITS)) * RESAMPLE_TAPS;
+            float mix = (fraction & ((1 << (32 - PHASE_BITS)) - 1)) * (1.0f / (1 << (32 - PHASE_BITS)));
+            float here, next;
+            resampler->dot(input, filter, filter + RESAMPLE_TAPS, &here, &next);
+            output[produced++] = to_sample(here + (next - here) * mix);
+        }
+        resampler->position += resampler->step;
+    }
+
+    int used = resampler->position >> 32;
+    if(used > resampler->input_count)
+        used = resampler->input_count;
+    memmove(resampler->input, resampler->input + used, sizeof(float) * (resampler->input_count - used));
+    resampler->input_count -= used;
+    resampler->position -= (uint64_t)used << 32;
+    return produced;
+}
+
+static int run(resampler* resampler, const int16_t* input, int count, int16_t* output, bool linear) {
+
+    int produced = 0;
+    while(count > 0) {
+        int room = RESAMPLE_BUFFER + RESAMPLE_TAPS - resampler->input_count;
+        int take = count < room ? count : room;
+        for(int i = 0; i < take; i++)
+            resampler->input[resampler->input_count + i] = input[i];
+        resampler->input_count += take;
+        input += take;
+        count -= take;
+
+        produced += run_block(resampler, output + produced, linear);
+    }
+    return produced;
+}
+
+/*
+takes all of the input, returns how many samples came out. output needs
+room for count * output_rate / input_rate + 2 of them. the output lags
+the input by RESAMPLE_TAPS / 2 samples
+*/
+int Resample(resampler* resampler, const int16_t* input, int count, int16_t* output) {
+
+    return run(resampler, input, count, output, false);
+}
+
+// -- bench --
+
+/*
+total harmonic distortion plus noise: whatever is left of the output
+after taking out the tone (and dc) it should be, against the tone
+*/
+static double thd_n(const int16_t* samples, int count, double frequency, double rate) {
+
+    // least squares over the 1, cos, sin basis, the tone is many periods long so they are near orthogonal
+    double w = 2 * M_PI * frequency / rate;
+    double mean = 0, c = 0, s = 0, cc = 0, ss = 0;
+    for(int i = 0; i < count; i++)
+        mean += samples[i];
+    mean /= count;
+    for(int i = 0; i < count; i++) {
+        c += (samples[i] - mean) * cos(w * i);
+        s += (samples[i] - mean) * sin(w * i);
+        cc += cos(w * i) * cos(w * i);
+        ss += sin(w * i) * sin(w * i);
+    }
+
+    double signal = 0, residue = 0;
+    for(int i = 0; i < count; i++) {
+        double tone = c / cc * cos(w * i) + s / ss * sin(w * i);
+        double error = samples[i] - mean - tone;
+        signal += tone * tone;
+        residue += error * error;
+    }
+    return 10 * log10(residue / signal);
+}
+
+static double seconds_since(struct timespec* begin) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--resample-bench: 48 kHz tones to each host rate, fed a frame at a time
+as the apu makes them. speed as times real time, quality as thd+n
+*/
+int Run_Resample_Bench(double seconds) {
+
+    const double input_rate = 48000;
+    const double output_rates[3] = {44100, 48000, 96000};
+    const double tones[2] = {1000, 10000};
+    const int frame = 800;
+
+    int count = input_rate * seconds;
+    int16_t* input = malloc(sizeof(int16_t) * count);
+    int16_t* output = malloc(sizeof(int16_t) * (count * 2 + 16));
+    if(!input || !output) {
+        free(input);
+        free(output);
+        return 1;
+    }
+
+    for(int r = 0; r < 3; r++) {
+        for(int mode = 0; mode < 2; mode++) {
+            bool linear = mode == 1;
+            printf("%5.0f Hz %-9s", output_rates[r], linear ? "linear" : "polyphase");
+
+            for(int t = 0; t < 2; t++) {
+                for(int i = 0; i < count; i++)
+                    input[i] = lrint(16000 * sin(2 * M_PI * tones[t] * i / input_rate));
+
+                resampler resampler;
+                if(!Init_Resampler(&resampler, input_rate, output_rates[r])) {
+                    free(input);
+                    free(output);
+                    return 1;
+                }
+
+                struct timespec begin;
+                clock_gettime(CLOCK_MONOTONIC, &begin);
+                int produced = 0;
+                for(int i = 0; i < count; i += frame)
+                    produced += run(&resampler, input + i, count - i < frame ? count - i : frame, output + produced, linear);
+                double elapsed = seconds_since(&begin);
+                Shut_Down_Resampler(&resampler);
+
+                // a second of it, past the filter filling up
+                int window = produced - RESAMPLE_TAPS < output_rates[r] ? produced - RESAMPLE_TAPS : output_rates[r];
+                printf("  %5.0f Hz: %6.0fx realtime, thd+n %6.1f dB", tones[t], seconds / elapsed,
+                    thd_n(output + RESAMPLE_TAPS, window, tones[t], output_rates[r]));
+            }
+            printf("\n");
+        }
+    }
+
+    free(input);
+    free(output);
+    return 0;
+}
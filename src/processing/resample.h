@@ -0,0 +1,43 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESAMPLE_TAPS 32 // input samples per output sample
+#define RESAMPLE_PHASES 256 // filters per input sample, interpolated in between
+#define RESAMPLE_BUFFER 4096 // input held at once, past the taps
+
+typedef void (*resample_dot)(const float* input, const float* a, const float* b, float* sum_a, float* sum_b);
+
+/*
+polyphase fir from one rate to another. every output sample is the dot
+product of the input around it with the filter for where it falls between
+two input samples, out of a table of RESAMPLE_PHASES of them made for the
+ratio. small changes of the ratio (rate control) only change the step,
+the table is made again when the cutoff would move by more than 1%.
+*/
+typedef struct resampler {
+
+    double input_rate;
+    double output_rate;
+    double cutoff; // the table's, in input samples, 0.5 is nyquist
+    float* filters; // RESAMPLE_PHASES + 1 rows of RESAMPLE_TAPS, 32 byte aligned
+    resample_dot dot; // the widest the cpu can run, picked in Init_Resampler
+
+    uint64_t step; // input samples per output sample, 32.32
+    uint64_t position; // of the next output sample, 32.32 input samples from input[0]
+    int input_count;
+    float input[RESAMPLE_BUFFER + RESAMPLE_TAPS];
+
+} resampler;
+
+bool Init_Resampler(resampler* resampler, double input_rate, double output_rate);
+void Shut_Down_Resampler(resampler* resampler);
+bool Resampler_Set_Rates(resampler* resampler, double input_rate, double output_rate);
+
+int Resample(resampler* resampler, const int16_t* input, int count, int16_t* output);
+
+int Run_Resample_Bench(double seconds);
+
+#endif
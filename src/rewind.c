@@ -0,0 +1,307 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rewind.h"
+#include "state.h"
+#include "memory/rom.h"
+#include "devices/controller.h"
+
+static uint8_t* put_varint(uint8_t* out, size_t value) {
+
+    while(value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static size_t get_varint(const uint8_t** in) {
+
+    size_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*in)++;
+        value |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
+/*
+xor of the new snapshot against the previous one, written as zero/literal
+word runs. most of ram, ciram and the mapper registers are untouched
+from one frame to the next so this is usually a few hundred bytes
+*/
+static size_t encode_delta(const uint64_t* next, const uint64_t* previous, size_t words, uint8_t* out) {
+
+    uint8_t* begin = out;
+    size_t i = 0;
+    while(i < words) {
+        size_t zero_start = i;
+        while(i < words && next[i] == previous[i])
+            i++;
+        size_t literal_start = i;
+        while(i < words && next[i] != previous[i])
+            i++;
+
+        out = put_varint(out, literal_start - zero_start);
+        out = put_varint(out, i - literal_start);
+        for(size_t j = literal_start; j < i; j++) {
+            uint64_t x = next[j] ^ previous[j];
+            memcpy(out, &x, 8);
+            out += 8;
+        }
+    }
+    return out - begin;
+}
+
+static void apply_delta(uint64_t* state, const uint8_t* in, size_t size) {
+
+    const uint8_t* end = in + size;
+    size_t i = 0;
+    while(in < end) {
+        i += get_varint(&in);
+        size_t literal = get_varint(&in);
+        for(size_t j = 0; j < literal; j++) {
+            uint64_t x;
+            memcpy(&x, in, 8);
+            state[i++] ^= x;
+            in += 8;
+        }
+    }
+}
+
+static rewind_entry* oldest_entry(rewind_buffer* history) {
+
+    return &history->entries[history->first];
+}
+
+static void drop_oldest(rewind_buffer* history) {
+
+    history->first = (history->first + 1) % history->max_entries;
+    history->count--;
+}
+
+/*
+reserve size bytes at the head of the arena, dropping whatever oldest
+history is in the way. returns NULL when a delta can never fit
+*/
+static uint8_t* arena_alloc(rewind_buffer* history, size_t size) {
+
+    if(size > history->capacity)
+        return NULL;
+
+    if(history->head + size > history->capacity) {
+        // the tail of the arena is given up, everything in it is older than anything at the start
+        while(history->count && oldest_entry(history)->offset >= history->head)
+            drop_oldest(history);
+        history->head = 0;
+    }
+    while(history->count) {
+        rewind_entry* oldest = oldest_entry(history);
+        if(oldest->offset >= history->head + size || oldest->offset + oldest->size <= history->head)
+            break;
+        drop_oldest(history);
+    }
+    if(history->count == history->max_entries)
+        drop_oldest(history);
+
+    rewind_entry* entry = &history->entries[(history->first + history->count) % history->max_entries];
+    entry->offset = history->head;
+    entry->size = size;
+    history->count++;
+
+    uint8_t* data = history->arena + history->head;
+    history->head += size;
+    return data;
+}
+
+rewind_buffer* Create_Rewind(nes_machine* nes, size_t budget, int interval) {
+
+    rewind_buffer* history = calloc(1, sizeof(rewind_buffer));
+    if(!history)
+        return NULL;
+
+    history->nes = nes;
+    history->state_size = State_Size(nes);
+    history->interval = interval > 0 ? interval : 1;
+
+    // the entry table comes out of the budget too. one per 64 bytes of arena, a frame's
+    // delta is rarely smaller and when they are the oldest are dropped a little early
+    // the arena always keeps room for one worst case delta, or nothing could be captured
+    size_t worst_delta = history->state_size * 2 + 16;
+    if(budget < worst_delta + sizeof(rewind_entry)) {
+        printf("Rewind budget of %zu bytes cannot hold one %zu byte delta\n", budget, worst_delta);
+        free(history);
+        return NULL;
+    }
+    history->max_entries = budget / (64 + sizeof(rewind_entry));
+    if(budget - (history->max_entries * sizeof(rewind_entry)) < worst_delta)
+        history->max_entries = (budget - worst_delta) / sizeof(rewind_entry);
+    history->capacity = budget - (history->max_entries * sizeof(rewind_entry));
+
+    history->current = malloc(history->state_size);
+    history->scratch = malloc(history->state_size);
+    history->delta = malloc(history->state_size * 2 + 16);
+    history->arena = malloc(history->capacity);
+    history->entries = calloc(history->max_entries, sizeof(rewind_entry));
+    if(!history->current || !history->scratch || !history->delta || !history->arena || !history->entries) {
+        Destroy_Rewind(history);
+        return NULL;
+    }
+
+    return history;
+}
+
+void Destroy_Rewind(rewind_buffer* history) {
+
+    if(!history)
+        return;
+
+    free(history->current);
+    free(history->scratch);
+    free(history->delta);
+    free(history->arena);
+    free(history->entries);
+    free(history);
+}
+
+/*
+call once per emulated frame, a snapshot is taken every interval frames
+*/
+void Rewind_Capture(rewind_buffer* history) {
+
+    if(++history->frames < history->interval)
+        return;
+    history->frames = 0;
+
+    Save_State(history->nes, history->scratch, history->state_size);
+
+    if(history->has_current) {
+        size_t size = encode_delta((uint64_t*)history->scratch, (uint64_t*)history->current,
+            history->state_size / 8, history->delta);
+
+        uint8_t* data = arena_alloc(history, size);
+        if(data) {
+            memcpy(data, history->delta, size);
+        }
+        else {
+            // every older delta is against the snapshot being replaced, none of them apply any more
+            history->count = 0;
+            history->head = 0;
+        }
+    }
+
+    uint8_t* swap = history->current;
+    history->current = history->scratch;
+    history->scratch = swap;
+    history->has_current = true;
+}
+
+/*
+go back one snapshot. if the machine has run past the newest snapshot it
+is first put back on it. false once the history is used up
+*/
+bool Rewind_Step(rewind_buffer* history) {
+
+    if(!history->has_current)
+        return false;
+
+    if(history->frames == 0) {
+        if(history->count == 0)
+            return false;
+
+        int newest = (history->first + history->count - 1) % history->max_entries;
+        rewind_entry* entry = &history->entries[newest];
+        apply_delta((uint64_t*)history->current, history->arena + entry->offset, entry->size);
+
+        history->count--;
+        history->head = entry->offset;
+    }
+    history->frames = 0;
+
+    return Load_State(history->nes, history->current, history->state_size);
+}
+
+/*
+Rewind_Step() with a picture: the snapshot's frame is run to draw it, then
+the machine goes back onto the snapshot. carrying on from there runs and
+records that frame again, nothing is skipped
+*/
+bool Rewind_Show_Step(rewind_buffer* history) {
+
+    if(!Rewind_Step(history))
+        return false;
+
+    Run_Frame(history->nes);
+    return Load_State(history->nes, history->current, history->state_size);
+}
+
+int Rewind_Seconds(rewind_buffer* history) {
+
+    return history->count * history->interval / 60;
+}
+
+/*
+--rewind-bench: capture cost against emulation cost, then rewind the
+whole history back
+*/
+int Run_Rewind_Bench(char* rom_path, int frames) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    rewind_buffer* history = nes ? Create_Rewind(nes, REWIND_BUDGET, 1) : NULL;
+    if(!history) {
+        Destroy_Rewind(history);
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    double emulate = 0, capture = 0;
+    struct timespec t0, t1, t2;
+    for(int f = 0; f < frames; f++) {
+        button_set(nes, (f / 8) & 0xff);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        Run_Frame(nes);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        Rewind_Capture(history);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        emulate += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        capture += (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+    }
+
+    size_t used = 0;
+    int snapshots = history->count;
+    for(int i = 0; i < snapshots; i++)
+        used += history->entries[(history->first + i) % history->max_entries].size;
+    printf("capture %.2f us/frame, %.2f%% of emulation, %.2f%% of a 60hz frame\n",
+        capture * 1e6 / frames, 100 * capture / emulate, 100 * capture * 60 / frames);
+    printf("%d snapshots (%d s) in %zu bytes, state %zu bytes\n",
+        snapshots, Rewind_Seconds(history), used, history->state_size);
+
+    int steps = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while(Rewind_Step(history))
+        steps++;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("rewound %d snapshots, %.2f us each\n", steps,
+        ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e6 / (steps ? steps : 1));
+
+    Destroy_Rewind(history);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return steps == snapshots ? 0 : 1;
+}
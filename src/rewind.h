@@ -0,0 +1,64 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "machine.h"
+
+#define REWIND_BUDGET (4 * 1024 * 1024) // arena and entry table together
+#define REWIND_INTERVAL 1 // frames between snapshots
+
+typedef struct rewind_entry {
+
+    uint32_t offset; // into the arena
+    uint32_t size;
+
+} rewind_entry;
+
+/*
+only the newest snapshot is kept whole. every older one is stored as the
+xor of it and the snapshot after it, with zero runs squeezed out, so
+stepping back is decoding one delta on top of the newest state. history
+lives in a fixed arena used as a ring, the oldest deltas are dropped as
+new ones need the space.
+
+delta format, in 8 byte words (states are always a multiple of 8):
+    varint zero words, varint literal words, literal words... repeated
+*/
+typedef struct rewind_buffer {
+
+    nes_machine* nes;
+    size_t state_size;
+
+    uint8_t* current; // newest snapshot, whole
+    uint8_t* scratch; // Save_State target
+    uint8_t* delta; // encode target, worst case size
+    bool has_current;
+
+    uint8_t* arena;
+    size_t capacity;
+    size_t head; // next write offset
+
+    rewind_entry* entries; // ring, oldest at first
+    int max_entries;
+    int first;
+    int count;
+
+    int interval;
+    int frames; // since the last snapshot
+
+} rewind_buffer;
+
+rewind_buffer* Create_Rewind(nes_machine* nes, size_t budget, int interval);
+void Destroy_Rewind(rewind_buffer* history);
+
+void Rewind_Capture(rewind_buffer* history);
+bool Rewind_Step(rewind_buffer* history);
+bool Rewind_Show_Step(rewind_buffer* history);
+int Rewind_Seconds(rewind_buffer* history);
+
+int Run_Rewind_Bench(char* rom_path, int frames);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "runahead.h"
+#include "state.h"
+#include "memory/rom.h"
+#include "devices/controller.h"
+
+/*
+only the last look-ahead frame is drawn, the ones before it just have to
+happen
+*/
+static void look_ahead(nes_machine* nes, int frames) {
+
+    // the real frame was already heard, these get rolled back
+    apu_output* audio = nes->audio;
+    nes->audio = NULL;
+    for(int i = 0; i < frames; i++) {
+        nes->skip_render = i < frames - 1;
+        Run_Frame(nes);
+    }
+    nes->skip_render = false;
+    nes->audio = audio;
+}
+
+static void* runahead_worker(void* arg) {
+
+    runahead* ahead = arg;
+
+    pthread_mutex_lock(&ahead->lock);
+    while(true) {
+        while(!ahead->pending && !ahead->quit)
+            pthread_cond_wait(&ahead->start, &ahead->lock);
+        if(ahead->quit)
+            break;
+        pthread_mutex_unlock(&ahead->lock);
+
+        Load_State(ahead->shadow, ahead->state, ahead->state_size);
+        look_ahead(ahead->shadow, ahead->frames);
+
+        pthread_mutex_lock(&ahead->lock);
+        ahead->pending = false;
+        pthread_cond_signal(&ahead->finished);
+    }
+    pthread_mutex_unlock(&ahead->lock);
+
+    return NULL;
+}
+
+static void wait_for_worker(runahead* ahead) {
+
+    pthread_mutex_lock(&ahead->lock);
+    while(ahead->pending)
+        pthread_cond_wait(&ahead->finished, &ahead->lock);
+    pthread_mutex_unlock(&ahead->lock);
+}
+
+runahead* Create_Runahead(nes_machine* nes, int frames, bool second_instance) {
+
+    runahead* ahead = calloc(1, sizeof(runahead));
+    if(!ahead)
+        return NULL;
+
+    ahead->nes = nes;
+    ahead->frames = frames < 0 ? 0 : frames > RUNAHEAD_MAX_FRAMES ? RUNAHEAD_MAX_FRAMES : frames;
+    ahead->state_size = State_Size(nes);
+    ahead->state = malloc(ahead->state_size);
+    if(!ahead->state) {
+        free(ahead);
+        return NULL;
+    }
+
+    if(second_instance) {
+        ahead->shadow = Create_Machine(nes->rom, NULL);
+        if(!ahead->shadow) {
+            Destroy_Runahead(ahead);
+            return NULL;
+        }
+
+        pthread_mutex_init(&ahead->lock, NULL);
+        pthread_cond_init(&ahead->start, NULL);
+        pthread_cond_init(&ahead->finished, NULL);
+        if(pthread_create(&ahead->thread, NULL, runahead_worker, ahead) != 0) {
+            Destroy_Runahead(ahead);
+            return NULL;
+        }
+        ahead->second_instance = true;
+    }
+
+    return ahead;
+}
+
+void Destroy_Runahead(runahead* ahead) {
+
+    if(!ahead)
+        return;
+
+    if(ahead->second_instance) {
+        pthread_mutex_lock(&ahead->lock);
+        ahead->quit = true;
+        pthread_cond_signal(&ahead->start);
+        pthread_mutex_unlock(&ahead->lock);
+        pthread_join(ahead->thread, NULL);
+
+        pthread_mutex_destroy(&ahead->lock);
+        pthread_cond_destroy(&ahead->start);
+        pthread_cond_destroy(&ahead->finished);
+    }
+
+    Destroy_Machine(ahead->shadow);
+    free(ahead->state);
+    free(ahead);
+}
+
+/*
+run the real frame (with whatever input is set on the machine now) and
+start the look-ahead from it. the real machine is back at vblank of its
+own frame when this returns, as after Run_Frame()
+*/
+void Runahead_Begin(runahead* ahead) {
+
+    nes_machine* nes = ahead->nes;
+    if(ahead->second_instance)
+        wait_for_worker(ahead);
+
+    nes->skip_render = ahead->frames > 0;
+    Run_Frame(nes);
+    nes->skip_render = false;
+
+    // stopped on a breakpoint, nothing to look ahead from
+    ahead->started = nes->ppu.frame_complete;
+    if(!ahead->started || ahead->frames == 0)
+        return;
+
+    Save_State(nes, ahead->state, ahead->state_size);
+
+    if(ahead->second_instance) {
+        pthread_mutex_lock(&ahead->lock);
+        ahead->pending = true;
+        pthread_cond_signal(&ahead->start);
+        pthread_mutex_unlock(&ahead->lock);
+        return;
+    }
+
+    look_ahead(nes, ahead->frames);
+    Load_State(nes, ahead->state, ahead->state_size);
+}
+
+/*
+the frame to present for the last Runahead_Begin, NULL if it stopped
+short of a finished frame
+*/
+uint32_t (*Runahead_End(runahead* ahead))[256] {
+
+    if(!ahead->started)
+        return NULL;
+
+    if(ahead->second_instance && ahead->frames > 0) {
+        wait_for_worker(ahead);
+        return ahead->shadow->frame_buffer;
+    }
+    return ahead->nes->frame_buffer;
+}
+
+static uint64_t frame_hash(uint32_t (*frame)[256]) {
+
+    uint64_t hash = 14695981039346656037ULL;
+    for(int y = 0; y < 240; y++) {
+        for(int x = 0; x < 256; x++) {
+            hash ^= frame[y][x];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+static double seconds_since(struct timespec* begin) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--runahead-bench: host frame cost of both variants against a plain run of
+the same input, and a check that they show the frames a plain run draws
+ahead_frames later (where the input did not change in between) while the
+real machine ends up exactly where the plain run does
+*/
+int Run_Runahead_Bench(char* rom_path, int frames, int ahead_frames) {
+
+    if(frames < 1 || ahead_frames < 0) {
+        printf("Runahead bench needs at least one frame and a non-negative lookahead\n");
+        return 1;
+    }
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    int total = frames + ahead_frames;
+    uint64_t* expected = malloc(sizeof(uint64_t) * total);
+    nes_machine* nes = Create_Machine(rom, NULL);
+    size_t state_size = nes ? State_Size(nes) : 0;
+    uint8_t* plain_state = nes ? malloc(state_size) : NULL;
+    uint8_t* state = nes ? malloc(state_size) : NULL;
+    if(!expected || !plain_state || !state) {
+        free(state);
+        free(plain_state);
+        free(expected);
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for(int f = 0; f < total; f++) {
+        button_set(nes, (f / 8) & 0xff);
+        Run_Frame(nes);
+        expected[f] = frame_hash(nes->frame_buffer);
+        if(f == frames - 1)
+            Save_State(nes, plain_state, state_size);
+    }
+    printf("plain: %.1f us/frame\n", seconds_since(&begin) * 1e6 / total);
+
+    int failed = 0;
+    for(int variant = 0; variant < 2; variant++) {
+
+        Reset_Machine(nes);
+        runahead* ahead = Create_Runahead(nes, ahead_frames, variant == 1);
+        if(!ahead) {
+            failed++;
+            continue;
+        }
+
+        int compared = 0, matched = 0;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for(int f = 0; f < frames; f++) {
+            button_set(nes, (f / 8) & 0xff);
+            Runahead_Begin(ahead);
+            uint32_t (*shown)[256] = Runahead_End(ahead);
+
+            if(shown && (f + ahead->frames) / 8 == f / 8) {
+                compared++;
+                matched += frame_hash(shown) == expected[f + ahead->frames];
+            }
+        }
+        double elapsed = seconds_since(&begin);
+
+        Save_State(nes, state, state_size);
+        bool same = memcmp(state, plain_state, state_size) == 0;
+        printf("%s, %d ahead: %.1f us/frame, future frames %d/%d, real machine %s\n",
+            variant ? "second instance" : "single instance", ahead->frames, elapsed * 1e6 / frames,
+            matched, compared, same ? "matches" : "DIFFERS");
+        failed += !same || matched != compared;
+
+        Destroy_Runahead(ahead);
+    }
+
+    free(state);
+    free(plain_state);
+    free(expected);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return failed ? 1 : 0;
+}
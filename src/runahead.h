@@ -0,0 +1,54 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "machine.h"
+
+#define RUNAHEAD_MAX_FRAMES 4
+
+/*
+run-ahead hides the frames of lag a game adds between reading the pad and
+drawing the result. every host frame the real machine runs one frame
+without rendering, then a copy of its state is run frames further with
+only the last one rendered, and that future frame is what gets shown.
+
+single instance: the look-ahead runs on the real machine, which is then
+rolled back with Load_State.
+second instance: a shadow machine loads the real one's state and runs
+the look-ahead on a worker thread, the real machine is never rolled back
+and the caller can do its own work between Begin and End.
+*/
+typedef struct runahead {
+
+    nes_machine* nes;
+    int frames;
+
+    uint8_t* state;
+    size_t state_size;
+    bool started; // a frame was run by Runahead_Begin and can be shown
+
+    // second instance
+    bool second_instance;
+    nes_machine* shadow;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    bool pending;
+    bool quit;
+
+} runahead;
+
+runahead* Create_Runahead(nes_machine* nes, int frames, bool second_instance);
+void Destroy_Runahead(runahead* ahead);
+
+void Runahead_Begin(runahead* ahead);
+uint32_t (*Runahead_End(runahead* ahead))[256];
+
+int Run_Runahead_Bench(char* rom_path, int frames, int ahead_frames);
+
+#endif
@@ -0,0 +1,584 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "search.h"
+#include "../state.h"
+#include "../devices/controller.h"
+
+/*
+the branches tried from every state. bit n = button n, see button_set()
+*/
+static const uint8_t default_actions[] = {
+    0x00, // nothing
+    0x01, // A
+    0x02, // B
+    0x10, // up
+    0x20, // down
+    0x40, // left
+    0x80, // right
+    0x81, // right + A
+    0x41, // left + A
+    0x08  // start
+};
+static const char* action_names[] = {".", "A", "B", "U", "D", "L", "R", "RA", "LA", "S"};
+
+/*
+expression parser
+*/
+typedef struct parser {
+
+    const char* at;
+    search_expression* out;
+    int depth; // stack depth of the code emitted so far
+    int max_depth;
+    bool failed;
+
+} parser;
+
+typedef struct operator_token {
+
+    const char* token;
+    search_op op;
+    int level; // 0 binds loosest
+
+} operator_token;
+
+// longest tokens first so "<<" is not read as "<"
+static const operator_token operators[] = {
+    {"||", OP_LOR, 0}, {"&&", OP_LAND, 1},
+    {"==", OP_EQ, 5}, {"!=", OP_NE, 5}, {"<=", OP_LE, 6}, {">=", OP_GE, 6},
+    {"<<", OP_SHL, 7}, {">>", OP_SHR, 7},
+    {"|", OP_OR, 2}, {"^", OP_XOR, 3}, {"&", OP_AND, 4},
+    {"<", OP_LT, 6}, {">", OP_GT, 6},
+    {"+", OP_ADD, 8}, {"-", OP_SUB, 8},
+    {"*", OP_MUL, 9}, {"/", OP_DIV, 9}, {"%", OP_MOD, 9}
+};
+#define OPERATOR_LEVELS 10
+
+static void emit(parser* p, search_op op, int64_t value) {
+
+    if(p->out->length == SEARCH_MAX_PROGRAM) {
+        p->failed = true;
+        return;
+    }
+
+    if(op == OP_CONST)
+        p->depth++;
+    else if(op >= OP_MUL)
+        p->depth--;
+    if(p->depth > p->max_depth)
+        p->max_depth = p->depth;
+
+    p->out->program[p->out->length++] = (search_instruction) {op, value};
+}
+
+static void skip_space(parser* p) {
+
+    while(isspace((unsigned char)*p->at))
+        p->at++;
+}
+
+static bool accept(parser* p, const char* token) {
+
+    skip_space(p);
+    size_t length = strlen(token);
+    if(strncmp(p->at, token, length) != 0)
+        return false;
+    p->at += length;
+    return true;
+}
+
+static void parse_binary(parser* p, int level);
+
+static void parse_primary(parser* p) {
+
+    skip_space(p);
+    char* end;
+
+    if(accept(p, "(")) {
+        parse_binary(p, 0);
+        if(!accept(p, ")"))
+            p->failed = true;
+    }
+    else if(accept(p, "ram[")) {
+        parse_binary(p, 0);
+        emit(p, OP_RAM, 0);
+        if(!accept(p, "]"))
+            p->failed = true;
+    }
+    else if(*p->at == '$') {
+        int64_t value = strtoll(p->at + 1, &end, 16);
+        if(end == p->at + 1)
+            p->failed = true;
+        p->at = end;
+        emit(p, OP_CONST, value);
+        emit(p, OP_RAM, 0);
+    }
+    else if(isdigit((unsigned char)*p->at)) {
+        int64_t value = strtoll(p->at, &end, 0);
+        p->at = end;
+        emit(p, OP_CONST, value);
+    }
+    else {
+        p->failed = true;
+    }
+}
+
+static void parse_unary(parser* p) {
+
+    skip_space(p);
+    if(*p->at == '-' || *p->at == '!' || *p->at == '~') {
+        char c = *p->at++;
+        parse_unary(p);
+        emit(p, c == '-' ? OP_NEG : c == '!' ? OP_NOT : OP_INVERT, 0);
+    }
+    else {
+        parse_primary(p);
+    }
+}
+
+static const operator_token* next_operator(parser* p) {
+
+    skip_space(p);
+    for(size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if(strncmp(p->at, operators[i].token, strlen(operators[i].token)) == 0)
+            return &operators[i];
+    }
+    return NULL;
+}
+
+static void parse_binary(parser* p, int level) {
+
+    if(level == OPERATOR_LEVELS) {
+        parse_unary(p);
+        return;
+    }
+
+    parse_binary(p, level + 1);
+    const operator_token* op;
+    while(!p->failed && (op = next_operator(p)) && op->level == level) {
+        p->at += strlen(op->token);
+        parse_binary(p, level + 1);
+        emit(p, op->op, 0);
+    }
+}
+
+bool Compile_Expression(const char* text, search_expression* expression) {
+
+    parser p = {text, expression, 0, 0, false};
+    expression->length = 0;
+
+    parse_binary(&p, 0);
+    skip_space(&p);
+    if(p.failed || *p.at != '\0' || p.max_depth > SEARCH_STACK) {
+        printf("Bad score expression at: \"%s\"\n", p.at);
+        return false;
+    }
+    return true;
+}
+
+/*
+RAM addresses wrap to the 2kb of console RAM, like the $0000-$1fff mirrors.
+arithmetic wraps like the 64-bit registers it mimics, so no expression traps
+*/
+int64_t Evaluate_Expression(const search_expression* expression, const uint8_t* ram) {
+
+    int64_t stack[SEARCH_STACK];
+    int top = 0;
+
+    for(int i = 0; i < expression->length; i++) {
+        const search_instruction* in = &expression->program[i];
+        if(in->op == OP_CONST) {
+            stack[top++] = in->value;
+            continue;
+        }
+        if(in->op < OP_MUL) {
+            int64_t* a = &stack[top-1];
+            switch(in->op) {
+                case OP_RAM: *a = ram[*a & 0x7ff]; break;
+                case OP_NEG: *a = (int64_t)(0 - (uint64_t)*a); break;
+                case OP_NOT: *a = !*a; break;
+                case OP_INVERT: *a = ~*a; break;
+                default: break;
+            }
+            continue;
+        }
+
+        int64_t b = stack[--top];
+        int64_t* a = &stack[top-1];
+        switch(in->op) {
+            case OP_MUL: *a = (int64_t)((uint64_t)*a * (uint64_t)b); break;
+            case OP_DIV: *a = b == -1 ? (int64_t)(0 - (uint64_t)*a) : b ? *a / b : 0; break;
+            case OP_MOD: *a = b == -1 || !b ? 0 : *a % b; break;
+            case OP_ADD: *a = (int64_t)((uint64_t)*a + (uint64_t)b); break;
+            case OP_SUB: *a = (int64_t)((uint64_t)*a - (uint64_t)b); break;
+            case OP_SHL: *a = (int64_t)((uint64_t)*a << (b & 63)); break;
+            case OP_SHR: *a >>= (b & 63); break;
+            case OP_LT: *a = *a < b; break;
+            case OP_LE: *a = *a <= b; break;
+            case OP_GT: *a = *a > b; break;
+            case OP_GE: *a = *a >= b; break;
+            case OP_EQ: *a = *a == b; break;
+            case OP_NE: *a = *a != b; break;
+            case OP_AND: *a &= b; break;
+            case OP_XOR: *a ^= b; break;
+            case OP_OR: *a |= b; break;
+            case OP_LAND: *a = *a && b; break;
+            case OP_LOR: *a = *a || b; break;
+            default: break;
+        }
+    }
+    return top ? stack[0] : 0;
+}
+
+/*
+seen set. every key also keeps the smallest id that inserted it (depth in
+the high half, child index in the low), so which duplicate survives does
+not depend on which worker got there first
+*/
+static bool set_create(search_set* set, size_t expected) {
+
+    size_t capacity = 1 << 16;
+    while(capacity < expected * 2)
+        capacity <<= 1;
+
+    set->slots = calloc(capacity * 2, sizeof(uint64_t)); // key, owner pairs
+    set->mask = capacity - 1;
+    atomic_init(&set->count, 0);
+    if(!set->slots)
+        return false;
+
+    for(size_t i = 0; i < capacity; i++)
+        atomic_init(&set->slots[(i * 2) + 1], UINT64_MAX);
+    return true;
+}
+
+static size_t set_slot(search_set* set, uint64_t key) {
+
+    return (key * 0x9e3779b97f4a7c15ULL >> 20) & set->mask;
+}
+
+static void set_insert(search_set* set, uint64_t key, uint64_t id) {
+
+    key = key ? key : 1;
+    for(size_t i = set_slot(set, key), probes = 0; probes <= set->mask; i = (i + 1) & set->mask, probes++) {
+
+        uint64_t current = atomic_load(&set->slots[i * 2]);
+        if(current == 0) {
+            // a full table stops deduplicating rather than failing
+            if(atomic_load(&set->count) >= set->mask - (set->mask >> 2))
+                return;
+            if(atomic_compare_exchange_strong(&set->slots[i * 2], &current, key))
+                atomic_fetch_add(&set->count, 1);
+        }
+        if(current != 0 && current != key)
+            continue;
+
+        uint64_t owner = atomic_load(&set->slots[(i * 2) + 1]);
+        while(id < owner && !atomic_compare_exchange_weak(&set->slots[(i * 2) + 1], &owner, id));
+        return;
+    }
+}
+
+static uint64_t set_owner(search_set* set, uint64_t key) {
+
+    key = key ? key : 1;
+    for(size_t i = set_slot(set, key), probes = 0; probes <= set->mask; i = (i + 1) & set->mask, probes++) {
+        uint64_t current = atomic_load(&set->slots[i * 2]);
+        if(current == key)
+            return atomic_load(&set->slots[(i * 2) + 1]);
+        if(current == 0)
+            break;
+    }
+    return UINT64_MAX;
+}
+
+/*
+worker side
+*/
+static uint64_t node_id(int depth, int index) {
+
+    return ((uint64_t)depth << 32) | (uint32_t)index;
+}
+
+static void expand_parents(search* s, nes_machine* nes) {
+
+    int parent;
+    while((parent = atomic_fetch_add(&s->next_job, 1)) < s->parent_count) {
+
+        uint8_t* state = s->parents + (s->state_size * parent);
+        for(int a = 0; a < s->action_count; a++) {
+            int index = (parent * s->action_count) + a;
+
+            Load_State(nes, state, s->state_size);
+            button_set(nes, s->actions[a]);
+            for(int f = 0; f < s->frames_per_input; f++) {
+                Run_Frame(nes);
+            }
+
+            search_node* node = &s->nodes[index];
+            node->parent = parent;
+            node->action = a;
+            node->score = Evaluate_Expression(&s->score, nes->ram);
+            // the same RAM only counts as the same state at the same depth, a
+            // game waiting for vblank keeps its RAM as is while time goes on
+            s->hashes[index] = Hash_Bytes(nes->ram, sizeof(nes->ram), s->expanding);
+            set_insert(&s->seen, s->hashes[index], node_id(s->expanding, index));
+
+            Save_State(nes, s->children + (s->state_size * index), s->state_size);
+        }
+    }
+}
+
+static void* search_worker(void* arg) {
+
+    search_thread* thread = arg;
+    search* s = thread->owner;
+
+    int seen = 0;
+    pthread_mutex_lock(&s->lock);
+    while(true) {
+        while(s->generation == seen && !s->quit)
+            pthread_cond_wait(&s->start, &s->lock);
+        if(s->quit)
+            break;
+        seen = s->generation;
+        pthread_mutex_unlock(&s->lock);
+
+        expand_parents(s, thread->nes);
+
+        pthread_mutex_lock(&s->lock);
+        if(--s->busy == 0)
+            pthread_cond_signal(&s->finished);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+static void expand_depth(search* s, int depth) {
+
+    atomic_store(&s->next_job, 0);
+
+    pthread_mutex_lock(&s->lock);
+    s->expanding = depth;
+    s->busy = s->thread_count;
+    s->generation++;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+
+    expand_parents(s, s->machines[0]);
+
+    pthread_mutex_lock(&s->lock);
+    while(s->busy > 0)
+        pthread_cond_wait(&s->finished, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+typedef struct ranked {
+
+    int64_t score;
+    int index;
+
+} ranked;
+
+// best first, ties in child order so the result never depends on the thread count
+static int by_score(const void* a, const void* b) {
+
+    const ranked* x = a;
+    const ranked* y = b;
+    if(x->score != y->score)
+        return x->score < y->score ? 1 : -1;
+    return x->index - y->index;
+}
+
+static void destroy_search(search* s) {
+
+    if(s->thread_count) {
+        pthread_mutex_lock(&s->lock);
+        s->quit = true;
+        pthread_cond_broadcast(&s->start);
+        pthread_mutex_unlock(&s->lock);
+        for(int i = 0; i < s->thread_count; i++)
+            pthread_join(s->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->finished);
+
+    if(s->machines) {
+        for(int i = 0; i < s->machine_count; i++)
+            Destroy_Machine(s->machines[i]);
+    }
+    if(s->history) {
+        for(int d = 0; d <= s->depth; d++)
+            free(s->history[d]);
+    }
+
+    free(s->history);
+    free(s->machines);
+    free(s->threads);
+    free(s->thread_args);
+    free(s->parents);
+    free(s->children);
+    free(s->nodes);
+    free(s->hashes);
+    free((void*)s->seen.slots);
+}
+
+static double seconds_since(struct timespec* begin) {
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+/*
+--search: beam search from a save state (or power-on with "-"), printing
+the best input path found and saving the state it ends in next to the rom
+*/
+int Run_Search(char* rom_path, char* state_path, char* score, int depth, int beam, int frames_per_input, int workers) {
+
+    search s = {0};
+    if(!Compile_Expression(score, &s.score))
+        return 1;
+
+    s.rom = Parse_Rom(rom_path);
+    if(!s.rom)
+        return 1;
+
+    s.depth = depth > 0 ? depth : 1;
+    s.beam = beam > 0 ? beam : 1;
+    s.frames_per_input = frames_per_input > 0 ? frames_per_input : 1;
+    s.actions = default_actions;
+    s.action_count = sizeof(default_actions);
+    if(workers <= 0)
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    size_t children = (size_t)s.beam * s.action_count;
+    s.machines = calloc(workers, sizeof(nes_machine*));
+    s.machine_count = workers;
+    if(s.machines)
+        s.machines[0] = Create_Machine(s.rom, NULL);
+    if(!s.machines || !s.machines[0]) {
+        free(s.machines);
+        Free_Rom(s.rom);
+        return 1;
+    }
+    s.state_size = State_Size(s.machines[0]);
+    s.parents = malloc(s.state_size * s.beam);
+    s.children = malloc(s.state_size * children);
+    s.nodes = calloc(children, sizeof(search_node));
+    s.history = calloc(s.depth + 1, sizeof(search_node*));
+    s.hashes = malloc(sizeof(uint64_t) * children);
+    ranked* order = malloc(sizeof(ranked) * children);
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.start, NULL);
+    pthread_cond_init(&s.finished, NULL);
+
+    bool ok = s.parents && s.children && s.nodes && s.history && s.hashes && order
+        && set_create(&s.seen, children * s.depth);
+    if(ok && strcmp(state_path, "-") != 0 && !Load_State_File(s.machines[0], state_path)) {
+        printf("No usable state: %s\n", state_path);
+        ok = false;
+    }
+    if(!ok) {
+        free(order);
+        destroy_search(&s);
+        Free_Rom(s.rom);
+        return 1;
+    }
+
+    s.machines[0]->skip_render = true;
+    Save_State(s.machines[0], s.parents, s.state_size);
+    s.parent_count = 1;
+
+    s.threads = calloc(workers, sizeof(pthread_t));
+    s.thread_args = calloc(workers, sizeof(search_thread));
+    for(int i = 1; i < workers && s.threads && s.thread_args; i++) {
+        s.machines[i] = Create_Machine(s.rom, NULL);
+        if(!s.machines[i])
+            break;
+        s.machines[i]->skip_render = true;
+
+        s.thread_args[i] = (search_thread) {&s, s.machines[i]};
+        if(pthread_create(&s.threads[s.thread_count], NULL, search_worker, &s.thread_args[i]) != 0)
+            break;
+        s.thread_count++;
+    }
+
+    printf("searching %d deep, beam %d, %d actions x %d frames, %d threads\n",
+        s.depth, s.beam, s.action_count, s.frames_per_input, s.thread_count + 1);
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    long long tried = 0;
+    int reached = 0;
+
+    for(int d = 1; d <= s.depth; d++) {
+
+        expand_depth(&s, d);
+
+        // a child survives if it is the first anywhere to reach its RAM (UINT64_MAX: set full)
+        int count = s.parent_count * s.action_count;
+        int fresh = 0;
+        for(int i = 0; i < count; i++) {
+            uint64_t owner = set_owner(&s.seen, s.hashes[i]);
+            s.nodes[i].valid = owner == node_id(d, i) || owner == UINT64_MAX;
+            if(s.nodes[i].valid)
+                order[fresh++] = (ranked) {s.nodes[i].score, i};
+        }
+        tried += count;
+        if(fresh == 0)
+            break;
+
+        qsort(order, fresh, sizeof(ranked), by_score);
+
+        int survivors = fresh < s.beam ? fresh : s.beam;
+        s.history[d] = malloc(sizeof(search_node) * survivors);
+        for(int i = 0; i < survivors; i++) {
+            s.history[d][i] = s.nodes[order[i].index];
+            memcpy(s.parents + (s.state_size * i), s.children + (s.state_size * order[i].index), s.state_size);
+        }
+        s.parent_count = survivors;
+        reached = d;
+
+        printf("depth %d: %d tried, %d new, best score %lld\n", d, count, fresh, (long long)s.history[d][0].score);
+    }
+
+    double elapsed = seconds_since(&begin);
+    printf("%lld states in %.2fs, %.0f frames/s, %zu distinct\n",
+        tried, elapsed, tried * s.frames_per_input / elapsed, atomic_load(&s.seen.count));
+
+    if(reached) {
+        // walk the best leaf back to the root
+        printf("best score %lld:", (long long)s.history[reached][0].score);
+        int path[reached + 1];
+        for(int d = reached, i = 0; d >= 1; i = s.history[d][i].parent, d--)
+            path[d] = s.history[d][i].action;
+        for(int d = 1; d <= reached; d++)
+            printf(" %s", action_names[path[d]]);
+        printf("\n");
+
+        char best_path[512];
+        if(rom_sibling_path(rom_path, ".search.state", best_path, sizeof(best_path))) {
+            Load_State(s.machines[0], s.parents, s.state_size);
+            if(Save_State_File(s.machines[0], best_path))
+                printf("best state saved: %s\n", best_path);
+        }
+    }
+
+    free(order);
+    destroy_search(&s);
+    Free_Rom(s.rom);
+
+    return reached ? 0 : 1;
+}
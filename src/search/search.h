@@ -0,0 +1,124 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../machine.h"
+#include "../memory/rom.h"
+
+#define SEARCH_MAX_PROGRAM 256
+#define SEARCH_STACK 64
+
+/*
+scoring expression, compiled to a little stack program. C operators and
+precedence over 64 bit integers, with RAM read as $addr or ram[expr],
+e.g. "$86 + ram[$75] * 256 - ($b5 == 3) * 1000"
+*/
+typedef enum search_op {
+    OP_CONST, OP_RAM,
+    OP_NEG, OP_NOT, OP_INVERT,
+    OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+} search_op;
+
+typedef struct search_instruction {
+
+    search_op op;
+    int64_t value; // OP_CONST
+
+} search_instruction;
+
+typedef struct search_expression {
+
+    search_instruction program[SEARCH_MAX_PROGRAM];
+    int length;
+
+} search_expression;
+
+/*
+lock-free set of 64 bit state hashes, open addressing. 0 marks an empty
+slot so a hash of 0 is stored as 1
+*/
+typedef struct search_set {
+
+    _Atomic uint64_t* slots;
+    size_t mask;
+    atomic_size_t count;
+
+} search_set;
+
+struct search;
+
+typedef struct search_thread {
+
+    struct search* owner;
+    nes_machine* nes;
+
+} search_thread;
+
+typedef struct search_node {
+
+    int parent; // index in the previous depth
+    uint8_t action;
+    bool valid; // new state, not seen before
+    int64_t score;
+
+} search_node;
+
+/*
+beam search from one save state: every state of a depth is tried with
+every action for frames_per_input frames, children whose RAM another
+child of that depth already reached are dropped, the best scoring beam
+of the rest go on to the next depth. workers take parents off a shared counter and each has its own
+machine, so nothing but the seen set is shared.
+*/
+typedef struct search {
+
+    nes_rom* rom;
+    search_expression score;
+    int depth;
+    int beam;
+    int frames_per_input;
+
+    const uint8_t* actions;
+    int action_count;
+
+    size_t state_size;
+    uint8_t* parents; // beam states of the current depth
+    int parent_count;
+    uint8_t* children; // parent_count * action_count states
+    search_node* nodes;
+    search_node** history; // survivors of every depth, for the input path
+    search_set seen;
+
+    // worker pool, the calling thread works too
+    int thread_count;
+    pthread_t* threads;
+    search_thread* thread_args;
+    int machine_count;
+    nes_machine** machines; // one per thread, [0] is the caller's
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    int generation;
+    int busy;
+    bool quit;
+
+    // current depth
+    atomic_int next_job;
+    int expanding; // depth being expanded
+    uint64_t* hashes; // RAM hash of every child
+
+} search;
+
+bool Compile_Expression(const char* text, search_expression* expression);
+int64_t Evaluate_Expression(const search_expression* expression, const uint8_t* ram);
+
+int Run_Search(char* rom_path, char* state_path, char* score, int depth, int beam, int frames_per_input, int workers);
+
+#endif
@@ -0,0 +1,538 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "state.h"
+#include "memory/rom.h"
+#include "devices/controller.h"
+
+/*
+a struct saved member by member, packed back to back in this order. the
+padding the compiler put between them is never written or hashed, so a
+state and its hash only depend on the members and their sizes
+*/
+typedef struct state_member {
+    uint16_t offset;
+    uint16_t size;
+} state_member;
+
+#define MEMBER(type, field) {offsetof(type, field), sizeof(((type*)0)->field)}
+#define MEMBERS(list) list, sizeof(list) / sizeof(list[0])
+
+// a member added to one of these structs has to be added below too, and STATE_VERSION bumped
+_Static_assert(sizeof(cpu_state) == 32, "cpu_state changed, update cpu_members");
+_Static_assert(sizeof(ppu_state) == 372, "ppu_state changed, update ppu_members");
+_Static_assert(sizeof(apu_state) == 160, "apu_state changed, update apu_members");
+_Static_assert(sizeof(controller_state) == 5, "controller_state changed, update controller_members");
+_Static_assert(offsetof(memory_mapper, work_ram) - offsetof(memory_mapper, type) == 51, "memory_mapper changed, update mapper_members");
+
+static const state_member cpu_members[] = {
+    MEMBER(cpu_state, pc), MEMBER(cpu_state, sp), MEMBER(cpu_state, status), MEMBER(cpu_state, accumulator),
+    MEMBER(cpu_state, index_x), MEMBER(cpu_state, index_y), MEMBER(cpu_state, irq), MEMBER(cpu_state, nmi),
+    MEMBER(cpu_state, breakpoint), MEMBER(cpu_state, cycles), MEMBER(cpu_state, stall), MEMBER(cpu_state, stall_align)
+};
+
+static const state_member ppu_members[] = {
+    MEMBER(ppu_state, scanline), MEMBER(ppu_state, dot), MEMBER(ppu_state, frame), MEMBER(ppu_state, frame_complete),
+    MEMBER(ppu_state, ppu_address), MEMBER(ppu_state, ppu_address_temp), MEMBER(ppu_state, fine_x),
+    MEMBER(ppu_state, latch), MEMBER(ppu_state, data_buffer), MEMBER(ppu_state, rendering_enabled),
+    MEMBER(ppu_state, render_s0), MEMBER(ppu_state, a12_rise_dot), MEMBER(ppu_state, a12), MEMBER(ppu_state, ppu_reg),
+    MEMBER(ppu_state, OAM_memory), MEMBER(ppu_state, OAM_memory_secondary)
+};
+
+#define ENVELOPE_MEMBERS(e) \
+    MEMBER(apu_state, e.start), MEMBER(apu_state, e.loop), MEMBER(apu_state, e.constant), \
+    MEMBER(apu_state, e.volume), MEMBER(apu_state, e.divider), MEMBER(apu_state, e.decay)
+
+#define PULSE_MEMBERS(p) \
+    MEMBER(apu_state, p.timer), MEMBER(apu_state, p.period), MEMBER(apu_state, p.timer_reload), \
+    MEMBER(apu_state, p.duty), MEMBER(apu_state, p.step), MEMBER(apu_state, p.length), ENVELOPE_MEMBERS(p.envelope), \
+    MEMBER(apu_state, p.sweep_enabled), MEMBER(apu_state, p.sweep_negate), MEMBER(apu_state, p.sweep_reload), \
+    MEMBER(apu_state, p.sweep_period), MEMBER(apu_state, p.sweep_shift), MEMBER(apu_state, p.sweep_divider), \
+    MEMBER(apu_state, p.output)
+
+static const state_member apu_members[] = {
+    MEMBER(apu_state, cycle), MEMBER(apu_state, frame_start), MEMBER(apu_state, frame_next),
+    MEMBER(apu_state, frame_step), MEMBER(apu_state, frame_five_step), MEMBER(apu_state, frame_irq_inhibit),
+    MEMBER(apu_state, frame_irq), MEMBER(apu_state, enabled), MEMBER(apu_state, event_next),
+    PULSE_MEMBERS(pulse[0]),
+    PULSE_MEMBERS(pulse[1]),
+    MEMBER(apu_state, triangle.timer), MEMBER(apu_state, triangle.timer_reload), MEMBER(apu_state, triangle.step),
+    MEMBER(apu_state, triangle.length), MEMBER(apu_state, triangle.control), MEMBER(apu_state, triangle.linear_reload_flag),
+    MEMBER(apu_state, triangle.linear_reload), MEMBER(apu_state, triangle.linear), MEMBER(apu_state, triangle.output),
+    MEMBER(apu_state, noise.timer), MEMBER(apu_state, noise.period), MEMBER(apu_state, noise.shift),
+    MEMBER(apu_state, noise.mode), MEMBER(apu_state, noise.length), ENVELOPE_MEMBERS(noise.envelope),
+    MEMBER(apu_state, noise.output),
+    MEMBER(apu_state, dmc.timer), MEMBER(apu_state, dmc.period), MEMBER(apu_state, dmc.irq_enabled),
+    MEMBER(apu_state, dmc.loop), MEMBER(apu_state, dmc.irq), MEMBER(apu_state, dmc.sample_address),
+    MEMBER(apu_state, dmc.sample_length), MEMBER(apu_state, dmc.address), MEMBER(apu_state, dmc.bytes_remaining),
+    MEMBER(apu_state, dmc.buffer), MEMBER(apu_state, dmc.buffer_full), MEMBER(apu_state, dmc.shift),
+    MEMBER(apu_state, dmc.bits), MEMBER(apu_state, dmc.silence), MEMBER(apu_state, dmc.output)
+};
+
+static const state_member controller_members[] = {
+    MEMBER(controller_state, strobe), MEMBER(controller_state, pads), MEMBER(controller_state, shift)
+};
+
+// bank windows, rom and prg ram pointers are left out and rebuilt on load
+static const state_member mapper_members[] = {
+    MEMBER(memory_mapper, type), MEMBER(memory_mapper, prg_length), MEMBER(memory_mapper, chr_length),
+    MEMBER(memory_mapper, prg_ram_length), MEMBER(memory_mapper, prg_ram_bank), MEMBER(memory_mapper, prg_bank_0),
+    MEMBER(memory_mapper, prg_bank_1), MEMBER(memory_mapper, chr_bank_0), MEMBER(memory_mapper, chr_bank_1),
+    MEMBER(memory_mapper, registers), MEMBER(memory_mapper, mirroring), MEMBER(memory_mapper, bank_select),
+    MEMBER(memory_mapper, irq_latch), MEMBER(memory_mapper, irq_counter), MEMBER(memory_mapper, irq_reload),
+    MEMBER(memory_mapper, irq_enabled), MEMBER(memory_mapper, irq_asserted)
+};
+
+#define STATE_PACKED_MAX 512 // largest packed struct, ppu_state
+_Static_assert(sizeof(ppu_state) <= STATE_PACKED_MAX, "raise STATE_PACKED_MAX");
+
+/*
+a section is either plain bytes (members NULL) or a struct packed from
+its members
+*/
+typedef struct state_field {
+    uint32_t id;
+    uint8_t* data;
+    uint32_t size; // as saved
+    const state_member* members;
+    int member_count;
+} state_field;
+
+static size_t padded(size_t size) {
+
+    return (size + 7) & ~(size_t)7;
+}
+
+static state_field packed_field(uint32_t id, void* data, const state_member* members, int count) {
+
+    uint32_t size = 0;
+    for(int i = 0; i < count; i++)
+        size += members[i].size;
+    return (state_field) {id, data, size, members, count};
+}
+
+static void save_field(const state_field* field, uint8_t* out) {
+
+    if(!field->members) {
+        memcpy(out, field->data, field->size);
+        return;
+    }
+    for(int i = 0; i < field->member_count; i++) {
+        memcpy(out, field->data + field->members[i].offset, field->members[i].size);
+        out += field->members[i].size;
+    }
+}
+
+static void load_field(const state_field* field, const uint8_t* in) {
+
+    if(!field->members) {
+        memcpy(field->data, in, field->size);
+        return;
+    }
+    for(int i = 0; i < field->member_count; i++) {
+        memcpy(field->data + field->members[i].offset, in, field->members[i].size);
+        in += field->members[i].size;
+    }
+}
+
+/*
+the fixed section list, pointing at the live machine
+*/
+static int state_fields(nes_machine* nes, state_field* fields) {
+
+    memory_mapper* mapper = &nes->mapper;
+
+    int n = 0;
+    fields[n++] = packed_field(STATE_ID('C','P','U',' '), &nes->cpu, MEMBERS(cpu_members));
+    fields[n++] = packed_field(STATE_ID('P','P','U',' '), &nes->ppu, MEMBERS(ppu_members));
+    fields[n++] = (state_field) {STATE_ID('R','A','M',' '), nes->ram, sizeof(nes->ram)};
+    fields[n++] = (state_field) {STATE_ID('C','I','R','M'), nes->vram + 0x2000, 0x2000}; // name tables + palette
+    fields[n++] = packed_field(STATE_ID('M','A','P','R'), mapper, MEMBERS(mapper_members));
+    fields[n++] = (state_field) {STATE_ID('P','R','A','M'), mapper->prg_ram, 0x2000};
+    fields[n++] = (state_field) {STATE_ID('C','R','A','M'), mapper->chr_ram, mapper->chr_length == 0 ? 0x2000 : 0};
+    fields[n++] = (state_field) {STATE_ID('A','P','U',' '), nes->apu_reg, sizeof(nes->apu_reg)};
+    fields[n++] = packed_field(STATE_ID('S','N','D',' '), &nes->apu, MEMBERS(apu_members));
+    fields[n++] = packed_field(STATE_ID('C','T','R','L'), &nes->controller, MEMBERS(controller_members));
+    fields[n++] = (state_field) {STATE_ID('B','U','S',' '), &nes->open_bus, 1};
+
+    return n;
+}
+
+size_t State_Size(nes_machine* nes) {
+
+    state_field fields[STATE_MAX_SECTIONS];
+    int count = state_fields(nes, fields);
+
+    size_t size = sizeof(state_header);
+    for(int i = 0; i < count; i++) {
+        size += sizeof(state_section) + padded(fields[i].size);
+    }
+    return size;
+}
+
+/*
+returns the bytes written, 0 when the buffer is too small. never allocates
+*/
+size_t Save_State(nes_machine* nes, uint8_t* buffer, size_t capacity) {
+
+    state_field fields[STATE_MAX_SECTIONS];
+    int count = state_fields(nes, fields);
+
+    size_t size = State_Size(nes);
+    if(capacity < size)
+        return 0;
+
+    state_header* header = (state_header*)buffer;
+    memcpy(header->magic, "NESSTATE", 8);
+    header->version = STATE_VERSION;
+    header->size = size;
+    header->crc32 = nes->rom->identity.crc32;
+    header->section_count = count;
+
+    uint8_t* out = buffer + sizeof(state_header);
+    for(int i = 0; i < count; i++) {
+        state_section* section = (state_section*)out;
+        section->id = fields[i].id;
+        section->size = fields[i].size;
+        out += sizeof(state_section);
+
+        save_field(&fields[i], out);
+        memset(out + fields[i].size, 0, padded(fields[i].size) - fields[i].size);
+        out += padded(fields[i].size);
+    }
+
+    return size;
+}
+
+/*
+the whole buffer is checked against this machine's layout before
+anything is copied, so a rejected state leaves the machine untouched
+*/
+bool Load_State(nes_machine* nes, const uint8_t* buffer, size_t size) {
+
+    state_field fields[STATE_MAX_SECTIONS];
+    int count = state_fields(nes, fields);
+
+    const state_header* header = (const state_header*)buffer;
+    if(size < sizeof(state_header) || memcmp(header->magic, "NESSTATE", 8) != 0)
+        return false;
+    if(header->version != STATE_VERSION || header->size != size || header->size != State_Size(nes))
+        return false;
+    if(header->crc32 != nes->rom->identity.crc32 || header->section_count != (uint32_t)count)
+        return false;
+
+    const uint8_t* in = buffer + sizeof(state_header);
+    for(int i = 0; i < count; i++) {
+        const state_section* section = (const state_section*)in;
+        if(section->id != fields[i].id || section->size != fields[i].size)
+            return false;
+        in += sizeof(state_section) + padded(fields[i].size);
+    }
+
+    in = buffer + sizeof(state_header);
+    for(int i = 0; i < count; i++) {
+        in += sizeof(state_section);
+        load_field(&fields[i], in);
+        in += padded(fields[i].size);
+    }
+
+    mapper_rebuild_pages(&nes->mapper);
+    nes->sprites.dirty = true;
+    if(nes->mapper.prg_ram_battery)
+        nes->mapper.prg_ram_dirty = true;
+
+    return true;
+}
+
+#define HASH_PRIME 0x9e3779b97f4a7c15ULL
+
+static uint64_t hash_mix(uint64_t x) {
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+four 64 bit lanes over 32 byte blocks: lane += word + lo32(k) * hi32(k),
+k = word ^ a key that moves on every block so the order of blocks counts.
+that is one 32x32->64 multiply per word, which SSE2 does two at a time;
+the plain C version gives the same result
+*/
+static void hash_blocks(uint64_t* lanes, const uint8_t* data, size_t blocks, uint64_t* keys) {
+
+#ifdef __SSE2__
+    __m128i lane_a = _mm_loadu_si128((const __m128i*)lanes);
+    __m128i lane_b = _mm_loadu_si128((const __m128i*)(lanes + 2));
+    __m128i key_a = _mm_loadu_si128((const __m128i*)keys);
+    __m128i key_b = _mm_loadu_si128((const __m128i*)(keys + 2));
+    __m128i step = _mm_set1_epi64x(HASH_PRIME);
+
+    for(size_t i = 0; i < blocks; i++, data += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)data);
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + 16));
+        __m128i ka = _mm_xor_si128(a, key_a);
+        __m128i kb = _mm_xor_si128(b, key_b);
+        lane_a = _mm_add_epi64(lane_a, _mm_add_epi64(a, _mm_mul_epu32(ka, _mm_srli_epi64(ka, 32))));
+        lane_b = _mm_add_epi64(lane_b, _mm_add_epi64(b, _mm_mul_epu32(kb, _mm_srli_epi64(kb, 32))));
+        key_a = _mm_add_epi64(key_a, step);
+        key_b = _mm_add_epi64(key_b, step);
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, lane_a);
+    _mm_storeu_si128((__m128i*)(lanes + 2), lane_b);
+    _mm_storeu_si128((__m128i*)keys, key_a);
+    _mm_storeu_si128((__m128i*)(keys + 2), key_b);
+#else
+    for(size_t i = 0; i < blocks; i++, data += 32) {
+        for(int l = 0; l < 4; l++) {
+            uint64_t word;
+            memcpy(&word, data + (l * 8), 8);
+            uint64_t k = word ^ keys[l];
+            lanes[l] += word + (k & 0xffffffff) * (k >> 32);
+            keys[l] += HASH_PRIME;
+        }
+    }
+#endif
+}
+
+uint64_t Hash_Bytes(const void* data, size_t size, uint64_t seed) {
+
+    uint64_t lanes[4] = {seed, seed ^ HASH_PRIME, seed + HASH_PRIME, ~seed};
+    uint64_t keys[4] = {0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL, 0xa4093822299f31d0ULL, 0x082efa98ec4e6c89ULL};
+
+    size_t blocks = size / 32;
+    hash_blocks(lanes, data, blocks, keys);
+
+    // the tail as one zero padded block, the size below tells them apart
+    size_t tail = size - (blocks * 32);
+    if(tail) {
+        uint8_t last[32] = {0};
+        memcpy(last, (const uint8_t*)data + (blocks * 32), tail);
+        hash_blocks(lanes, last, 1, keys);
+    }
+
+    uint64_t hash = hash_mix(seed ^ (size * HASH_PRIME));
+    for(int l = 0; l < 4; l++) {
+        hash = (hash ^ hash_mix(lanes[l])) * HASH_PRIME;
+    }
+    return hash_mix(hash);
+}
+
+static void hash_total(state_hash* hash) {
+
+    hash->total = Hash_Bytes(hash->sections, sizeof(uint64_t) * hash->count, hash->count);
+}
+
+/*
+about a microsecond for a whole machine, cheap enough for every frame
+*/
+void Hash_Machine(nes_machine* nes, state_hash* hash) {
+
+    state_field fields[STATE_MAX_SECTIONS];
+    hash->count = state_fields(nes, fields);
+
+    for(int i = 0; i < hash->count; i++) {
+        hash->ids[i] = fields[i].id;
+        if(fields[i].members) {
+            uint8_t packed[STATE_PACKED_MAX];
+            save_field(&fields[i], packed);
+            hash->sections[i] = Hash_Bytes(packed, fields[i].size, fields[i].id);
+        }
+        else {
+            hash->sections[i] = Hash_Bytes(fields[i].data, fields[i].size, fields[i].id);
+        }
+    }
+    hash_total(hash);
+}
+
+/*
+same hash for a state from Save_State(), without loading it. false if the
+buffer is not a state
+*/
+bool Hash_State(const uint8_t* buffer, size_t size, state_hash* hash) {
+
+    const state_header* header = (const state_header*)buffer;
+    if(size < sizeof(state_header) || memcmp(header->magic, "NESSTATE", 8) != 0)
+        return false;
+    if(header->size != size || header->section_count > STATE_MAX_SECTIONS)
+        return false;
+
+    const uint8_t* in = buffer + sizeof(state_header);
+    const uint8_t* end = buffer + size;
+    hash->count = header->section_count;
+    for(int i = 0; i < hash->count; i++) {
+        const state_section* section = (const state_section*)in;
+        if((size_t)(end - in) < sizeof(state_section) || (size_t)(end - in) - sizeof(state_section) < padded(section->size))
+            return false;
+
+        in += sizeof(state_section);
+        hash->ids[i] = section->id;
+        hash->sections[i] = Hash_Bytes(in, section->size, section->id);
+        in += padded(section->size);
+    }
+    hash_total(hash);
+    return true;
+}
+
+/*
+index of the first section that differs, -1 when the states match
+*/
+int State_Hash_Diff(const state_hash* a, const state_hash* b) {
+
+    if(a->total == b->total)
+        return -1;
+    for(int i = 0; i < a->count && i < b->count; i++) {
+        if(a->ids[i] != b->ids[i] || a->sections[i] != b->sections[i])
+            return i;
+    }
+    return a->count < b->count ? a->count : b->count;
+}
+
+bool Save_State_File(nes_machine* nes, const char* path) {
+
+    size_t size = State_Size(nes);
+    uint8_t* buffer = malloc(size);
+    if(!buffer)
+        return false;
+
+    Save_State(nes, buffer, size);
+
+    FILE* file = fopen(path, "wb");
+    bool ok = file && fwrite(buffer, 1, size, file) == size;
+    if(file)
+        ok = (fclose(file) == 0) && ok;
+
+    free(buffer);
+    return ok;
+}
+
+bool Load_State_File(nes_machine* nes, const char* path) {
+
+    size_t size = State_Size(nes);
+    uint8_t* buffer = malloc(size + 1);
+    if(!buffer)
+        return false;
+
+    FILE* file = fopen(path, "rb");
+    size_t read_size = file ? fread(buffer, 1, size + 1, file) : 0;
+    if(file)
+        fclose(file);
+
+    bool ok = read_size == size && Load_State(nes, buffer, size);
+
+    free(buffer);
+    return ok;
+}
+
+/*
+--state-bench: save+load round trip time on a running machine
+*/
+int Run_State_Bench(char* rom_path, int iterations) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    if(!nes) {
+        Free_Rom(rom);
+        return 1;
+    }
+    for(int i = 0; i < 60; i++) {
+        Run_Frame(nes);
+    }
+
+    size_t size = State_Size(nes);
+    uint8_t* buffer = malloc(size);
+    if(!buffer) {
+        Destroy_Machine(nes);
+        Free_Rom(rom);
+        return 1;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    bool ok = true;
+    for(int i = 0; i < iterations && ok; i++) {
+        ok = Save_State(nes, buffer, size) == size && Load_State(nes, buffer, size);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    if(ok)
+        printf("state %zu bytes, save+load %.3f us\n", size, seconds * 1e6 / iterations);
+    else
+        printf("state round trip failed\n");
+
+    free(buffer);
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return ok ? 0 : 1;
+}
+
+/*
+--hash: one line per frame, the hash of the machine at the start of the
+frame and of each section, for a fixed scripted input. two builds (or
+engines) are compared by diffing their output, the first differing line
+and column give the frame and the section
+*/
+int Run_Hash_Log(char* rom_path, int frames) {
+
+    nes_rom* rom = Parse_Rom(rom_path);
+    if(!rom)
+        return 1;
+
+    nes_machine* nes = Create_Machine(rom, NULL);
+    if(!nes) {
+        Free_Rom(rom);
+        return 1;
+    }
+
+    state_hash hash;
+    Hash_Machine(nes, &hash);
+    printf("frame total           ");
+    for(int i = 0; i < hash.count; i++) {
+        printf(" %-16.4s", (const char*)&hash.ids[i]);
+    }
+    printf("\n");
+
+    double hashing = 0;
+    for(int f = 0; f < frames; f++) {
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        Hash_Machine(nes, &hash);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        hashing += (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+        printf("%5d %016llx", f, (unsigned long long)hash.total);
+        for(int i = 0; i < hash.count; i++) {
+            printf(" %016llx", (unsigned long long)hash.sections[i]);
+        }
+        printf("\n");
+
+        button_set(nes, (f / 8) & 0xff);
+        Run_Frame(nes);
+    }
+
+    fprintf(stderr, "%d frames, hash %.3f us per frame\n", frames, frames ? hashing * 1e6 / frames : 0);
+
+    Destroy_Machine(nes);
+    Free_Rom(rom);
+
+    return 0;
+}
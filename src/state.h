@@ -0,0 +1,75 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "machine.h"
+
+#define STATE_VERSION 8
+#define STATE_MAX_SECTIONS 11
+#define STATE_ID(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/*
+save state layout:
+    state_header
+    state_section + payload (padded to 8 bytes), for each section in a
+    fixed order: CPU, PPU, RAM, CIRAM, mapper registers, PRG RAM, CHR RAM,
+    APU registers, APU channels, controller, open bus
+
+the layout only depends on the version and the cart (CHR RAM is empty
+for CHR ROM games), so a buffer from State_Size() can be reused forever
+and saving is a handful of memcpys. structs are saved member by member
+without their padding, states and hashes mean the same to any compiler
+with the same type sizes. the frame buffer and sprite priority
+map are not saved, states are meant to be taken between frames.
+*/
+typedef struct state_header {
+
+    char magic[8]; // "NESSTATE"
+    uint32_t version;
+    uint32_t size; // header and all sections
+    uint32_t crc32; // rom PRG+CHR, a state only loads into the same game
+    uint32_t section_count;
+
+} state_header;
+
+typedef struct state_section {
+
+    uint32_t id; // STATE_ID fourcc
+    uint32_t size; // payload bytes, before padding
+
+} state_section;
+
+/*
+64 bit hash of every section on its own and of all of them together, the
+same whether taken from a running machine or a saved state. two machines
+that hash the same at a frame boundary are in the same state, the first
+differing section says which part went wrong
+*/
+typedef struct state_hash {
+
+    uint64_t total;
+    int count;
+    uint32_t ids[STATE_MAX_SECTIONS];
+    uint64_t sections[STATE_MAX_SECTIONS];
+
+} state_hash;
+
+size_t State_Size(nes_machine* nes);
+size_t Save_State(nes_machine* nes, uint8_t* buffer, size_t capacity);
+bool Load_State(nes_machine* nes, const uint8_t* buffer, size_t size);
+
+bool Save_State_File(nes_machine* nes, const char* path);
+bool Load_State_File(nes_machine* nes, const char* path);
+
+uint64_t Hash_Bytes(const void* data, size_t size, uint64_t seed);
+void Hash_Machine(nes_machine* nes, state_hash* hash);
+bool Hash_State(const uint8_t* buffer, size_t size, state_hash* hash);
+int State_Hash_Diff(const state_hash* a, const state_hash* b);
+
+int Run_State_Bench(char* rom_path, int iterations);
+int Run_Hash_Log(char* rom_path, int frames);
+
+#endif